@@ -1298,13 +1298,17 @@ static void icbReport(void *drvPvt, FILE *fp, int details)
 {
     drvIcbAsynPvt *pPvt = (drvIcbAsynPvt *)drvPvt;
     icbModule *module;
+    int ni_module, icb_addr;
 
     assert(pPvt);
     fprintf(fp, "ICB port %s:\n", pPvt->portName);
     if (details >= 1) {
         module = &pPvt->icbModule;
-        if (module->defined == icbFound) 
+        if (module->defined == icbFound) {
             fprintf(fp, "  module address: %s OK\n", module->address);
+            if (parse_ICB_address(module->address, &ni_module, &icb_addr) == OK)
+                nmc_report_module(fp, ni_module);
+        }
         else if (module->defined == icbNotFound) 
             fprintf(fp, "  module address: %s NOT FOUND\n", module->address);
     }
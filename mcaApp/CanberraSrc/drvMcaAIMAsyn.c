@@ -2,6 +2,10 @@
     Author: Mark Rivers
 
    27-June-2004  Converted from mcaAIMServer.cc
+   19-Oct-2026   Choose compressed or uncompressed spectrum reads from the
+                 measured transfer rate of each, aimTransferMode overrides
+   19-Oct-2026   Fall back to the other transfer mode after repeated failures,
+                 added the AIM_TRANSFER_MODE override and transfer rate parameters
 */
 
 #include <stdlib.h>
@@ -26,12 +30,26 @@
 #include "nmc_sys_defs.h"
 #include <epicsExport.h>
 
+/* Commands for this driver only, they follow the mca commands */
+#define aimTransferModeString           "AIM_TRANSFER_MODE"        /* int32, read/write */
+#define aimTransferModeInUseString      "AIM_TRANSFER_MODE_IN_USE" /* int32, read */
+#define aimUncompressedRateString       "AIM_UNCOMPRESSED_RATE"    /* float64, read */
+#define aimCompressedRateString         "AIM_COMPRESSED_RATE"      /* float64, read */
+
+typedef enum {
+    aimTransferModeCommand = MAX_MCA_COMMANDS,
+    aimTransferModeInUse,
+    aimUncompressedRate,
+    aimCompressedRate
+} aimCommand;
+#define MAX_AIM_COMMANDS (MAX_MCA_COMMANDS + 4)
+
 typedef struct {
-    mcaCommand command;
+    int command;
     char *commandString;
 } mcaCommandStruct;
 
-static mcaCommandStruct mcaCommands[MAX_MCA_COMMANDS] = {
+static mcaCommandStruct mcaCommands[MAX_AIM_COMMANDS] = {
     {mcaStartAcquire,           mcaStartAcquireString},           /* int32, write */
     {mcaStopAcquire,            mcaStopAcquireString},            /* int32, write */
     {mcaErase,                  mcaEraseString},                  /* int32, write */
@@ -52,9 +70,42 @@ static mcaCommandStruct mcaCommands[MAX_MCA_COMMANDS] = {
     {mcaAcquiring,              mcaAcquiringString},              /* int32, read */
     {mcaElapsedLiveTime,        mcaElapsedLiveTimeString},        /* float64, read */
     {mcaElapsedRealTime,        mcaElapsedRealTimeString},        /* float64, read */
-    {mcaElapsedCounts,          mcaElapsedCountsString}           /* float64, read */
+    {mcaElapsedCounts,          mcaElapsedCountsString},          /* float64, read */
+    {aimTransferModeCommand,    aimTransferModeString},           /* int32, read/write */
+    {aimTransferModeInUse,      aimTransferModeInUseString},      /* int32, read */
+    {aimUncompressedRate,       aimUncompressedRateString},       /* float64, read */
+    {aimCompressedRate,         aimCompressedRateString}          /* float64, read */
 };
 
+/* Spectrum transfer modes, AIM_TRANSFER_MODE or aimTransferMode selects one or leaves
+ * it to the driver */
+typedef enum {
+    aimTransferAuto,
+    aimTransferUncompressed,
+    aimTransferCompressed
+} aimTransferModeType;
+#define AIM_TRANSFER_MODES 3
+
+/* Weight of each new transfer rate measurement in the running average */
+#define AIM_TRANSFER_RATE_WEIGHT 0.25
+/* In automatic mode the slower transfer mode is measured again every this many reads */
+#define AIM_TRANSFER_PROBE_INTERVAL 20
+/* In automatic mode a transfer mode which failed this many times in a row is only
+ * used for the reads which measure the slower mode */
+#define AIM_TRANSFER_MAX_FAILURES 3
+
+static char *aimTransferModeNames[AIM_TRANSFER_MODES] = {"auto", "uncompressed", "compressed"};
+
+int aimTransferMode = aimTransferAuto;
+
+typedef struct {
+    double rate;            /* Average transfer rate, spectrum bytes/second */
+    double lastRate;
+    int reads;
+    int failures;           /* Failed reads since the last good one */
+    int totalFailures;
+} aimTransferStats;
+
 typedef struct {
     int module;
     int adc;
@@ -79,6 +130,10 @@ typedef struct {
     epicsTimeStamp statusTime;
     double maxStatusTime;
     int acquiring;
+    aimTransferModeType transferModeSetting;
+    aimTransferModeType transferMode;
+    int transferReads;
+    aimTransferStats transferStats[AIM_TRANSFER_MODES];
     asynInterface common;
     asynInterface int32;
     asynInterface float64;
@@ -117,6 +172,7 @@ static asynStatus AIMDisconnect     (void *drvPvt, asynUser *pasynUser);
 
 /* Private methods */
 static int sendAIMSetup(mcaAIMPvt *drvPvt);
+static aimTransferModeType chooseTransferMode(mcaAIMPvt *pPvt);
 static asynStatus AIMWrite(void *drvPvt, asynUser *pasynUser,
                            epicsInt32 ivalue, epicsFloat64 dvalue);
 static asynStatus AIMRead(void *drvPvt, asynUser *pasynUser,
@@ -236,6 +292,17 @@ int AIMConfig(
     }
     pPvt->seq_address = pPvt->base_address;
 
+    /* Start with the transfer mode that was measured to be faster on each module type.
+     * It is 40% faster to read compressed data on the original 556 model, 300% faster
+     * to read uncompressed data on the 556A, and 230% faster to read uncompressed data
+     * on the DSA2000.  The hw_revision of the 556 is 0, 556A is 1, and DS2000 is 2.
+     * The real difference also depends on how sparse the spectrum is and the network
+     * load, so int32ArrayRead measures both modes and then uses the faster one. */
+    if (nmc_module_info[pPvt->module].hw_revision == 0)
+        pPvt->transferMode = aimTransferCompressed;
+    else
+        pPvt->transferMode = aimTransferUncompressed;
+
     pPvt->ethernetDevice = epicsStrDup(ethernetDevice);
     pPvt->portName = epicsStrDup(portName);
 
@@ -314,7 +381,7 @@ static asynStatus AIMWrite(void *drvPvt, asynUser *pasynUser,
                            epicsInt32 ivalue, epicsFloat64 dvalue)
 {
     mcaAIMPvt *pPvt = (mcaAIMPvt *)drvPvt;
-    mcaCommand command=pasynUser->reason;
+    int command=pasynUser->reason;
     asynStatus status=asynSuccess;
     int len;
     int address, seq;
@@ -450,6 +517,16 @@ static asynStatus AIMWrite(void *drvPvt, asynUser *pasynUser,
             pPvt->ptotal = dvalue;
             status = sendAIMSetup(pPvt);
             break;
+        case aimTransferModeCommand:
+            /* Force a transfer mode for this port, auto leaves it to aimTransferMode */
+            if ((ivalue < aimTransferAuto) || (ivalue > aimTransferCompressed)) {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+                          "mcaAIMAsynDriver::command port %s illegal transfer mode %d\n",
+                          pPvt->portName, ivalue);
+                return(asynError);
+            }
+            pPvt->transferModeSetting = (aimTransferModeType)ivalue;
+            break;
         default:
             asynPrint(pasynUser, ASYN_TRACE_ERROR, 
                       "mcaAIMAsynDriver::command port %s got illegal command %d\n",
@@ -476,7 +553,7 @@ static asynStatus AIMRead(void *drvPvt, asynUser *pasynUser,
                           epicsInt32 *pivalue, epicsFloat64 *pfvalue)
 {
     mcaAIMPvt *pPvt = (mcaAIMPvt *)drvPvt;
-    mcaCommand command = pasynUser->reason;
+    int command = pasynUser->reason;
     asynStatus status=asynSuccess;
 
     switch (command) {
@@ -495,6 +572,18 @@ static asynStatus AIMRead(void *drvPvt, asynUser *pasynUser,
         case mcaElapsedCounts:
             *pfvalue = pPvt->etotals;
             break;
+        case aimTransferModeCommand:
+            *pivalue = pPvt->transferModeSetting;
+            break;
+        case aimTransferModeInUse:
+            *pivalue = pPvt->transferMode;
+            break;
+        case aimUncompressedRate:
+            *pfvalue = pPvt->transferStats[aimTransferUncompressed].rate;
+            break;
+        case aimCompressedRate:
+            *pfvalue = pPvt->transferStats[aimTransferCompressed].rate;
+            break;
         default:
             asynPrint(pasynUser, ASYN_TRACE_ERROR,
                       "drvMcaAIMAsyn::AIMRead got illegal command %d\n",
@@ -522,7 +611,10 @@ static asynStatus int32ArrayRead(void *drvPvt, asynUser *pasynUser,
     int status;
     int address;
     int signal;
-    struct nmc_module_info_struct minfo = nmc_module_info[pPvt->module];
+    aimTransferModeType mode;
+    aimTransferStats *stats;
+    epicsTimeStamp start, end;
+    double seconds, rate;
 
     pasynManager->getAddr(pasynUser, &signal);
 
@@ -532,23 +624,45 @@ static asynStatus int32ArrayRead(void *drvPvt, asynUser *pasynUser,
 
     address = pPvt->seq_address + pPvt->maxChans*signal*4;
  
-    /* There is a real performance difference between reading compressed and
-     * uncompressed data on different module types.  It is 40% faster to
-     * read compressed data on the original 556 model, 300% faster to read 
-     * uncompresed data on the 556A, and 230% faster to read uncompressed data
-     * on the DSA2000.  The hw_revision of the 556 is 0, 556A is 1, and DS2000 is 2.
-     * We read compressed for 556 and uncompressed for others.
-     */
-    if (minfo.hw_revision == 0) {
+    mode = chooseTransferMode(pPvt);
+    epicsTimeGetCurrent(&start);
+    if (mode == aimTransferCompressed) {
         status = nmc_acqu_getmemory_cmp(pPvt->module, pPvt->adc, address, 1, 1, 1, 
                                         maxChans, data);
     } else {
         status = nmc_acqu_getmemory(pPvt->module, pPvt->adc, address, 1, 1, 1, 
                                     maxChans, data);
     }
+    epicsTimeGetCurrent(&end);
     asynPrint(pasynUser, ASYN_TRACE_FLOW, 
-              "(mcaAIMAsynDriver [%s signal=%d]): read %d chans, status=%d\n", 
-              pPvt->portName, signal, maxChans, status);
+              "(mcaAIMAsynDriver [%s signal=%d]): read %d chans %s, status=%d\n", 
+              pPvt->portName, signal, maxChans, aimTransferModeNames[mode], status);
+
+    /* Both functions return ERROR on failure, a failed read is not a rate measurement */
+    stats = &pPvt->transferStats[mode];
+    pPvt->transferReads++;
+    if (status == ERROR) {
+        stats->failures++;
+        stats->totalFailures++;
+        asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+                  "(mcaAIMAsynDriver [%s signal=%d]): %s read failed, %d failures in a row\n", 
+                  pPvt->portName, signal, aimTransferModeNames[mode], stats->failures);
+    } else {
+        stats->failures = 0;
+    }
+    seconds = epicsTimeDiffInSeconds(&end, &start);
+    if ((status != ERROR) && (seconds > 0.) && (maxChans > 0)) {
+        rate = maxChans * 4 / seconds;
+        if (stats->reads == 0)
+            stats->rate = rate;
+        else
+            stats->rate += AIM_TRANSFER_RATE_WEIGHT * (rate - stats->rate);
+        stats->lastRate = rate;
+        stats->reads++;
+        asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+                  "(mcaAIMAsynDriver [%s signal=%d]): %s rate=%.0f bytes/s, average=%.0f\n", 
+                  pPvt->portName, signal, aimTransferModeNames[mode], rate, stats->rate);
+    }
     *nactual = maxChans;
     return(asynSuccess);
 }
@@ -586,7 +700,7 @@ static asynStatus drvUserCreate(void *drvPvt, asynUser *pasynUser,
     int i;
     const char *pstring;
 
-    for (i=0; i<MAX_MCA_COMMANDS; i++) {
+    for (i=0; i<MAX_AIM_COMMANDS; i++) {
         pstring = mcaCommands[i].commandString;
         if (epicsStrCaseCmp(drvInfo, pstring) == 0) {
             pasynUser->reason = mcaCommands[i].command;
@@ -605,7 +719,7 @@ static asynStatus drvUserCreate(void *drvPvt, asynUser *pasynUser,
 static asynStatus drvUserGetType(void *drvPvt, asynUser *pasynUser,
                                  const char **pptypeName, size_t *psize)
 {
-    mcaCommand command = pasynUser->reason;
+    int command = pasynUser->reason;
 
     *pptypeName = NULL;
     *psize = 0;
@@ -627,12 +741,29 @@ static asynStatus drvUserDestroy(void *drvPvt, asynUser *pasynUser)
 static void AIMReport(void *drvPvt, FILE *fp, int details)
 {
     mcaAIMPvt *pPvt = (mcaAIMPvt *)drvPvt;
+    int mode;
+    aimTransferStats *stats;
 
     assert(pPvt);
     fprintf(fp, "AIM %s: connected on Ethernet device %s, ADC port %d\n",
             pPvt->portName, pPvt->ethernetDevice, pPvt->adc);
     if (details >= 1) {
         fprintf(fp, "              maxChans: %d\n", pPvt->maxChans);
+        fprintf(fp, "              transfer mode: %s, aimTransferMode: %s, using %s\n",
+                aimTransferModeNames[pPvt->transferModeSetting],
+                aimTransferModeNames[aimTransferMode == aimTransferCompressed ||
+                                     aimTransferMode == aimTransferUncompressed ? 
+                                     aimTransferMode : aimTransferAuto],
+                aimTransferModeNames[pPvt->transferMode]);
+        for (mode=aimTransferUncompressed; mode<AIM_TRANSFER_MODES; mode++) {
+            stats = &pPvt->transferStats[mode];
+            fprintf(fp, "              %s reads: %d, average=%.1f kB/s, last=%.1f kB/s, "
+                    "failures=%d (%d in a row)\n",
+                    aimTransferModeNames[mode], stats->reads,
+                    stats->rate/1024., stats->lastRate/1024.,
+                    stats->totalFailures, stats->failures);
+        }
+        nmc_report_module(fp, pPvt->module);
     }
 }
 
@@ -656,6 +787,45 @@ static asynStatus AIMDisconnect(void *drvPvt, asynUser *pasynUser)
 
 
 /* Support routines */
+
+/* Returns the transfer mode to use for the next spectrum read.  The port's
+ * AIM_TRANSFER_MODE, or if that is auto aimTransferMode, can force one of the modes.
+ * Otherwise each mode is measured once, then the faster one is used, and every
+ * AIM_TRANSFER_PROBE_INTERVAL reads the slower one is measured again in case the
+ * spectrum or the network load has changed.  If one mode has failed
+ * AIM_TRANSFER_MAX_FAILURES times in a row the other one is used, until a read which
+ * measures the failed mode succeeds. */
+static aimTransferModeType chooseTransferMode(mcaAIMPvt *pPvt)
+{
+    aimTransferStats *uncompressed = &pPvt->transferStats[aimTransferUncompressed];
+    aimTransferStats *compressed = &pPvt->transferStats[aimTransferCompressed];
+    int uncompressedFailed = (uncompressed->failures >= AIM_TRANSFER_MAX_FAILURES);
+    int compressedFailed = (compressed->failures >= AIM_TRANSFER_MAX_FAILURES);
+
+    if (pPvt->transferModeSetting != aimTransferAuto) return(pPvt->transferModeSetting);
+    if ((aimTransferMode == aimTransferUncompressed) ||
+        (aimTransferMode == aimTransferCompressed)) {
+        return((aimTransferModeType)aimTransferMode);
+    }
+    if (uncompressedFailed != compressedFailed) {
+        pPvt->transferMode = uncompressedFailed ? aimTransferCompressed : aimTransferUncompressed;
+    } else {
+        if (pPvt->transferStats[pPvt->transferMode].reads == 0) return(pPvt->transferMode);
+        if (uncompressed->reads == 0) return(aimTransferUncompressed);
+        if (compressed->reads == 0) return(aimTransferCompressed);
+
+        if (compressed->rate > uncompressed->rate)
+            pPvt->transferMode = aimTransferCompressed;
+        else
+            pPvt->transferMode = aimTransferUncompressed;
+    }
+    if ((pPvt->transferReads % AIM_TRANSFER_PROBE_INTERVAL) == 0) {
+        return(pPvt->transferMode == aimTransferCompressed ? 
+               aimTransferUncompressed : aimTransferCompressed);
+    }
+    return(pPvt->transferMode);
+}
+
 int sendAIMSetup(mcaAIMPvt *pPvt)
 {
    int status;
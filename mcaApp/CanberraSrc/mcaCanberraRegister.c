@@ -10,7 +10,11 @@
 
 extern int aimDebug;
 extern int icbDebug;
+extern int aimGetMemoryWindow;
+extern int aimTransferMode;
 epicsExportAddress(int, aimDebug);
+epicsExportAddress(int, aimGetMemoryWindow);
+epicsExportAddress(int, aimTransferMode);
 epicsExportAddress(int, icbDebug);
 
 int nmc_show_modules();
@@ -0,0 +1,214 @@
+/* ndlDiffdecmTest.c
+ *
+ * Test of ndl_diffdecm, which decodes compressed AIM spectra.  It does not need
+ * an AIM or the network support.
+ *
+ * - Round trip: random spectra of several kinds are encoded in the AIM
+ *   differential format, as emu_encode in nmcEmulator.c does, and decoded.
+ *   The decoded channels must be the spectrum.
+ * - Random bytes: random input is decoded by ndl_diffdecm and by the decoder
+ *   it replaced, which must give the same channels.
+ *
+ * The input is decoded at an odd address as well, since the AIM data follows
+ * a header in the receive buffer and need not be aligned.
+ *
+ * Usage: ndlDiffdecmTest [iterations]
+ *
+ * Exits with status 1 if any check fails.
+ *
+ * Revision History
+ *   19-Oct-2026  Original version
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+
+#include "ncp_comm_defs.h"
+
+#define MAX_CHANNELS 4096
+/* Each channel takes at most 5 bytes */
+#define MAX_BYTES (5*MAX_CHANNELS)
+
+int ndl_diffdecm(unsigned char *input, int channels, int *output,
+                 int max_channels, int *actual_channels);
+
+/* Random number generator (xorshift), so each run tests the same data */
+static epicsUInt32 randomState = 1;
+
+static epicsUInt32 randomWord(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+/*******************************************************************************
+*
+* encode encodes channels in the AIM differential format, like emu_encode in
+* nmcEmulator.c.  It returns the number of bytes.
+*
+*******************************************************************************/
+static int encode(int *channels, int n, unsigned char *out)
+{
+    int i, nbytes = 0;
+    epicsInt32 value, previous = 0, diff;
+
+    for (i=0; i<n; i++) {
+        value = channels[i];
+        diff = (epicsInt32)((epicsUInt32)value - (epicsUInt32)previous);
+        /* 0x7f and 0x80 are the escape codes, so they can't be 8-bit differences */
+        if ((diff >= -127) && (diff <= 126)) {
+            out[nbytes++] = (epicsUInt8)(signed char)diff;
+        } else if ((diff >= -32768) && (diff <= 32767)) {
+            out[nbytes++] = 0x7f;
+            out[nbytes++] = diff & 0xff;
+            out[nbytes++] = (diff >> 8) & 0xff;
+        } else {
+            out[nbytes++] = 0x80;
+            out[nbytes++] = value & 0xff;
+            out[nbytes++] = (value >> 8) & 0xff;
+            out[nbytes++] = (value >> 16) & 0xff;
+            out[nbytes++] = (value >> 24) & 0xff;
+        }
+        previous = value;
+    }
+    return nbytes;
+}
+
+/*******************************************************************************
+*
+* ndl_diffdecm_ref is ndl_diffdecm before it decoded 8 channels at a time.
+* The 16 and 32 bit values are copied with memcpy rather than loaded through
+* a cast pointer, so the reference does not need aligned input either, and
+* the value is unsigned so that it wraps like the AIM's 32 bit value.
+*
+*******************************************************************************/
+static int ndl_diffdecm_ref(unsigned char *input, int channels, int *output,
+                            int max_channels, int *actual_channels)
+{
+    unsigned char *input_ptr;
+    epicsUInt32 value;
+    int *output_ptr;
+    int channels_left;
+    short sdiff;
+
+    *actual_channels = channels;
+    if(channels > 285) *actual_channels -= 1;
+    if(*actual_channels > max_channels) *actual_channels = max_channels;
+    channels_left = *actual_channels;
+    input_ptr = input;
+    output_ptr = output;
+    value = 0;
+    while(channels_left) {
+        switch (*input_ptr) {
+        case (unsigned char) 0x7f:
+            memcpy(&sdiff, input_ptr + 1, sizeof(sdiff));
+            SSWAP(sdiff);
+            value += sdiff;
+            input_ptr += 3;
+            break;
+        case (unsigned char) 0x80:
+            memcpy(&value, input_ptr + 1, sizeof(value));
+            LSWAP(value);
+            input_ptr += 5;
+            break;
+        default:
+            value += *(signed char *) input_ptr;
+            input_ptr++;
+            break;
+        }
+        *output_ptr = value;
+        output_ptr++;
+        channels_left -= 1;
+    }
+    return 0;
+}
+
+/* Fills a spectrum with one of several kinds of random data */
+static void makeSpectrum(int *channels, int n, int kind)
+{
+    int i, r;
+    epicsUInt32 value = randomWord();
+
+    for (i=0; i<n; i++) {
+        r = randomWord() % 100;
+        switch (kind) {
+        case 0:
+            /* Mostly 8 bit differences, some 16 and 32 bit */
+            if (r < 90) value += (int)(randomWord() % 254) - 127;
+            else if (r < 97) value += (int)(randomWord() % 65536) - 32768;
+            else value = randomWord();
+            break;
+        case 1:
+            /* Slowly varying, all 8 bit differences */
+            value += (int)(randomWord() % 3) - 1;
+            break;
+        case 2:
+            /* Sparse, the differences around the peaks are 16 bit */
+            value = (r < 50) ? 0 : randomWord() % 300;
+            break;
+        default:
+            /* Every channel is a 32 bit value */
+            value = randomWord();
+            break;
+        }
+        channels[i] = value;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static int spectrum[MAX_CHANNELS], output[MAX_CHANNELS], reference[MAX_CHANNELS];
+    /* One more byte so the data can be decoded at an odd address */
+    static unsigned char buffer[MAX_BYTES + 1];
+    int iterations = 100000;
+    int iteration, n, nbytes, offset, actual, refActual, maxChannels, expected, i;
+    int failures = 0;
+
+    if (argc > 1) iterations = atoi(argv[1]);
+
+    for (iteration=0; iteration<iterations; iteration++) {
+        offset = iteration & 1;
+
+        /* Round trip */
+        n = 1 + randomWord() % MAX_CHANNELS;
+        makeSpectrum(spectrum, n, iteration % 4);
+        nbytes = encode(spectrum, n, buffer + offset);
+        maxChannels = (iteration % 5 == 0) ? (int)(randomWord() % n) : MAX_CHANNELS;
+        ndl_diffdecm(buffer + offset, n, output, maxChannels, &actual);
+        /* The AIM can send one channel too many, so one is dropped from long reads */
+        expected = (n > 285) ? n-1 : n;
+        if (expected > maxChannels) expected = maxChannels;
+        if (actual != expected) {
+            printf("Round trip %d: %d channels decoded, expected %d\n", iteration, actual, expected);
+            failures++;
+        } else {
+            for (i=0; i<actual; i++) {
+                if (output[i] != spectrum[i]) {
+                    printf("Round trip %d: channel %d is %d, expected %d\n",
+                           iteration, i, output[i], spectrum[i]);
+                    failures++;
+                    break;
+                }
+            }
+        }
+
+        /* Random bytes.  No channel takes more than 5 bytes, so nbytes/5 channels
+         * never read past the data. */
+        nbytes = 5 + randomWord() % (MAX_BYTES - 4);
+        for (i=0; i<nbytes; i++) buffer[offset + i] = randomWord();
+        n = nbytes/5;
+        ndl_diffdecm(buffer + offset, n, output, MAX_CHANNELS, &actual);
+        ndl_diffdecm_ref(buffer + offset, n, reference, MAX_CHANNELS, &refActual);
+        if ((actual != refActual) || memcmp(output, reference, actual*sizeof(int))) {
+            printf("Random bytes %d: output differs from reference decoder\n", iteration);
+            failures++;
+        }
+    }
+    printf("ndlDiffdecmTest: %d iterations, %d failures\n", iterations, failures);
+    return (failures == 0) ? 0 : 1;
+}
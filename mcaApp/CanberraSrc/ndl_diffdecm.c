@@ -0,0 +1,172 @@
+/* NDL_DIFFDECM.C */
+
+/******************************************************************************
+*
+* This module contains the routine which decodes compressed spectra read from
+* networked acquisition modules.  It is separate from nmc_user_subs_1.c and does
+* not include nmc_sys_defs.h, so it can be built without the network support,
+* for ndlDiffdecmTest.
+*
+*******************************************************************************
+*
+* Revision History
+*
+*       19-Oct-2026           Moved from nmc_user_subs_1.c.
+******************************************************************************/
+
+#include <string.h>
+#include <epicsTypes.h>
+
+#define OK 0
+
+/*******************************************************************************
+*
+* This routine decodes 4 byte differential spectral data. It is specialized for
+* the situation where the data comes from an ND556 AIM, where we know the
+* number of channels (almost) to convert. The AIM can tell us that there is
+* one more channel than there really is if its buffer is full, so we knock one
+* off in this case.
+*
+* The calling format is:
+*
+*       status=NDL_DIFFDECM(input,channels in,output,max channels,actual channels)
+*
+* where
+*
+*  "status" is the status of the operation.
+*
+*  "input" (address) is the address of the encoded data.
+*
+*  "channels in" (longword) is the number of channels of encoded data.
+*
+*  "output" (address) is the address of the output longword array.
+*
+*  "max channels" (longword) is the number of channels in "output".
+*
+*  "actual channels" (returned longword, by reference) is the number of channels
+*   produced by the routine.
+*
+********************************************************************************
+*
+* Revision History:
+*
+*       31-Dec-1993     MLR     Modified from Nuclear Data source
+*       12-May-2000     MLR     Added "signed" keyword to "char".  Was not
+*                               portable, and failed on PowerPC.
+*       19-Oct-2026             Decode runs of 8 bit differences 8 channels at
+*                               a time.  The 16 and 32 bit values are built
+*                               from the bytes, so they need not be aligned.
+*
+*******************************************************************************/
+
+/*
+* Each channel is encoded as a signed 8 bit difference from the previous
+* channel, or as 0x7f followed by a 16 bit difference, or as 0x80 followed by
+* the 32 bit value, both little-endian.  Most channels of a spectrum are 8 bit
+* differences, so 8 input bytes at a time are checked for the two escape codes
+* and if there are none they are decoded without testing each byte.
+*
+* NDL_DIFF_HASZERO is non-zero if any byte of the 32 bit word is zero.  Bytes
+* are XORed with 0x80 so 0x80 becomes 0x00 and 0x7f becomes 0xff, and both
+* the word and its complement are tested.
+*/
+#define NDL_DIFF_HASZERO(w) (((w) - 0x01010101) & ~(w) & 0x80808080)
+#define NDL_DIFF_HASESCAPE(w) (NDL_DIFF_HASZERO((w) ^ 0x80808080) || \
+                               NDL_DIFF_HASZERO(~(w) ^ 0x80808080))
+
+int ndl_diffdecm(input,channels,output,max_channels,actual_channels)
+   unsigned char *input;
+   int channels;
+   int *output;
+   int max_channels;
+   int *actual_channels;
+
+{
+        unsigned char *input_ptr;       /* points to item we're converting */
+        epicsUInt32 value;              /* current channel's value */
+        int *output_ptr;                /* points to current output channel */
+        int channels_left;              /* number of channels left to process */
+        epicsUInt32 words[2];
+        int sdiff;
+/*
+* First, could the AIM have truncated a channel, or will the caller's buffer
+* overflow?
+*/
+        *actual_channels = channels;
+        if(channels > 285) *actual_channels -= 1;
+        if(*actual_channels > max_channels) *actual_channels = max_channels;
+/*
+* Set up to start the loop
+*/
+        channels_left = *actual_channels;
+        input_ptr = input;
+        output_ptr = output;
+        value = 0;
+/*
+* Loop while there are channels to decompress
+*/
+        while(channels_left) {
+           /*
+           * Are the next 8 channels all 8 bit diffs?  Every channel takes at
+           * least one byte, so the 8 bytes are all in the input.  The value is
+           * unsigned so that it wraps like the AIM's 32 bit value.
+           */
+           if (channels_left >= 8) {
+                memcpy(words, input_ptr, sizeof(words));
+                if (!NDL_DIFF_HASESCAPE(words[0]) && !NDL_DIFF_HASESCAPE(words[1])) {
+                     output_ptr[0] = value += (signed char) input_ptr[0];
+                     output_ptr[1] = value += (signed char) input_ptr[1];
+                     output_ptr[2] = value += (signed char) input_ptr[2];
+                     output_ptr[3] = value += (signed char) input_ptr[3];
+                     output_ptr[4] = value += (signed char) input_ptr[4];
+                     output_ptr[5] = value += (signed char) input_ptr[5];
+                     output_ptr[6] = value += (signed char) input_ptr[6];
+                     output_ptr[7] = value += (signed char) input_ptr[7];
+                     input_ptr += 8;
+                     output_ptr += 8;
+                     channels_left -= 8;
+                     continue;
+                }
+           }
+           switch (*input_ptr)
+           {
+
+           /*
+           * Is this a 16 bit value?
+           */
+           case (unsigned char) 0x7f:
+                sdiff = input_ptr[1] | (input_ptr[2] << 8);
+                if (sdiff & 0x8000) sdiff -= 0x10000;
+                value += sdiff;
+                input_ptr += 3;
+                break;
+
+           /*
+           * Is this a 32 bit value?
+           */
+           case (unsigned char) 0x80:
+                value = (epicsUInt32) input_ptr[1] |
+                        ((epicsUInt32) input_ptr[2] << 8) |
+                        ((epicsUInt32) input_ptr[3] << 16) |
+                        ((epicsUInt32) input_ptr[4] << 24);
+                input_ptr += 5;
+                break;
+
+           /*
+           * No, it's a 8 bit diff, so add it to the current value
+           */
+           default:
+                value += (signed char) *input_ptr;
+                input_ptr++;
+                break;
+           }
+           /*
+           * Store the current value and bump the output pointer, etc.
+           */
+           *output_ptr = value;
+           output_ptr++;
+           channels_left -= 1;
+        }
+
+        return OK;
+}
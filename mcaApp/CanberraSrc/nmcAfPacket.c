@@ -0,0 +1,216 @@
+/*******************************************************************************
+*
+* nmcAfPacket.c
+*
+* Linux AF_PACKET backend for communicating with AIM modules, selected with
+* USE_AFPACKET in the Makefile.  It replaces libpcap for receiving and libnet
+* for sending, and needs no additional libraries.
+*
+* Packets are received into a TPACKET_V3 ring buffer which is memory-mapped
+* into the process, so the kernel does not copy each packet with a system call.
+* A classic BPF filter attached to the socket passes only packets whose source
+* address starts with 00 00 AF, the Nuclear Data (Canberra) company code, which
+* is the same filter used with pcap.
+*
+* Packets are sent with a single send() from the packet buffer, which already
+* has room for the Ethernet header.  The source address is copied from a frame
+* header built in nmcAfPacketOpen, and the destination address and length are
+* set for each packet.
+*
+********************************************************************************
+*
+* Revision History:
+*
+*   19-Oct-2026          Initial version
+*******************************************************************************/
+
+#ifdef USE_AFPACKET
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#include "nmc_sys_defs.h"
+
+/*******************************************************************************
+*
+* nmcAfPacketOpen opens the AF_PACKET socket on a network interface, sets up
+* the receive ring and the filter, and builds the Ethernet header for sending.
+* It is called from nmc_initialize, after i->sys_address has been set.
+*
+*******************************************************************************/
+int nmcAfPacketOpen(struct nmc_comm_info_struct *i, char *device)
+{
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    /* ether[6]=0 and ether[7]=0 and ether[8]=0xaf */
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x00, 0, 5),
+        BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 7),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x00, 0, 3),
+        BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 8),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xaf, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, NMC_K_CAPTURESIZE),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog filter;
+
+    /* AIM packets are 802.3 frames with an LLC/SNAP header */
+    i->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
+    if (i->sockfd == -1) {
+        printf("nmcAfPacketOpen: socket: %s\n", strerror(errno));
+        return ERROR;
+    }
+
+    filter.len = sizeof(code)/sizeof(code[0]);
+    filter.filter = code;
+    if (setsockopt(i->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1) {
+        printf("nmcAfPacketOpen: SO_ATTACH_FILTER: %s\n", strerror(errno));
+        goto error;
+    }
+
+    if (setsockopt(i->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        printf("nmcAfPacketOpen: PACKET_VERSION: %s\n", strerror(errno));
+        goto error;
+    }
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = NMC_K_AFPACKET_BLOCK_SIZE;
+    req.tp_block_nr = NMC_K_AFPACKET_BLOCKS;
+    req.tp_frame_size = NMC_K_AFPACKET_FRAME_SIZE;
+    req.tp_frame_nr = (req.tp_block_size * req.tp_block_nr) / req.tp_frame_size;
+    /* A block is passed to us when it is full or after this many ms */
+    req.tp_retire_blk_tov = NMC_K_AFPACKET_BLOCK_TIMEOUT;
+    if (setsockopt(i->sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        printf("nmcAfPacketOpen: PACKET_RX_RING: %s\n", strerror(errno));
+        goto error;
+    }
+    i->rx_ring_size = req.tp_block_size * req.tp_block_nr;
+    i->rx_ring = mmap(NULL, i->rx_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, i->sockfd, 0);
+    if (i->rx_ring == MAP_FAILED) {
+        printf("nmcAfPacketOpen: mmap: %s\n", strerror(errno));
+        i->rx_ring = NULL;
+        goto error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_802_2);
+    addr.sll_ifindex = if_nametoindex(device);
+    if (addr.sll_ifindex == 0) {
+        printf("nmcAfPacketOpen: unknown interface %s\n", device);
+        goto error;
+    }
+    if (bind(i->sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        printf("nmcAfPacketOpen: bind: %s\n", strerror(errno));
+        goto error;
+    }
+
+    /* Build the Ethernet header for sending, the destination and length are set per packet */
+    memset(&i->tx_header, 0, sizeof(i->tx_header));
+    COPY_ENET_ADDR(i->sys_address, i->tx_header.source);
+    return OK;
+
+error:
+    nmcAfPacketClose(i);
+    return ERROR;
+}
+
+/*******************************************************************************
+*
+* nmcAfPacketClose unmaps the receive ring and closes the socket.
+*
+*******************************************************************************/
+void nmcAfPacketClose(struct nmc_comm_info_struct *i)
+{
+    if (i->rx_ring != NULL) munmap(i->rx_ring, i->rx_ring_size);
+    i->rx_ring = NULL;
+    if (i->sockfd >= 0) close(i->sockfd);
+    i->sockfd = -1;
+}
+
+/*******************************************************************************
+*
+* nmcAfPacketCapture runs in the capture thread.  It waits for blocks of the
+* receive ring to be filled by the kernel, passes each packet in the block to
+* nmcEtherGrab in a buffer from the receive buffer pool, and returns the block
+* to the kernel.  It never returns.
+*
+*******************************************************************************/
+void nmcAfPacketCapture(struct nmc_comm_info_struct *i)
+{
+    struct pollfd pfd;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd;
+    struct nmc_rx_buffer *b;
+    unsigned int block=0, n;
+    int length;
+
+    pfd.fd = i->sockfd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (1) {
+        bd = (struct tpacket_block_desc *)((char *)i->rx_ring + block*NMC_K_AFPACKET_BLOCK_SIZE);
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        ppd = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (n=0; n<bd->hdr.bh1.num_pkts; n++) {
+            if ((b = nmc_alloc_rx_buffer(i)) == NULL) {
+                nmc_signal("nmcAfPacketCapture: no free receive buffers", 0);
+            } else {
+                length = ppd->tp_snaplen;
+                if (length > (int)sizeof(b->pkt)) length = sizeof(b->pkt);
+                memcpy(&b->pkt, (char *)ppd + ppd->tp_mac, length);
+                b->length = length;
+                nmcEtherGrab(b);
+            }
+            ppd = (struct tpacket3_hdr *)((char *)ppd + ppd->tp_next_offset);
+        }
+        /* Return the block to the kernel */
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        block = (block + 1) % NMC_K_AFPACKET_BLOCKS;
+    }
+}
+
+/*******************************************************************************
+*
+* nmcAfPacketSend sends a packet to an Ethernet address.  "frame" is the start
+* of the Ethernet header of the packet, "length" is the length of the data
+* following the Ethernet header.  "dest" can point into the frame header, as it
+* does for nmc_broadcast_inq.  It returns the number of bytes sent, or -1.
+*
+*******************************************************************************/
+int nmcAfPacketSend(struct nmc_comm_info_struct *i, unsigned char *dest,
+                    struct enet_header *frame, int length)
+{
+    int ret;
+
+    /* memmove, dest can be frame->dest itself */
+    memmove(frame->dest, dest, sizeof(frame->dest));
+    COPY_ENET_ADDR(i->tx_header.source, frame->source);
+    frame->length = length;
+    /* NOTE: the SSWAP and LSWAP macros do byte-swapping on big-endian hosts, because the
+     * AIM is little-endian.  But the enet_header.length must be in network byte-order, which
+     * is big-endian, so on a little-endian host it must be swapped. */
+    SSWAP_LITTLE(frame->length);
+    ret = send(i->sockfd, frame, length + sizeof(*frame), 0);
+    if (ret < 0) printf("Error writing ethernet packet, error=%s\n", strerror(errno));
+    return ret;
+}
+
+#endif /* USE_AFPACKET */
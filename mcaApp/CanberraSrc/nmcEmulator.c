@@ -0,0 +1,1038 @@
+/* NMC_EMULATOR.C */
+
+/*******************************************************************************
+*
+* Software emulator for Canberra AIM (ND556, ND556A) and DSA2000 networked
+* modules.
+*
+* This program answers the NCP protocol on an Ethernet interface for one or more
+* emulated modules, so the Canberra support (nmc_initialize, nmc_buymodule,
+* nmc_sendcmd, drvMcaAIMAsyn, drvIcbAsyn, DSA2000) can be run and benchmarked
+* without hardware.  It is normally run on one end of a veth pair, with the IOC
+* using the other end:
+*
+*       ip link add aimemu type veth peer name aimhost
+*       ip link set aimemu up
+*       ip link set aimhost up
+*       nmcEmulator -m 4 -a 100 aimemu
+*
+* and in the IOC startup script, for the first module:
+*
+*       AIMConfig("AIM1/1", 0x100, 1, 2048, 1, 1, "aimhost")
+*
+* Usage: nmcEmulator [-m modules] [-a base address (hex)] [-s memory bytes]
+*                    [-w hardware revision] [-f firmware revision]
+*                    [-c counts/s per input] [-l loss fraction] [-v] interface
+*
+*   -m  Number of modules, 1 to EMU_MAX_MODULES (default 1).
+*   -a  Address of the first module, as passed to AIMConfig (default 100).
+*       The modules have consecutive Ethernet addresses 00:00:AF:xx:xx:xx.
+*   -s  Acquisition memory per module in bytes (default 1 MB).
+*   -w  Hardware revision: 0=ND556, 1=ND556A, 2=DSA2000 (default 1).
+*   -f  Firmware revision (default 5).
+*   -c  Count rate of each input while acquiring (default 10000).
+*   -l  Fraction of commands to ignore, to test retries (default 0).
+*   -v  Print each command.
+*
+* Statistics for each module are printed on SIGINT or SIGTERM.
+*
+* What is emulated:
+*   - Status messages in response to multicast inquiry messages, honoring the
+*     inquiry type.
+*   - Module ownership (SETOWNER, SETOWNEROVER), reflected in the header of
+*     every message so the host's ownership handler sees it.
+*   - Acquisition memory (SETMEMORY, ERASEMEM, RETMEMORY, RETMEMCMP,
+*     RETMEMSEP) and host memory (SETHOSTMEM, RETHOSTMEM).
+*   - Two inputs per module with setup, presets, elapsed times, status and
+*     acquisition mode.  While acquiring, counts are added to the spectrum at the
+*     count rate (a peak on a flat background), live time runs 5% slower than
+*     real time, and when a preset is reached acquisition stops and an ACQOFF
+*     event message is sent to the address set with SETMODEVSAP.
+*   - Double buffered list mode.  The acquisition memory of the input is split
+*     into two buffers, each event is stored as a 32-bit channel number, and a
+*     BUFFER event message is sent when a buffer fills.
+*   - ICB register access (SENDICB, RECVICB) on 256 registers, which read back
+*     what was written.
+*   - The DSA2000 high voltage commands.
+*
+********************************************************************************
+*
+* Revision History:
+*
+*   19-Oct-2026          Initial version
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include <epicsTypes.h>
+
+#include "ncp_comm_defs.h"
+#include "aim_comm_defs.h"
+
+#define EMU_MAX_MODULES     64          /* Same as NMC_K_MAX_MODULES */
+#define EMU_INPUTS          2           /* Inputs (ADCs) per module */
+#define EMU_HOSTMEM_SIZE    256         /* Bytes of host memory */
+#define EMU_ICB_REGISTERS   256         /* 16 ICB modules with 16 registers */
+#define EMU_TICKS_PER_SEC   100.        /* Unit of the live and real times is 10 ms */
+#define EMU_DEAD_TIME       0.05        /* Fraction of real time which is dead time */
+#define EMU_POLL_MS         10          /* Acquisition update period */
+#define EMU_SNAP_SAP        0xAA
+#define EMU_MAX_DATA        (NMC_K_MAX_NIMSG - sizeof(struct ncp_comm_header) - \
+                             sizeof(struct ncp_comm_packet))
+#define EMU_MIN_FRAME       60
+
+struct emu_input {
+    int acquiring;
+    int mode;
+    epicsUInt32 address;            /* Acquisition address */
+    epicsUInt32 alimit;             /* Last byte of acquisition memory */
+    epicsUInt32 plive, preal, ptotals, pstart, pend, plimit;
+    double elive, ereal;            /* Elapsed times in ticks */
+    epicsUInt32 totals;             /* Counts in the preset region */
+    double pending;                 /* Fraction of a count left over from the last update */
+    int event_valid;                /* Event messages have been requested with SETMODEVSAP */
+    unsigned char event_snap[5];
+    int list_current;               /* List mode: buffer being filled */
+    int list_full[2];
+    epicsUInt32 list_offset[2];     /* List mode: bytes in each buffer */
+};
+
+struct emu_module {
+    unsigned char address[6];
+    unsigned char owner_id[6];
+    epicsInt8 owner_name[8];
+    epicsUInt8 *memory;
+    epicsUInt32 memory_size;
+    epicsUInt8 hostmem[EMU_HOSTMEM_SIZE];
+    epicsUInt8 icb[EMU_ICB_REGISTERS];
+    struct emu_input input[EMU_INPUTS];
+    int icb_event_valid;
+    unsigned char icb_event_snap[5];
+    epicsInt16 hv_control;
+    epicsInt16 hv_dac;
+    unsigned long commands;
+    unsigned long dropped;
+    unsigned long errors;
+    double bytes_returned;
+};
+
+static struct emu_module modules[EMU_MAX_MODULES];
+static int num_modules = 1;
+static int hw_revision = 1;
+static int fw_revision = 5;
+static double count_rate = 10000.;
+static double loss = 0.;
+static int verbose = 0;
+static int sockfd = -1;
+static volatile sig_atomic_t done = 0;
+
+/* Frame as sent and received on the wire */
+struct emu_frame {
+    struct enet_header enet_header;
+    struct snap_header snap_header;
+    struct ncp_comm_header ncp_comm_header;
+    epicsUInt8 data[NMC_K_MAX_NIMSG];
+};
+
+static double emu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double emu_random(void)
+{
+    return (rand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+static epicsUInt32 emu_get32(epicsUInt8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((epicsUInt32)p[3] << 24);
+}
+
+static void emu_put32(epicsUInt8 *p, epicsUInt32 value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+/* Returns 1 if the range address to address+size-1 is in acquisition memory */
+static int emu_check_range(struct emu_module *m, epicsUInt32 address, epicsUInt32 size)
+{
+    return (address <= m->memory_size) && (size <= m->memory_size - address);
+}
+
+/*******************************************************************************
+*
+* emu_send sends a message from a module.  "data" is the data area following the
+* NCP header, "dsize" is its size.
+*
+*******************************************************************************/
+static int emu_send(struct emu_module *m, unsigned char *dest, unsigned char *snap_id,
+                    int message_type, int message_number, void *data, int dsize)
+{
+    struct emu_frame frame;
+    struct ncp_comm_header *h = &frame.ncp_comm_header;
+    int length;
+
+    memset(&frame, 0, sizeof(frame) - sizeof(frame.data));
+    COPY_ENET_ADDR(dest, frame.enet_header.dest);
+    COPY_ENET_ADDR(m->address, frame.enet_header.source);
+    frame.snap_header.dsap = EMU_SNAP_SAP;
+    frame.snap_header.ssap = EMU_SNAP_SAP;
+    frame.snap_header.control = 0x03;
+    memcpy(frame.snap_header.snap_id, snap_id, 5);
+
+    h->checkword = NCP_K_CHECKWORD;
+    h->protocol_type = NCP_C_PRTYPE_NAM;
+    h->message_number = message_number;
+    h->message_type = message_type;
+    COPY_ENET_ADDR(m->owner_id, h->owner_id);
+    memcpy(h->owner_name, m->owner_name, sizeof(h->owner_name));
+    h->data_size = dsize;
+    LSWAP(h->checkword);
+    LSWAP(h->data_size);
+    memcpy(frame.data, data, dsize);
+
+    length = sizeof(struct enet_header) + sizeof(struct snap_header) + sizeof(*h) + dsize;
+    /* The 802.3 length field is big-endian */
+    frame.enet_header.length = htons(length - sizeof(struct enet_header));
+    if (length < EMU_MIN_FRAME) {
+        memset((char *)&frame + length, 0, EMU_MIN_FRAME - length);
+        length = EMU_MIN_FRAME;
+    }
+    if (send(sockfd, &frame, length, 0) != length) {
+        printf("nmcEmulator: send failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Send a command response with packet code "code" and "size" bytes of data */
+static void emu_respond(struct emu_module *m, unsigned char *host, unsigned char *snap_id,
+                        int message_number, int code, void *data, int size)
+{
+    epicsUInt8 buffer[sizeof(struct ncp_comm_packet) + NMC_K_MAX_NIMSG];
+    struct ncp_comm_packet *pkt = (struct ncp_comm_packet *)buffer;
+
+    pkt->packet_size = size;
+    pkt->packet_type = NCP_C_PTYPE_MRESPONSE;
+    pkt->packet_flags = 0;
+    pkt->packet_code = code;
+    LSWAP(pkt->packet_size);
+    SSWAP(pkt->packet_code);
+    if (size > 0) memcpy(buffer + sizeof(*pkt), data, size);
+    m->bytes_returned += size;
+    emu_send(m, host, snap_id, NCP_C_MSGTYPE_PACKET, message_number, buffer, sizeof(*pkt) + size);
+}
+
+static void emu_send_status(struct emu_module *m, unsigned char *host, unsigned char *snap_id)
+{
+    struct ncp_comm_mstatus s;
+
+    memset(&s, 0, sizeof(s));
+    s.module_type = NCP_C_MODTYPE_NAM;
+    s.hw_revision = hw_revision;
+    s.fw_revision = fw_revision;
+    s.module_init = 1;
+    s.num_inputs = EMU_INPUTS;
+    s.acq_memory = m->memory_size;
+    LSWAP(s.comm_flags);
+    LSWAP(s.acq_memory);
+    emu_send(m, host, snap_id, NCP_C_MSGTYPE_MSTATUS, 0, &s, sizeof(s));
+}
+
+static void emu_send_event(struct emu_module *m, unsigned char *snap_id,
+                           int type, int id1, int id2)
+{
+    struct ncp_comm_mevent e;
+
+    e.event_type = type;
+    e.event_id1 = id1;
+    e.event_id2 = id2;
+    LSWAP(e.event_id1);
+    LSWAP(e.event_id2);
+    /* Event messages go to the owner of the module */
+    emu_send(m, m->owner_id, snap_id, NCP_C_MSGTYPE_MEVENT, 0, &e, sizeof(e));
+}
+
+static void emu_reset_list(struct emu_input *in)
+{
+    in->list_current = 0;
+    in->list_full[0] = in->list_full[1] = 0;
+    in->list_offset[0] = in->list_offset[1] = 0;
+}
+
+/* List mode buffers are the two halves of the input's acquisition memory */
+static epicsUInt32 emu_list_size(struct emu_input *in)
+{
+    if (in->alimit <= in->address) return 0;
+    return ((in->alimit - in->address + 1) / 2) & ~3;
+}
+
+static void emu_release_list(struct emu_module *m, int adc, int buffer)
+{
+    struct emu_input *in = &m->input[adc];
+
+    in->list_full[buffer] = 0;
+    in->list_offset[buffer] = 0;
+    /* If acquisition was held because both buffers were full, continue in this one */
+    if (in->list_full[in->list_current]) in->list_current = buffer;
+}
+
+static void emu_stop(struct emu_module *m, int adc, int send_event)
+{
+    struct emu_input *in = &m->input[adc];
+
+    in->acquiring = 0;
+    if (send_event && in->event_valid)
+        emu_send_event(m, in->event_snap, NCP_C_EVTYPE_ACQOFF, adc, 0);
+}
+
+/*******************************************************************************
+*
+* emu_encode encodes channels of acquisition memory in the AIM differential
+* format decoded by ndl_diffdecm.  It returns the number of channels encoded,
+* and the number of bytes in *nbytes.
+*
+*******************************************************************************/
+static int emu_encode(struct emu_module *m, epicsUInt32 address, int max_bytes,
+                      epicsUInt8 *out, int *nbytes)
+{
+    int channels = 0, n = 0;
+    epicsInt32 value, previous = 0, diff;
+
+    while (emu_check_range(m, address, 4)) {
+        value = (epicsInt32)emu_get32(m->memory + address);
+        diff = value - previous;
+        /* 0x7f and 0x80 are the escape codes, so they can't be 8-bit differences */
+        if ((diff >= -127) && (diff <= 126)) {
+            if (n + 1 > max_bytes) break;
+            out[n++] = (epicsUInt8)(signed char)diff;
+        } else if ((diff >= -32768) && (diff <= 32767)) {
+            if (n + 3 > max_bytes) break;
+            out[n++] = 0x7f;
+            out[n++] = diff & 0xff;
+            out[n++] = (diff >> 8) & 0xff;
+        } else {
+            if (n + 5 > max_bytes) break;
+            out[n++] = 0x80;
+            emu_put32(out + n, (epicsUInt32)value);
+            n += 4;
+        }
+        previous = value;
+        address += 4;
+        channels++;
+    }
+    *nbytes = n;
+    return channels;
+}
+
+/*******************************************************************************
+*
+* emu_command executes a host command and sends the response.
+*
+*******************************************************************************/
+static void emu_command(struct emu_module *m, unsigned char *host, unsigned char *snap_id,
+                        int message_number, int code, epicsUInt8 *data, int size)
+{
+    epicsUInt8 resp[NMC_K_MAX_NIMSG];
+    int rcode = NCP_K_MRESP_SUCCESS, rsize = 0;
+    int adc, i, n;
+    struct emu_input *in = NULL;
+
+    m->commands++;
+    if (verbose) printf("Module %02x%02x%02x: command %d, %d bytes\n",
+                        m->address[3], m->address[4], m->address[5], code, size);
+
+    /* Most commands start with the ADC number */
+    switch (code) {
+    case NCP_K_HCMD_SETACQADDR:
+    case NCP_K_HCMD_SETELAPSED:
+    case NCP_K_HCMD_SETPRESETS:
+    case NCP_K_HCMD_SETACQSTATUS:
+    case NCP_K_HCMD_SETACQMODE:
+    case NCP_K_HCMD_RETADCSTATUS:
+    case NCP_K_HCMD_SETUPACQ:
+    case NCP_K_HCMD_RETACQSETUP:
+    case NCP_K_HCMD_RETLISTMEM:
+    case NCP_K_HCMD_RELLISTMEM:
+    case NCP_K_HCMD_RETLISTSTAT:
+    case NCP_K_HCMD_RESETLIST:
+        adc = (data[0] | (data[1] << 8)) & 0x7fff;
+        if (size < 2 || adc >= EMU_INPUTS) {
+            rcode = NCP_K_MRESP_INVALADC;
+            goto respond;
+        }
+        in = &m->input[adc];
+        break;
+    default:
+        adc = 0;
+        break;
+    }
+
+    switch (code) {
+    case NCP_K_HCMD_SETACQADDR: {
+        struct ncp_hcmd_setacqaddr c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.limit);
+        in->address = c.address;
+        in->alimit = c.limit;
+        break;
+    }
+    case NCP_K_HCMD_SETELAPSED: {
+        struct ncp_hcmd_setelapsed c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.live);
+        LSWAP(c.real);
+        in->elive = c.live;
+        in->ereal = c.real;
+        break;
+    }
+    case NCP_K_HCMD_SETMEMORY: {
+        struct ncp_hcmd_setmemory c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if (!emu_check_range(m, c.address, c.size) || (int)(c.size + sizeof(c)) > size) {
+            rcode = NCP_K_MRESP_INVALSTMEMADR;
+            break;
+        }
+        memcpy(m->memory + c.address, data + sizeof(c), c.size);
+        break;
+    }
+    case NCP_K_HCMD_SETPRESETS: {
+        struct ncp_hcmd_setpresets c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.live);
+        LSWAP(c.real);
+        LSWAP(c.totals);
+        LSWAP(c.start);
+        LSWAP(c.end);
+        LSWAP(c.limit);
+        in->plive = c.live;
+        in->preal = c.real;
+        in->ptotals = c.totals;
+        in->pstart = c.start;
+        in->pend = c.end;
+        in->plimit = c.limit;
+        break;
+    }
+    case NCP_K_HCMD_SETACQSTATUS: {
+        struct ncp_hcmd_setacqstate c;
+        memcpy(&c, data, sizeof(c));
+        if (c.status) in->acquiring = 1;
+        else emu_stop(m, adc, 0);
+        break;
+    }
+    case NCP_K_HCMD_ERASEMEM: {
+        struct ncp_hcmd_erasemem c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if (!emu_check_range(m, c.address, c.size)) {
+            rcode = NCP_K_MRESP_INVALSTMEMADR;
+            break;
+        }
+        memset(m->memory + c.address, 0, c.size);
+        for (i=0; i<EMU_INPUTS; i++) {
+            if ((m->input[i].address >= c.address) && (m->input[i].address < c.address + c.size))
+                m->input[i].totals = 0;
+        }
+        break;
+    }
+    case NCP_K_HCMD_SETACQMODE: {
+        struct ncp_hcmd_setacqmode c;
+        memcpy(&c, data, sizeof(c));
+        in->mode = c.mode;
+        emu_reset_list(in);
+        break;
+    }
+    case NCP_K_HCMD_RETMEMORY: {
+        struct ncp_hcmd_retmemory c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if (c.size > EMU_MAX_DATA) {
+            rcode = NCP_K_MRESP_RQSTMEMSIZETOOLG;
+            break;
+        }
+        if (!emu_check_range(m, c.address, c.size)) {
+            rcode = NCP_K_MRESP_INVALSTMEMADR;
+            break;
+        }
+        memcpy(resp, m->memory + c.address, c.size);
+        rsize = c.size;
+        break;
+    }
+    case NCP_K_HCMD_RETMEMCMP: {
+        struct ncp_hcmd_retmemcmp c;
+        struct ncp_mresp_retmemcmp r;
+        int max_bytes;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if (!emu_check_range(m, c.address, 4)) {
+            rcode = NCP_K_MRESP_INVALSTMEMADR;
+            break;
+        }
+        max_bytes = EMU_MAX_DATA - sizeof(r);
+        if ((int)c.size < max_bytes) max_bytes = c.size;
+        r.channels = emu_encode(m, c.address, max_bytes, resp + sizeof(r), &n);
+        LSWAP(r.channels);
+        memcpy(resp, &r, sizeof(r));
+        rsize = sizeof(r) + n;
+        rcode = NCP_K_MRESP_RETMEMCMP;
+        break;
+    }
+    case NCP_K_HCMD_RETADCSTATUS: {
+        struct ncp_mresp_retadcstatus r;
+        r.status = in->acquiring;
+        r.live = (epicsUInt32)in->elive;
+        r.real = (epicsUInt32)in->ereal;
+        r.totals = in->totals;
+        LSWAP(r.live);
+        LSWAP(r.real);
+        LSWAP(r.totals);
+        memcpy(resp, &r, sizeof(r));
+        rsize = sizeof(r);
+        rcode = NCP_K_MRESP_ADCSTATUS;
+        break;
+    }
+    case NCP_K_HCMD_SETHOSTMEM: {
+        struct ncp_hcmd_sethostmem c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if ((c.address > EMU_HOSTMEM_SIZE) || (c.size > EMU_HOSTMEM_SIZE - c.address) ||
+            ((int)(c.size + sizeof(c)) > size)) {
+            rcode = NCP_K_MRESP_SETHOSTMEMSIZETOOLG;
+            break;
+        }
+        memcpy(m->hostmem + c.address, data + sizeof(c), c.size);
+        break;
+    }
+    case NCP_K_HCMD_RETHOSTMEM: {
+        struct ncp_hcmd_rethostmem c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        if ((c.address > EMU_HOSTMEM_SIZE) || (c.size > EMU_HOSTMEM_SIZE - c.address)) {
+            rcode = NCP_K_MRESP_RQSTMEMSIZETOOLG;
+            break;
+        }
+        memcpy(resp, m->hostmem + c.address, c.size);
+        rsize = c.size;
+        break;
+    }
+    case NCP_K_HCMD_SETOWNER:
+    case NCP_K_HCMD_SETOWNEROVER: {
+        struct ncp_hcmd_setowner c;
+        static const unsigned char unowned[6] = {0,0,0,0,0,0};
+        memcpy(&c, data, sizeof(c));
+        if ((code == NCP_K_HCMD_SETOWNER) &&
+            !COMPARE_ENET_ADDR(m->owner_id, unowned) &&
+            !COMPARE_ENET_ADDR(m->owner_id, c.owner_id)) {
+            rcode = NCP_K_MRESP_OWNERNOTSET;
+            break;
+        }
+        COPY_ENET_ADDR(c.owner_id, m->owner_id);
+        memcpy(m->owner_name, c.owner_name, sizeof(m->owner_name));
+        break;
+    }
+    case NCP_K_HCMD_RESET:
+        for (i=0; i<EMU_INPUTS; i++) {
+            m->input[i].acquiring = 0;
+            emu_reset_list(&m->input[i]);
+        }
+        break;
+    case NCP_K_HCMD_SETDISPLAY:
+    case NCP_K_HCMD_RETDISPLAY:
+    case NCP_K_HCMD_DIAGNOSE:
+        break;
+    case NCP_K_HCMD_SENDICB: {
+        struct ncp_hcmd_sendicb c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.registers);
+        if (c.registers > 64) c.registers = 64;
+        for (i=0; i<(int)c.registers; i++)
+            m->icb[c.addresses[i].address] = c.addresses[i].data;
+        break;
+    }
+    case NCP_K_HCMD_RECVICB: {
+        struct ncp_hcmd_recvicb c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.registers);
+        if (c.registers > 64) c.registers = 64;
+        for (i=0; i<(int)c.registers; i++)
+            resp[i] = m->icb[c.address[i]];
+        rsize = c.registers;
+        break;
+    }
+    case NCP_K_HCMD_SETUPACQ: {
+        struct ncp_hcmd_setupacq c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.alimit);
+        LSWAP(c.plive);
+        LSWAP(c.preal);
+        LSWAP(c.ptotals);
+        LSWAP(c.start);
+        LSWAP(c.end);
+        LSWAP(c.plimit);
+        LSWAP(c.elive);
+        LSWAP(c.ereal);
+        in->address = c.address;
+        in->alimit = c.alimit;
+        in->plive = c.plive;
+        in->preal = c.preal;
+        in->ptotals = c.ptotals;
+        in->pstart = c.start;
+        in->pend = c.end;
+        in->plimit = c.plimit;
+        in->elive = c.elive;
+        in->ereal = c.ereal;
+        in->mode = c.mode;
+        emu_reset_list(in);
+        break;
+    }
+    case NCP_K_HCMD_RETACQSETUP: {
+        struct ncp_mresp_retacqsetup r;
+        r.address = in->address;
+        r.alimit = in->alimit;
+        r.plive = in->plive;
+        r.preal = in->preal;
+        r.ptotals = in->ptotals;
+        r.start = in->pstart;
+        r.end = in->pend;
+        r.plimit = in->plimit;
+        r.mode = in->mode;
+        LSWAP(r.address);
+        LSWAP(r.alimit);
+        LSWAP(r.plive);
+        LSWAP(r.preal);
+        LSWAP(r.ptotals);
+        LSWAP(r.start);
+        LSWAP(r.end);
+        LSWAP(r.plimit);
+        memcpy(resp, &r, sizeof(r));
+        rsize = sizeof(r);
+        rcode = NCP_K_MRESP_RETACQSETUP;
+        break;
+    }
+    case NCP_K_HCMD_SETMODEVSAP: {
+        struct ncp_hcmd_setmodevsap c;
+        memcpy(&c, data, sizeof(c));
+        SSWAP(c.mevsource);
+        if (c.mevsource < EMU_INPUTS) {
+            m->input[c.mevsource].event_valid = 1;
+            memcpy(m->input[c.mevsource].event_snap, c.snap_id, 5);
+        } else if (c.mevsource == NCP_K_MEVSRC_ICB) {
+            m->icb_event_valid = 1;
+            memcpy(m->icb_event_snap, c.snap_id, 5);
+        } else {
+            rcode = NCP_K_MRESP_INVLMEVSRC;
+        }
+        break;
+    }
+    case NCP_K_HCMD_RETLISTMEM: {
+        struct ncp_hcmd_retlistmem c;
+        epicsUInt32 start;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.offset);
+        LSWAP(c.size);
+        if ((c.buffer < 0) || (c.buffer > 1)) {
+            rcode = NCP_K_MRESP_INVALLISTBUFFER;
+            break;
+        }
+        if ((c.offset > in->list_offset[(int)c.buffer]) || (c.size > EMU_MAX_DATA)) {
+            rcode = NCP_K_MRESP_INVALOFFSETRETLIST;
+            break;
+        }
+        if (c.size > in->list_offset[(int)c.buffer] - c.offset)
+            c.size = in->list_offset[(int)c.buffer] - c.offset;
+        start = in->address + c.buffer*emu_list_size(in) + c.offset;
+        memcpy(resp, m->memory + start, c.size);
+        rsize = c.size;
+        /* The top bit of the ADC number releases the buffer with the last transfer */
+        if ((data[1] & 0x80) && (c.offset + c.size >= in->list_offset[(int)c.buffer]))
+            emu_release_list(m, adc, c.buffer);
+        break;
+    }
+    case NCP_K_HCMD_RELLISTMEM: {
+        struct ncp_hcmd_rellistmem c;
+        memcpy(&c, data, sizeof(c));
+        if ((c.buffer < 0) || (c.buffer > 1)) {
+            rcode = NCP_K_MRESP_INVALLISTBUFFER;
+            break;
+        }
+        emu_release_list(m, adc, c.buffer);
+        break;
+    }
+    case NCP_K_HCMD_RETLISTSTAT: {
+        struct ncp_mresp_retliststat r;
+        r.status = in->acquiring;
+        r.current_buffer = in->list_current;
+        r.buffer_1_full = in->list_full[0];
+        r.offset_1 = in->list_offset[0];
+        r.buffer_2_full = in->list_full[1];
+        r.offset_2 = in->list_offset[1];
+        LSWAP(r.offset_1);
+        LSWAP(r.offset_2);
+        memcpy(resp, &r, sizeof(r));
+        rsize = sizeof(r);
+        rcode = NCP_K_MRESP_RETLISTSTAT;
+        break;
+    }
+    case NCP_K_HCMD_RETMEMSEP: {
+        struct ncp_hcmd_retmemsep c;
+        memcpy(&c, data, sizeof(c));
+        LSWAP(c.address);
+        LSWAP(c.size);
+        LSWAP(c.offset);
+        LSWAP(c.chunks);
+        if ((double)c.size * c.chunks > EMU_MAX_DATA) {
+            rcode = NCP_K_MRESP_RQSTMEMSIZETOOLG;
+            break;
+        }
+        for (i=0; i<(int)c.chunks; i++) {
+            if (!emu_check_range(m, c.address + i*c.offset, c.size)) {
+                rcode = NCP_K_MRESP_INVALSTMEMADR;
+                rsize = 0;
+                break;
+            }
+            memcpy(resp + rsize, m->memory + c.address + i*c.offset, c.size);
+            rsize += c.size;
+        }
+        break;
+    }
+    case NCP_K_HCMD_RESETLIST:
+        emu_reset_list(in);
+        break;
+    case NCP_K_HCMD_SETHVSTATUS: {
+        struct ncp_hcmd_sethvstatus c;
+        memcpy(&c, data, sizeof(c));
+        SSWAP(c.control);
+        SSWAP(c.DAC);
+        m->hv_control = c.control;
+        m->hv_dac = c.DAC & 0xfff;
+        break;
+    }
+    case NCP_K_HCMD_RETHVSTATUS: {
+        struct ncp_mresp_rethvstatus r;
+        r.status = m->hv_control;
+        r.DACValue = m->hv_dac;
+        r.DACSetting = m->hv_dac;
+        r.ADCValue = m->hv_dac >> 4;
+        r.spare = 0;
+        SSWAP(r.status);
+        SSWAP(r.DACValue);
+        SSWAP(r.DACSetting);
+        SSWAP(r.ADCValue);
+        memcpy(resp, &r, sizeof(r));
+        rsize = sizeof(r);
+        rcode = NCP_K_MRESP_RETHVSTATUS;
+        break;
+    }
+    case NCP_K_HCMD_RESETHVSTATUS:
+    case NCP_K_HCMD_SETHVPARAMS:
+        break;
+    default:
+        rcode = NCP_K_MRESP_INVALCMD;
+        break;
+    }
+
+respond:
+    /* Error responses have no data, responses with data have their own codes */
+    if ((rcode != NCP_K_MRESP_SUCCESS) && (rsize == 0)) {
+        m->errors++;
+        if (verbose) printf("  error response %d\n", rcode);
+    }
+    emu_respond(m, host, snap_id, message_number, rcode, resp, rsize);
+}
+
+/*******************************************************************************
+*
+* emu_receive handles a frame received from the network.
+*
+*******************************************************************************/
+static void emu_receive(struct emu_frame *frame, int length)
+{
+    struct enet_header *e = &frame->enet_header;
+    struct ncp_comm_header *h = &frame->ncp_comm_header;
+    struct ncp_comm_packet *pkt;
+    struct emu_module *m;
+    int i, inquiry_type, owned;
+    static const unsigned char unowned[6] = {0,0,0,0,0,0};
+
+    if (length < (int)(sizeof(struct enet_header) + sizeof(struct snap_header) + sizeof(*h)))
+        return;
+    if (frame->snap_header.dsap != EMU_SNAP_SAP) return;
+    LSWAP(h->checkword);
+    LSWAP(h->data_size);
+    if (((epicsUInt32)h->checkword != NCP_K_CHECKWORD) || (h->protocol_type != NCP_C_PRTYPE_NAM)) return;
+
+    if (h->message_type == NCP_C_MSGTYPE_INQUIRY) {
+        /* Inquiries are multicast, every module which matches the inquiry type responds */
+        inquiry_type = frame->data[0];
+        for (i=0; i<num_modules; i++) {
+            m = &modules[i];
+            owned = !COMPARE_ENET_ADDR(m->owner_id, unowned);
+            if ((inquiry_type == NCP_C_INQTYPE_UNOWNED) && owned) continue;
+            if ((inquiry_type == NCP_C_INQTYPE_NOTMINE) &&
+                COMPARE_ENET_ADDR(m->owner_id, e->source)) continue;
+            emu_send_status(m, e->source, frame->snap_header.snap_id);
+        }
+        return;
+    }
+
+    if (h->message_type != NCP_C_MSGTYPE_PACKET) return;
+    for (i=0; i<num_modules; i++) {
+        if (COMPARE_ENET_ADDR(modules[i].address, e->dest)) break;
+    }
+    if (i == num_modules) return;
+    m = &modules[i];
+    pkt = (struct ncp_comm_packet *)frame->data;
+    LSWAP(pkt->packet_size);
+    SSWAP(pkt->packet_code);
+    if (pkt->packet_type != NCP_C_PTYPE_HCOMMAND) return;
+    if (pkt->packet_size > sizeof(frame->data) - sizeof(*pkt)) return;
+    if ((loss > 0) && (emu_random() < loss)) {
+        m->dropped++;
+        return;
+    }
+    emu_command(m, e->source, frame->snap_header.snap_id, h->message_number,
+                pkt->packet_code, frame->data + sizeof(*pkt), pkt->packet_size);
+}
+
+/*******************************************************************************
+*
+* emu_random_channel returns a channel for a count: a peak at 1/3 of the range
+* with 70% of the counts, on a flat background.
+*
+*******************************************************************************/
+static int emu_random_channel(int channels)
+{
+    double x;
+
+    if (emu_random() < 0.7) {
+        /* Box-Muller */
+        x = channels/3. + channels/100. * sqrt(-2.*log(emu_random())) * cos(2.*M_PI*emu_random());
+        if ((x >= 0) && (x < channels)) return (int)x;
+    }
+    return (int)(emu_random() * channels);
+}
+
+/*******************************************************************************
+*
+* emu_acquire updates the inputs which are acquiring for "dt" seconds.
+*
+*******************************************************************************/
+static void emu_acquire(double dt)
+{
+    int i, adc, n, k, channel, channels;
+    struct emu_module *m;
+    struct emu_input *in;
+    epicsUInt32 word, list_size;
+    double counts;
+
+    for (i=0; i<num_modules; i++) {
+        m = &modules[i];
+        for (adc=0; adc<EMU_INPUTS; adc++) {
+            in = &m->input[adc];
+            if (!in->acquiring) continue;
+            if ((in->alimit <= in->address) || !emu_check_range(m, in->address, in->alimit - in->address + 1)) {
+                emu_stop(m, adc, 1);
+                continue;
+            }
+            channels = (in->alimit - in->address + 1) / 4;
+            in->ereal += dt * EMU_TICKS_PER_SEC;
+            in->elive += dt * EMU_TICKS_PER_SEC * (1. - EMU_DEAD_TIME);
+            counts = count_rate * dt * (1. - EMU_DEAD_TIME) + in->pending;
+            n = (int)counts;
+            in->pending = counts - n;
+            list_size = emu_list_size(in);
+            for (k=0; k<n; k++) {
+                channel = emu_random_channel(channels);
+                if (in->mode == NCP_C_AMODE_DLIST) {
+                    int b = in->list_current;
+                    /* Both buffers full, events are lost until the host releases one */
+                    if (in->list_full[b] || (list_size < 4)) break;
+                    emu_put32(m->memory + in->address + b*list_size + in->list_offset[b], channel);
+                    in->list_offset[b] += 4;
+                    if (in->list_offset[b] + 4 > list_size) {
+                        in->list_full[b] = 1;
+                        if (in->event_valid)
+                            emu_send_event(m, in->event_snap, NCP_C_EVTYPE_BUFFER, adc, b);
+                        if (!in->list_full[1-b]) in->list_current = 1-b;
+                    }
+                } else {
+                    word = emu_get32(m->memory + in->address + channel*4);
+                    emu_put32(m->memory + in->address + channel*4, word + 1);
+                }
+                if (((in->pend == 0) && (in->pstart == 0)) ||
+                    ((channel >= (int)in->pstart) && (channel <= (int)in->pend)))
+                    in->totals++;
+            }
+            if ((in->plive && (in->elive >= in->plive)) ||
+                (in->preal && (in->ereal >= in->preal)) ||
+                (in->ptotals && (in->totals >= in->ptotals))) {
+                emu_stop(m, adc, 1);
+            }
+        }
+    }
+}
+
+static void emu_report(void)
+{
+    int i;
+    struct emu_module *m;
+
+    printf("Module    Owner              Commands   Dropped    Errors      MB returned\n");
+    for (i=0; i<num_modules; i++) {
+        m = &modules[i];
+        printf("NI%02x%02x%02x  %02x:%02x:%02x:%02x:%02x:%02x  %10lu %9lu %9lu %14.3f\n",
+               m->address[3], m->address[4], m->address[5],
+               m->owner_id[0], m->owner_id[1], m->owner_id[2],
+               m->owner_id[3], m->owner_id[4], m->owner_id[5],
+               m->commands, m->dropped, m->errors, m->bytes_returned/1e6);
+    }
+}
+
+static void emu_signal(int sig)
+{
+    done = 1;
+}
+
+static int emu_open(char *device)
+{
+    struct sockaddr_ll addr;
+    struct packet_mreq mreq;
+
+    /* AIM packets are 802.3 frames with an LLC/SNAP header */
+    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
+    if (sockfd == -1) {
+        printf("nmcEmulator: socket: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_802_2);
+    addr.sll_ifindex = if_nametoindex(device);
+    if (addr.sll_ifindex == 0) {
+        printf("nmcEmulator: unknown interface %s\n", device);
+        return -1;
+    }
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        printf("nmcEmulator: bind: %s\n", strerror(errno));
+        return -1;
+    }
+    /* The emulated modules have their own Ethernet addresses, and inquiries are multicast */
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = addr.sll_ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+        printf("nmcEmulator: PACKET_ADD_MEMBERSHIP: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void emu_usage(char *name)
+{
+    printf("Usage: %s [-m modules] [-a base address (hex)] [-s memory bytes]\n"
+           "       [-w hardware revision] [-f firmware revision]\n"
+           "       [-c counts/s per input] [-l loss fraction] [-v] interface\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, length;
+    unsigned int base_address = 0x100, address;
+    epicsUInt32 memory_size = 0x100000;
+    struct emu_frame frame;
+    struct pollfd pfd;
+    double now, last;
+
+    while ((opt = getopt(argc, argv, "m:a:s:w:f:c:l:v")) != -1) {
+        switch (opt) {
+        case 'm': num_modules = atoi(optarg); break;
+        case 'a': base_address = strtoul(optarg, NULL, 16); break;
+        case 's': memory_size = strtoul(optarg, NULL, 0); break;
+        case 'w': hw_revision = atoi(optarg); break;
+        case 'f': fw_revision = atoi(optarg); break;
+        case 'c': count_rate = atof(optarg); break;
+        case 'l': loss = atof(optarg); break;
+        case 'v': verbose = 1; break;
+        default: emu_usage(argv[0]); return 1;
+        }
+    }
+    if ((optind != argc - 1) || (num_modules < 1) || (num_modules > EMU_MAX_MODULES) ||
+        (memory_size < 4) || (count_rate < 0) || (loss < 0) || (loss >= 1)) {
+        emu_usage(argv[0]);
+        return 1;
+    }
+
+    for (i=0; i<num_modules; i++) {
+        /* The same address mapping as nmc_build_enet_addr */
+        address = base_address + i;
+        modules[i].address[0] = 0;
+        modules[i].address[1] = 0;
+        modules[i].address[2] = 0xAF;
+        modules[i].address[3] = (address >> 16) & 0xff;
+        modules[i].address[4] = (address >> 8) & 0xff;
+        modules[i].address[5] = address & 0xff;
+        modules[i].memory_size = memory_size;
+        modules[i].memory = (epicsUInt8 *)calloc(1, memory_size);
+        if (modules[i].memory == NULL) {
+            printf("nmcEmulator: cannot allocate %u bytes\n", memory_size);
+            return 1;
+        }
+    }
+    if (emu_open(argv[optind]) != 0) return 1;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGINT, emu_signal);
+    signal(SIGTERM, emu_signal);
+    printf("nmcEmulator: %d modules NI%06x to NI%06x on %s\n", num_modules,
+           base_address, base_address + num_modules - 1, argv[optind]);
+
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    last = emu_time();
+    while (!done) {
+        if (poll(&pfd, 1, EMU_POLL_MS) > 0) {
+            while ((length = recv(sockfd, &frame, sizeof(frame), MSG_DONTWAIT)) > 0) {
+                /* Ignore our own frames */
+                if (frame.enet_header.source[0] == 0 && frame.enet_header.source[1] == 0 &&
+                    frame.enet_header.source[2] == 0xAF) continue;
+                emu_receive(&frame, length);
+            }
+        }
+        now = emu_time();
+        if (now - last >= EMU_POLL_MS/1000.) {
+            emu_acquire(now - last);
+            last = now;
+        }
+    }
+    emu_report();
+    close(sockfd);
+    return 0;
+}
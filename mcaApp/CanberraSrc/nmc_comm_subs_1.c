@@ -67,6 +67,24 @@
 *   03-Dec-2009    mlr   Added support for WinPcap on Windows, moved from libnet to WinPcap on Cygwin
 *   03-Jun-2013    rls   Added VxWorks 6.8 (and above) support. VxWorks 6.x support
 *                        requires INCLUDE_NET_POOL BSP option.
+*   19-Oct-2026          Added nmc_sendcmd_pipelined, which keeps several commands
+*                        outstanding, used by nmc_acqu_getmemory.
+*   19-Oct-2026          Received packets are put in buffers from a pool, and the
+*                        message queues pass pointers to the buffers, rather than
+*                        copying the packets into and out of the queues.
+*   19-Oct-2026          Added USE_AFPACKET, Linux AF_PACKET sockets with a
+*                        memory-mapped receive ring, in nmcAfPacket.c.
+*   19-Oct-2026          nmc_findmod_by_addr uses a hash table index of module
+*                        addresses, rather than searching nmc_module_info.
+*   19-Oct-2026          The response timeout is computed from the measured round
+*                        trip time of each module and doubled after a timeout, and
+*                        modules are unreachable after max_tries*timeout_time
+*                        without a response.  Added nmc_report_module.
+*   19-Oct-2026          Added command slots.  nmcEtherGrab passes each response
+*                        to the slot which sent the command, by message number, and
+*                        the module interlock is no longer held while waiting for
+*                        responses, so several threads can have commands
+*                        outstanding to a module at once.
 *******************************************************************************/
 
 #include "nmc_sys_defs.h"
@@ -101,6 +119,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <osiSock.h>
+#include <epicsAtomic.h>
+#include <epicsTime.h>
 
 #ifdef USE_WINPCAP
   #ifdef _WIN32
@@ -128,9 +148,26 @@
 
 struct nmc_module_info_struct *nmc_module_info; /* Keeps info on modules */
 struct nmc_comm_info_struct *nmc_comm_info;     /* Keeps comm info */
+/* Index of nmc_module_info by module address, see nmc_findmod_by_addr.
+ * Each slot is 0 if unused, or the module number + 1. */
+static int nmc_module_index[NMC_K_MODULE_INDEX_SIZE];
 char sys_node_name[9] = {"        "};           /* System node name */
 static int nmc_event_hdl(struct event_packet *epkt);
+static int nmc_buildcmd(int module, int slot, struct response_packet *pkt,
+                        int command, void *data, int dsize);
+static int nmc_alloc_slot(int module);
+static void nmc_free_slot(int module, int slot);
+static void nmc_free_number(int module, int slot, int number);
+static int nmc_rx_pool_create(struct nmc_comm_info_struct *i);
+static unsigned int nmc_hash_addr(unsigned char *address);
+static void nmc_index_module(int module);
+static void nmc_rtt_sample(struct nmc_module_info_struct *m,
+                           struct nmc_comm_info_struct *i, double rtt);
+static void nmc_rtt_backoff(struct nmc_module_info_struct *m,
+                            struct nmc_comm_info_struct *i);
+static void nmc_count_command(struct nmc_module_info_struct *m, int tries);
 volatile int aimDebug = 0;
+volatile int aimGetMemoryWindow = NMC_K_DEFAULT_WINDOW;
 extern char list_buffer_ready_array[2];   /* Is this needed ? */
 
 epicsMutexId nmc_global_mutex = NULL;   /* Mutual exclusion semaphore to
@@ -181,7 +218,7 @@ int nmc_initialize(char *device)
     char hostname[256];
 #ifdef USE_SOCKETS
     struct sockaddr_llc saddr;
-#else
+#elif !defined(USE_AFPACKET)
     char errbuf[PCAP_ERRBUF_SIZE];
     struct bpf_program bpfprog;      /* hold compiled program     */
     bpf_u_int32 netp =0;             /* ip                        */
@@ -262,6 +299,8 @@ found:
     i->timeout_time = 1000;            /* 1000 ms */
     i->max_msg_size = NMC_K_MAX_NIMSG; /* Maximum Ethernet message size */
     i->max_tries = 3;                  /* we try to send commands trice */
+    /* Several threads can send commands at once, but packets are sent one at a time */
+    i->send_mutex = epicsMutexCreate();
 
     /*
      * Use the "extended 802" protocol (SNAP), using as our ID
@@ -331,6 +370,12 @@ found:
     i->dest.sllc_sap = LLC_SNAP_LSAP;
 
 
+#elif defined(USE_AFPACKET)
+    /* Get our Ethernet address */
+    if((s=nmc_get_niaddr(device,i->sys_address)) == ERROR) goto signal;
+    /* Open the AF_PACKET socket and map the receive ring */
+    if ((s=nmcAfPacketOpen(i, device)) != OK) goto signal;
+
 #else /* USE_SOCKETS */
     /* If we are not using sockets then we must be using pcap */
     errbuf[0]='\0';
@@ -459,6 +504,12 @@ found:
         goto signal;
     } 
 
+    /* Create the pool of receive buffers */
+    if (nmc_rx_pool_create(i) != OK) {
+        s = errno;
+        goto signal;
+    }
+
 #ifndef USE_SOCKETS
     /* Define the size of the device dependent header */
     i->header_size = sizeof(struct enet_header) + sizeof(struct snap_header);
@@ -535,7 +586,7 @@ void nmc_cleanup()
    int net;
    struct nmc_comm_info_struct *i = NULL;
    struct nmc_module_info_struct *p;
-   int module;
+   int module, slot;
 
     /* FIXME,  */
     /* missing:
@@ -554,20 +605,40 @@ We should shut down Status and Broadcast thread first */
       if (i->valid) {
 #ifdef USE_SOCKETS
          close(i->sockfd);
+#elif defined(USE_AFPACKET)
+         nmcAfPacketClose(i);
 #endif
          if (i->statusQ != NULL) {
             epicsMessageQueueDestroy(i->statusQ);
                                      i->statusQ = NULL;
          }
+         if (i->rx_freeQ != NULL) {
+            epicsMessageQueueDestroy(i->rx_freeQ);
+            i->rx_freeQ = NULL;
+         }
+         free(i->rx_buffers);
+         i->rx_buffers = NULL;
+         if (i->send_mutex != NULL) {
+            epicsMutexDestroy(i->send_mutex);
+            i->send_mutex = NULL;
+         }
       }
    }
    if (nmc_module_info != NULL) {
       for (module=0; module<NMC_K_MAX_MODULES; module++) {
          p = &nmc_module_info[module];
          if (!p->valid) break;
-         if (p->responseQ != NULL) {
-            epicsMessageQueueDestroy(p->responseQ);
-            p->responseQ = NULL;
+         for (slot=0; slot<NMC_K_MAX_SLOTS; slot++) {
+            if (p->slots[slot].responseQ != NULL) {
+               epicsMessageQueueDestroy(p->slots[slot].responseQ);
+               p->slots[slot].responseQ = NULL;
+            }
+            free(p->slots[slot].out_pkt);
+            p->slots[slot].out_pkt = NULL;
+         }
+         if (p->free_slotQ != NULL) {
+            epicsMessageQueueDestroy(p->free_slotQ);
+            p->free_slotQ = NULL;
          }
          if (p->module_mutex != NULL) {
             epicsMutexDestroy(p->module_mutex);
@@ -575,6 +646,7 @@ We should shut down Status and Broadcast thread first */
          }
       }
    }
+   memset(nmc_module_index, 0, sizeof(nmc_module_index));
    if (nmc_comm_info != NULL) free(nmc_comm_info);
    if (nmc_module_info != NULL) free(nmc_module_info);
    nmc_comm_info = NULL;
@@ -592,28 +664,44 @@ void nmcEthCapture(struct nmc_comm_info_struct *i)
     struct sockaddr_llc from;
     int fromlen = sizeof(from);
     int length;
-    struct response_packet buf;
+    struct nmc_rx_buffer *b;
+    struct nmc_rx_buffer discard;
     /* Start reading in from the snap ID */
     int offset = offsetof(struct response_packet, snap_header.snap_id);
 
     epicsEventSignal(semStartup);
     while(1) {
-        length = recvfrom(i->sockfd, ((char*)&buf) + offset,
-                          sizeof(buf) - offset, 0, 
+        /* Receive directly into a buffer from the pool.  If the pool is empty
+         * the packet is read into a local buffer and dropped. */
+        b = nmc_alloc_rx_buffer(i);
+        length = recvfrom(i->sockfd, ((char*)&(b ? b : &discard)->pkt) + offset,
+                          sizeof(discard.pkt) - offset, 0, 
                           (struct sockaddr *)&from, &fromlen);
+        if (b == NULL) {
+            nmc_signal("nmcEthCapture: no free receive buffers", 0);
+            continue;
+        }
         /*
          * If this packet is from an AIM module, pass it on to nmcEtherGrab.
          * This test is based upon the first 3 bytes of the source address
          * being 00 00 AF, which is the Nuclear Data (Canberra) company code.
          */
-        if ( from.sllc_mac[0] == 0 &&
+        if ( length > 0 &&
+             from.sllc_mac[0] == 0 &&
              from.sllc_mac[1] == 0 &&
              from.sllc_mac[2] == 0xAF ) {
-            memcpy(buf.enet_header.source, from.sllc_mac, 6);
-            nmcEtherGrab((char *)&buf, length + offset);
+            memcpy(b->pkt.response.enet_header.source, from.sllc_mac, 6);
+            b->length = length + offset;
+            nmcEtherGrab(b);
+        } else {
+            nmc_free_rx_buffer(b);
         }
     }
 
+    return;
+#elif defined(USE_AFPACKET)
+    epicsEventSignal(semStartup);
+    nmcAfPacketCapture(i);
     return;
 #else
 
@@ -645,62 +733,147 @@ void nmcEthCapture(struct nmc_comm_info_struct *i)
 * nmcEtherGrab()
 *
 * nmcEtherGrab looks at all matching Ethernet packets.
-* AIM response packets are written to the nmcResponseQ
+* AIM response packets are written to the responseQ of the command slot waiting
+* for them
 * AIM status and event packets are written to the nmcStatusQ
 * All other packets are ignored.
 *
+* The queues pass pointers to receive buffers from the pool.  With sockets the
+* packet has already been received into a buffer by nmcEthCapture, with AF_PACKET
+* it has been copied from the receive ring by nmcAfPacketCapture, with pcap it is
+* copied from the pcap buffer here.  Buffers which are not queued are returned
+* to the pool.
+*
 *******************************************************************************/
-#ifdef USE_SOCKETS
-void nmcEtherGrab(char *buffer, int length)
+#if defined(USE_SOCKETS) || defined(USE_AFPACKET)
+void nmcEtherGrab(struct nmc_rx_buffer *b)
 {
     struct enet_header *h;
     struct snap_header *s;
     struct nmc_comm_info_struct *net;
-    int module;
+    struct nmc_module_info_struct *m;
+    int  length, module, slot;
 
-    h = (struct enet_header *)buffer;
-    s = (struct snap_header *)(h + 1);
-    net = nmc_comm_info;
+    net = b->net;
+    length = b->length;
 #else /* USE_SOCKETS */
 void nmcEtherGrab(unsigned char* usrdata, const struct pcap_pkthdr* pkthdr, const unsigned char *buffer)
 {
     struct enet_header *h;
     struct snap_header *s;
     struct nmc_comm_info_struct *net;
-    int  length, module;
+    struct nmc_module_info_struct *m;
+    struct nmc_rx_buffer *b;
+    int  length, module, slot;
 
-    h = (struct enet_header *) buffer;
-    s = (struct snap_header *) (h + 1);
     net = (struct nmc_comm_info_struct *) usrdata;
     length = pkthdr->caplen;
+    if (length > (int)sizeof(b->pkt)) length = sizeof(b->pkt);
+    if ((b = nmc_alloc_rx_buffer(net)) == NULL) {
+        nmc_signal("nmcEtherGrab: no free receive buffers", 0);
+        return;
+    }
+    memcpy(&b->pkt, buffer, length);
+    b->length = length;
 #endif
+    h = &b->pkt.response.enet_header;
+    s = &b->pkt.response.snap_header;
 
     if (aimDebug > 4) errlogPrintf("(nmcEtherGrab): got a %d byte packet from AIM\n", length);
 
     /* If the packet has the statusSNAP ID then write the message to the statusQ */
     if (COMPARE_SNAP(s->snap_id, net->status_snap)) {
-        if (epicsMessageQueueSend(net->statusQ, (char *)buffer, length) == -1) {
+        if (epicsMessageQueueSend(net->statusQ, &b, sizeof(b)) == -1) {
             nmc_signal("nmcEtherGrab: Status Queue write failed", -1);  
+            goto release;
         }
+        return;
     }
-    /* If the packet has the responseSNAP ID then write the message to the responseQ for this module */
+    /* If the packet has the responseSNAP ID then write the message to the responseQ of
+     * the command slot which sent the message with this message number */
     else if (COMPARE_SNAP(s->snap_id, net->response_snap)) {
         if (aimDebug > 4) errlogPrintf("(nmcEtherGrab): ...response packet\n");
         if (nmc_findmod_by_addr(&module, h->source) == OK) {
-            if (aimDebug > 4) errlogPrintf("(nmcEtherGrab): sending %d bytes to module %d (%p)\n",
-                                           length, module, (void *)nmc_module_info[module].responseQ);
-            if (epicsMessageQueueSend(nmc_module_info[module].responseQ, (char *)buffer, length) == -1) {
-                nmc_signal("nmcEtherGrab: Message Queue of module full",module);
+            m = &nmc_module_info[module];
+            /* Read the slot atomically rather than taking the module interlock, this
+             * thread must not block on a command thread.  If the slot is freed just
+             * after it is read the response is flushed or discarded by its message
+             * number. */
+            slot = epicsAtomicGetIntT(&m->message_slot[b->pkt.response.ncp_comm_header.message_number]);
+            if (slot < 0) {
+                /* A late response to a command which has finished */
+                if (aimDebug > 0) errlogPrintf("(nmcEtherGrab): no command waiting for message_number=%d\n",
+                                               b->pkt.response.ncp_comm_header.message_number);
+                goto release;
             }
+            if (aimDebug > 4) errlogPrintf("(nmcEtherGrab): sending %d bytes to module %d slot %d\n",
+                                           length, module, slot);
+            if (epicsMessageQueueSend(m->slots[slot].responseQ, &b, sizeof(b)) == -1) {
+                nmc_signal("nmcEtherGrab: Message Queue of module full",NMC__INVMODRESP);
+                goto release;
+            }
+            return;
         } else { 
-            nmc_signal("nmcEtherGrab: Can't find module",module);
+            nmc_signal("nmcEtherGrab: Can't find module",NMC__NOSUCHMODULE);
         }
     } else {
         if (aimDebug > 0) errlogPrintf("(nmcEtherGrab): ...unrecognized SNAP ID\n");
         nmc_signal("nmcEtherGrab: unrecognized SNAP ID",NMC__INVMODRESP);
     }
+release:
+    nmc_free_rx_buffer(b);
     return;
 }
+
+/*******************************************************************************
+*
+* The pool of receive buffers.
+*
+* nmc_rx_pool_create allocates NMC_K_RX_BUFFERS buffers for a network device and
+* puts them on its queue of free buffers.  It is called from nmc_initialize.
+*
+* nmc_alloc_rx_buffer takes a buffer from the pool.  It does not wait, it returns
+* NULL if there are no free buffers, in which case the packet is dropped and the
+* command will be retried.
+*
+* nmc_free_rx_buffer returns a buffer to the pool it came from.  The free queue
+* can hold all of the buffers, so this never waits.
+*
+*******************************************************************************/
+
+static int nmc_rx_pool_create(struct nmc_comm_info_struct *i)
+{
+    int n;
+    struct nmc_rx_buffer *b;
+
+    i->rx_buffers = (struct nmc_rx_buffer *)
+                        calloc(NMC_K_RX_BUFFERS, sizeof(struct nmc_rx_buffer));
+    if (i->rx_buffers == NULL) return ERROR;
+    if ((i->rx_freeQ = epicsMessageQueueCreate(NMC_K_RX_BUFFERS, 
+                                               sizeof(struct nmc_rx_buffer *))) == 0)
+        return ERROR;
+    for (n=0; n<NMC_K_RX_BUFFERS; n++) {
+        b = &i->rx_buffers[n];
+        b->net = i;
+        epicsMessageQueueSend(i->rx_freeQ, &b, sizeof(b));
+    }
+    return OK;
+}
+
+struct nmc_rx_buffer *nmc_alloc_rx_buffer(struct nmc_comm_info_struct *i)
+{
+    struct nmc_rx_buffer *b;
+
+    if (epicsMessageQueueTryReceive(i->rx_freeQ, &b, sizeof(b)) != sizeof(b))
+        return NULL;
+    return b;
+}
+
+void nmc_free_rx_buffer(struct nmc_rx_buffer *b)
+{
+    if (b == NULL) return;
+    epicsMessageQueueSend(b->net->rx_freeQ, &b, sizeof(b));
+}
 
 /******************************************************************************
 *
@@ -714,25 +887,22 @@ void nmcEtherGrab(unsigned char* usrdata, const struct pcap_pkthdr* pkthdr, cons
 
 int nmcStatusDispatch(struct nmc_comm_info_struct *i)
 {
-    int s, len;
-    struct status_packet pkt;   /* This assumes a status_packet is larger */
-    struct status_packet *spkt; /*  than an event packet, which is true */
+    int len;
+    struct nmc_rx_buffer *b;
+    struct status_packet *spkt;
     struct event_packet *epkt;
     struct ncp_comm_header *p;
 
     while (1) {
-        len = epicsMessageQueueReceive(i->statusQ, &pkt, sizeof(pkt));
-        if (len < 0)
-            s=ERROR;
-        else
-            s=OK;
-        if (s==ERROR) {
+        len = epicsMessageQueueReceive(i->statusQ, &b, sizeof(b));
+        if (len != sizeof(b)) {
             nmc_signal("nmcStatusDispatch:1",errno);
+            continue;
         }
 
         /* Swap byte order */
-        nmc_byte_order_in(&pkt);
-        p = &pkt.ncp_comm_header;
+        nmc_byte_order_in(&b->pkt);
+        p = &b->pkt.status.ncp_comm_header;
         if (p->checkword != NCP_K_CHECKWORD ||
             p->protocol_type != NCP_C_PRTYPE_NAM)
             nmc_signal("nmcStatusDispatch:2",NMC__INVMODRESP);
@@ -740,8 +910,8 @@ int nmcStatusDispatch(struct nmc_comm_info_struct *i)
         /*
          * See what kind of message we've got and call the appropriate handler
          */
-        spkt = (struct status_packet *) &pkt;
-        epkt = (struct event_packet *) &pkt;
+        spkt = &b->pkt.status;
+        epkt = &b->pkt.event;
 
         if(p->message_type == NCP_C_MSGTYPE_MSTATUS)
             nmc_status_hdl(i, spkt);
@@ -749,6 +919,7 @@ int nmcStatusDispatch(struct nmc_comm_info_struct *i)
         else if(p->message_type == NCP_C_MSGTYPE_MEVENT)
             nmc_event_hdl(epkt);
 
+        nmc_free_rx_buffer(b);
     }
     return OK;
 }
@@ -812,7 +983,7 @@ static int nmc_event_hdl(struct event_packet *epkt)
 
 int nmc_status_hdl(struct nmc_comm_info_struct *net, struct status_packet *pkt)
 {
-    int module,s=0;
+    int module,slot,s=0;
     struct nmc_module_info_struct *p;
     struct ncp_comm_mstatus *m;
     struct ncp_comm_header *h;
@@ -849,30 +1020,46 @@ int nmc_status_hdl(struct nmc_comm_info_struct *net, struct status_packet *pkt)
         /* All acquisition memory is available for allocation */
         p->free_address = 0;
         p->current_message_number = 0;
-        /* Create the message queue for response packets */
-        if ((p->responseQ = epicsMessageQueueCreate(MAX_RESPONSE_Q_MESSAGES, 
-                                                    MAX_RESPONSE_Q_MSG_SIZE)) == 0) {
-             nmc_signal("Unable to create response Queue",0);
+        /* Until the round trip time is measured use the configured timeout */
+        p->rto = net->timeout_time/1000.;
+        /* No command is waiting for any message number */
+        for (slot=0; slot<256; slot++) p->message_slot[slot] = -1;
+        /* Create the command slots, each with a message queue for response packets
+         * and a buffer for output packets, input packets are in the receive buffer
+         * pool.  All of the slots are free. */
+        if ((p->free_slotQ = epicsMessageQueueCreate(NMC_K_MAX_SLOTS, sizeof(int))) == 0) {
+             nmc_signal("Unable to create free slot Queue",0);
              goto done;
         }
+        for (slot=0; slot<NMC_K_MAX_SLOTS; slot++) {
+            if ((p->slots[slot].responseQ = epicsMessageQueueCreate(MAX_RESPONSE_Q_MESSAGES, 
+                                                                    MAX_RESPONSE_Q_MSG_SIZE)) == 0) {
+                 nmc_signal("Unable to create response Queue",0);
+                 goto done;
+            }
+            p->slots[slot].out_pkt = (struct response_packet *)
+                                         calloc(1, sizeof(struct response_packet));
+            epicsMessageQueueSend(p->free_slotQ, &slot, sizeof(slot));
+        }
         /* Create a semaphore to interlock access to this module */
         p->module_mutex = epicsMutexCreate();
 
-        /* Allocate buffers for input and output packets */
-        p->in_pkt = (struct response_packet *)
-                         calloc(1, sizeof(struct response_packet));
-        p->out_pkt = (struct response_packet *)
-                         calloc(1, sizeof(struct response_packet));
+        /* Now that the module is set up, nmcEtherGrab can find it */
+        nmc_index_module(module);
 
         /* Call the module ownership change handler */
+        MODULE_INTERLOCK_ON(module);
         s=nmc_owner_hdl(module, h);
+        MODULE_INTERLOCK_OFF(module);
         /* Signal that we know about the first module so initialisation can
            continue (must do this after we change the ownership state!) */
         epicsEventSignal(gotModule);
     } else {
         /* Call the module ownership change handler */
         GLOBAL_INTERLOCK_ON;
+        MODULE_INTERLOCK_ON(module);
         s=nmc_owner_hdl(module, h);
+        MODULE_INTERLOCK_OFF(module);
     }
 
 done:
@@ -892,7 +1079,8 @@ done:
 * from nmc_status_hdl (for status packets) and from nmc_getmsg (for response
 * packets).
 *
-* Interlocks for global variables are already on when this routine is called.
+* The module interlock must be on when this routine is called, the command
+* threads of the module and nmc_status_hdl can call it at the same time.
 *
 ******************************************************************************/
 int nmc_owner_hdl(int module, struct ncp_comm_header *h)
@@ -933,7 +1121,7 @@ int nmc_owner_hdl(int module, struct ncp_comm_header *h)
 *
 * Its calling format is:
 *
-*       status=NMC_GETMSG(module,buffer,buffer size,message size)
+*       status=NMC_GETMSG(module,slot,buffer,timeout)
 *
 * where
 *
@@ -941,22 +1129,23 @@ int nmc_owner_hdl(int module, struct ncp_comm_header *h)
 *
 *  "module" (longword) is the module number.
 *
-*  "buffer" (array of char) is where the received message should be put.
+*  "slot" (longword) is the command slot which sent the command.
 *
-*  "buffer size" (longword) is the size of "buffer".
+*  "buffer" (returned address, by reference) is the receive buffer containing
+*   the message.  The size of the message is in buffer->length.  The caller must
+*   return the buffer to the pool with nmc_free_rx_buffer.
 *
-*  "message size" (returned longword, by reference) is the size of the received
-*   message.
+*  "timeout" (double) is the time in seconds to wait for the message.
 *
-* This routine is called from nmc_sendcmd.
-*
-* Interlocks for global variables are already on when this routine is called.
+* This routine is called from nmc_sendcmd and nmc_sendcmd_pipelined.
+* It interlocks access to the module's communication and ownership state.
 *
 *******************************************************************************/
-int nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual)
+int nmc_getmsg(int module, int slot, struct nmc_rx_buffer **buffer, double timeout)
 {
     int  s=0, len;
     struct nmc_comm_info_struct *i;
+    struct nmc_rx_buffer *b;
     struct enet_header *e;
     struct ncp_comm_header *p;
     struct nmc_module_info_struct *m;
@@ -976,9 +1165,7 @@ int nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual)
          * ETHERNET: Read a message from the response queue with timeout
          */
  read:
-        /* The timeout_time is in milliseconds, convert to seconds */
-        len = epicsMessageQueueReceiveWithTimeout(m->responseQ, pkt, sizeof(*pkt), (double)(i->timeout_time/1000.));
-        if (aimDebug > 5) errlogPrintf("(nmc_getmsg): message length:%d (%p)\n", len, (void *)m->responseQ);
+        len = epicsMessageQueueReceiveWithTimeout(m->slots[slot].responseQ, &b, sizeof(b), timeout);
         if (len < 0) {
             if (aimDebug > 0) errlogPrintf("(nmc_getmsg): timeout while waiting for message\n");
             s = errno;
@@ -989,8 +1176,9 @@ int nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual)
          * Make sure the message came from the right module:
          *  if not, throw it away and try again
          */
-        e = &pkt->enet_header;
-        p = &pkt->ncp_comm_header;
+        if (aimDebug > 5) errlogPrintf("(nmc_getmsg): message length:%d, slot %d\n", b->length, slot);
+        e = &b->pkt.response.enet_header;
+        p = &b->pkt.response.ncp_comm_header;
         if (!COMPARE_ENET_ADDR( e->source, m->address)) {
             if (aimDebug > 0) errlogPrintf("(nmc_getmsg): message from wrong module!\n");
             if (aimDebug > 0) errlogPrintf("              actual: %2.2x%2.2x%2.2x%2.2x%2.2x%2.2x\n",
@@ -999,13 +1187,16 @@ int nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual)
             if (aimDebug > 0) errlogPrintf("           should be: %2.2x%2.2x%2.2x%2.2x%2.2x%2.2x\n", 
                 m->address[0], m->address[1], m->address[2], m->address[3], m->address[4], 
                 m->address[5]);
+            nmc_free_rx_buffer(b);
             goto read;
         }
 
         /*
          * Zero out the "unanswered message" counter
          */
-        nmc_module_info[module].inqmsg_counter = 0;
+        MODULE_INTERLOCK_ON(module);
+        m->inqmsg_counter = 0;
+        m->module_comm_state = NMC_K_MCS_REACHABLE;
 
         /*
          * If the module's owner is different from that in the database call
@@ -1015,13 +1206,14 @@ int nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual)
          * to have byte order swapped.
          */
 
-        if (!COMPARE_ENET_ADDR(p->owner_id, nmc_module_info[module].owner_id))
+        if (!COMPARE_ENET_ADDR(p->owner_id, m->owner_id))
             nmc_owner_hdl(module, p);
+        MODULE_INTERLOCK_OFF(module);
 
         /*
-         * Return the received message size to the caller
+         * Return the received message to the caller
          */
-        *actual = len;
+        *buffer = b;
         return OK;
     }
 
@@ -1043,11 +1235,12 @@ signal:
 
 /*******************************************************************************
 *
-* NMC_FLUSH_INPUT gets rid of any queued messages in the response queue.
+* NMC_FLUSH_INPUT gets rid of any queued messages in the response queue of a
+* command slot.
 *
 * Its calling format is:
 *
-*       status=NMC_FLUSH_INPUT(module)
+*       status=NMC_FLUSH_INPUT(module,slot)
 *
 * where
 *
@@ -1055,16 +1248,18 @@ signal:
 *
 *  "module" (longword) is the module number.
 *
-* This routine is called from nmc_sendcmd.
-* Interlocks for global variables are already on when this routine is called.
+*  "slot" (longword) is the command slot.
+*
+* This routine is called from nmc_alloc_slot.
+* No interlocks are needed, only the thread which took the slot reads its queue.
 *
 *******************************************************************************/
 
-int nmc_flush_input(int module)
+int nmc_flush_input(int module, int slot)
 {
-    int s, len;
+    int s;
     struct nmc_comm_info_struct *i;
-    char temp[MAX_RESPONSE_Q_MSG_SIZE];
+    struct nmc_rx_buffer *b;
 
     /* The module is known to be valid and reachable - checked in nmc_sendcmd */
     i = nmc_module_info[module].comm_device;
@@ -1079,8 +1274,8 @@ int nmc_flush_input(int module)
         /*
          * ETHERNET: Read messages from the queue until none remain.
          */
-        do len = epicsMessageQueueReceiveWithTimeout(nmc_module_info[module].responseQ, temp, sizeof(temp), 0.);
-        while (len != ERROR);
+        while (epicsMessageQueueTryReceive(nmc_module_info[module].slots[slot].responseQ, &b, sizeof(b)) == sizeof(b))
+            nmc_free_rx_buffer(b);
         return OK;
     }
 
@@ -1112,7 +1307,7 @@ int nmc_flush_input(int module)
 *  "buffer size" (longword) is the size of "buffer".
 *
 * This routine is called from nmc_sendcmd.
-* Interlocks for global variables are already on when this routine is called.
+* It interlocks access to the network device.
 *
 *******************************************************************************/
 
@@ -1132,8 +1327,10 @@ int nmc_putmsg(int module, struct response_packet *pkt, int size)
         case NMC_K_DTYPE_ETHERNET:
 
         /*
-         * Ethernet: Just send the message.
+         * Ethernet: Just send the message.  Other threads may be sending to this
+         * or other modules on the same network.
          */
+        epicsMutexLock(i->send_mutex);
         COPY_SNAP(i->response_snap, pkt->snap_header.snap_id);
 #if defined(USE_SOCKETS)
         /* Send from the snap ID. The socket code will do the rest */
@@ -1179,7 +1376,12 @@ int nmc_putmsg(int module, struct response_packet *pkt, int size)
         if (ret != 0) printf("Error writing ethernet packet, error=%d\n", ret);
         if (aimDebug > 0) errlogPrintf("(nmc_putmsg): wrote %d bytes\n", 
                                        length + sizeof(pkt->enet_header));
+#elif defined(USE_AFPACKET)
+        ret = nmcAfPacketSend(i, nmc_module_info[module].address, &pkt->enet_header, length);
+        if (aimDebug > 0) errlogPrintf("(nmc_putmsg): wrote %d bytes of %d\n", 
+                                       ret, length + (int)sizeof(pkt->enet_header));
 #endif
+        epicsMutexUnlock(i->send_mutex);
         return OK;
     }
     /*
@@ -1192,6 +1394,123 @@ int nmc_putmsg(int module, struct response_packet *pkt, int size)
 
 }
 
+/*******************************************************************************
+*
+* nmc_alloc_slot takes a free command slot of a module, waiting until there is
+* one, and throws away any responses left in its queue.  It returns the slot
+* number.
+*
+* nmc_free_slot returns a command slot to the module.  Responses to the messages
+* sent from the slot which arrive later are thrown away by nmcEtherGrab.
+*
+* nmc_free_number frees one message number sent from a slot, when the slot no
+* longer waits for a response to it.  A later response to it is thrown away by
+* nmcEtherGrab, until the number is used again.
+*
+* These routines are called from nmc_sendcmd and nmc_sendcmd_pipelined.
+* They interlock access to the module's message numbers.
+*
+*******************************************************************************/
+
+static int nmc_alloc_slot(int module)
+{
+    int slot;
+
+    epicsMessageQueueReceive(nmc_module_info[module].free_slotQ, &slot, sizeof(slot));
+    nmc_flush_input(module, slot);
+    return slot;
+}
+
+static void nmc_free_slot(int module, int slot)
+{
+    struct nmc_module_info_struct *m = &nmc_module_info[module];
+    int n;
+
+    MODULE_INTERLOCK_ON(module);
+    for (n=0; n<256; n++) {
+        if (m->message_slot[n] == slot) epicsAtomicSetIntT(&m->message_slot[n], -1);
+    }
+    MODULE_INTERLOCK_OFF(module);
+    epicsMessageQueueSend(m->free_slotQ, &slot, sizeof(slot));
+}
+
+static void nmc_free_number(int module, int slot, int number)
+{
+    struct nmc_module_info_struct *m = &nmc_module_info[module];
+
+    MODULE_INTERLOCK_ON(module);
+    if (m->message_slot[number] == slot) epicsAtomicSetIntT(&m->message_slot[number], -1);
+    MODULE_INTERLOCK_OFF(module);
+}
+
+/*******************************************************************************
+*
+* NMC_BUILDCMD builds a command message for a module in a packet buffer.
+*
+* The calling format is:
+*
+*       size=NMC_BUILDCMD(module,slot,packet,command code,packet data,data size)
+*
+* where
+*
+*  "size" is the size of the message to be passed to nmc_putmsg, or ERROR if
+*   all of the message numbers are in use.
+*
+* The module's current message number is advanced, skipping numbers which
+* command slots, including this one, are waiting for, and the message is sent
+* with that number.  The number is recorded as belonging to "slot", so
+* nmcEtherGrab passes the response to that slot.  A number which is in use is
+* never taken.  Each slot has at most NMC_K_MAX_WINDOW numbers in use, so this
+* only fails if numbers are not freed.
+*
+* This routine is called from nmc_sendcmd and nmc_sendcmd_pipelined.
+* It interlocks access to the module's message numbers.
+*
+*******************************************************************************/
+
+static int nmc_buildcmd(int module, int slot, struct response_packet *pkt,
+                        int command, void *data, int dsize)
+{
+    struct nmc_module_info_struct *m = &nmc_module_info[module];
+    struct ncp_comm_header *h;
+    struct ncp_comm_packet *p;
+    unsigned char *d;
+    int cmdsize, n;
+
+    h = &pkt->ncp_comm_header;
+    p = &pkt->ncp_comm_packet;
+    d = &pkt->ncp_packet_data[0];
+
+    memset(h, 0, sizeof(*h) + sizeof(*p));
+    h->checkword = NCP_K_CHECKWORD;
+    h->protocol_type = NCP_C_PRTYPE_NAM;
+    h->message_type = NCP_C_MSGTYPE_PACKET;
+    /* advance the current message number to one which no slot is waiting for */
+    MODULE_INTERLOCK_ON(module);
+    for (n=0; n<256; n++) {
+        m->current_message_number++;
+        if (m->message_slot[m->current_message_number] < 0) break;
+    }
+    if (n == 256) {
+        MODULE_INTERLOCK_OFF(module);
+        if (aimDebug > 0) errlogPrintf("(nmc_buildcmd): no free message number\n");
+        return ERROR;
+    }
+    h->message_number = m->current_message_number;
+    epicsAtomicSetIntT(&m->message_slot[h->message_number], slot);
+    MODULE_INTERLOCK_OFF(module);
+    h->data_size = sizeof(*p) + dsize;
+    cmdsize = sizeof(*h) + h->data_size;
+    p->packet_size = dsize;
+    p->packet_type = NCP_C_PTYPE_HCOMMAND;
+    p->packet_code = command;
+
+    memcpy(d, data, dsize);
+    /*Swap byte order */
+    nmc_byte_order_out(pkt);
+    return cmdsize;
+}
+
 /*******************************************************************************
 *
 * NMC_SENDCMD sends a command message to a module and gets the response.
@@ -1239,19 +1558,20 @@ int nmc_putmsg(int module, struct response_packet *pkt, int size)
 int nmc_sendcmd(int module, int command, void *data, int dsize, void *response,
                 int rsize, int *size, int oflag)
 {
-    int s,tries,rmsgsize,cmdsize;
+    int s,tries,invalid=0,cmdsize,code=0,slot=-1;
+    unsigned char number;
+    double elapsed,timeout;
+    epicsTimeStamp start,sent,now;
     struct ncp_comm_header *h;
     struct ncp_comm_packet *p=NULL;
-    unsigned char *d;
     struct nmc_comm_info_struct *i;
     struct nmc_module_info_struct *m;
+    struct nmc_rx_buffer *b;
     /* Note, this code is specific to Ethernet. It will need
      * a little work if other networks are ever supported */
 
     if (aimDebug > 7) errlogPrintf("(nmc_sendcmd): enter\n");
 
-    MODULE_INTERLOCK_ON(module);
-
     m = &nmc_module_info[module];
     /*
      * Make sure the module number is reasonable, and that the data size isn't too
@@ -1279,66 +1599,70 @@ int nmc_sendcmd(int module, int command, void *data, int dsize, void *response,
     }
 
 
+    /*
+     * Take a command slot.  Other threads can send commands to the module while we
+     * wait for the response, the responses are passed to the slots by message number.
+     */
+    slot = nmc_alloc_slot(module);
+
     /*
      * Build the protocol and command packet headers, and copy the command arguments
      * into the packet data area.
      */
-    h = &m->out_pkt->ncp_comm_header;
-    p = &m->out_pkt->ncp_comm_packet;
-    d = &m->out_pkt->ncp_packet_data[0];
-
-    s = sizeof(*h) + sizeof(*p);
-    memset(h, 0, s);
-    h->checkword = NCP_K_CHECKWORD;
-    h->protocol_type = NCP_C_PRTYPE_NAM;
-    h->message_type = NCP_C_MSGTYPE_PACKET;
-    /* advance the current message number */
-    m->current_message_number++;       
-    h->message_number = m->current_message_number;
-    h->data_size = sizeof(*p) + dsize;
-    cmdsize = sizeof(*h) + h->data_size;
-    p->packet_size = dsize;
-    p->packet_type = NCP_C_PTYPE_HCOMMAND;
-    p->packet_code = command;
-
-    memcpy(d, data, dsize);
-    /*Swap byte order */
-    nmc_byte_order_out(m->out_pkt);
-
-    nmc_flush_input(module);        /* make sure there are no queued messages */
+    cmdsize = nmc_buildcmd(module, slot, m->slots[slot].out_pkt, command, data, dsize);
+    if (cmdsize == ERROR) {
+        s = NMC__MODCOMMERR;
+        goto done;
+    }
+    number = m->slots[slot].out_pkt->ncp_comm_header.message_number;
+    epicsTimeGetCurrent(&start);
+    timeout = m->rto;
 
     /*
-     * Send the command - try i->max_tries times to get a valid response
+     * Send the command, and send it again if there is no valid response within the
+     * timeout.  Give up if there is no valid response within max_tries*timeout_time,
+     * or after max_tries invalid responses.
      */
-    for (tries=0; tries < i->max_tries; tries++) {
-        if ((s=nmc_putmsg(module, m->out_pkt, cmdsize)) == ERROR) goto done;
+    for (tries=0; ; tries++) {
+        nmc_count_command(m, tries);
+        if ((s=nmc_putmsg(module, m->slots[slot].out_pkt, cmdsize)) == ERROR) goto done;
+        epicsTimeGetCurrent(&sent);
 
         /*
          * Receive the module's response message. Retry if there was an error.
          */
-        if (nmc_getmsg(module,m->in_pkt,sizeof(*(m->in_pkt)),&rmsgsize) == ERROR) 
+        if (nmc_getmsg(module,slot,&b,timeout) == ERROR) {
+            nmc_rtt_backoff(m, i);
             goto retry;
-        m->module_comm_state = NMC_K_MCS_REACHABLE;
+        }
         /* Swap byte order */
-        nmc_byte_order_in(m->in_pkt);
+        nmc_byte_order_in(&b->pkt);
 
         /*
          * If the message came from the right module, make sure it's
          * basically a valid message.
          */
 
-        h = &m->in_pkt->ncp_comm_header;
-        p = &m->in_pkt->ncp_comm_packet;
+        h = &b->pkt.response.ncp_comm_header;
+        p = &b->pkt.response.ncp_comm_packet;
         *size = p->packet_size;
-        if(h->message_number != m->current_message_number ||
+        if(h->message_number != number ||
             h->checkword != NCP_K_CHECKWORD ||
             h->protocol_type != NCP_C_PRTYPE_NAM ||
             p->packet_type != NCP_C_PTYPE_MRESPONSE) {
             if (aimDebug > 0) errlogPrintf("(nmc_sendcmd): message_number=%d, current=%d\n", 
-                                           h->message_number, m->current_message_number);
+                                           h->message_number, number);
+            nmc_free_rx_buffer(b);
+            if (++invalid >= i->max_tries) break;
             goto retry;
         }
 
+        /* Only time the response to the first try, a later response could be to any try */
+        if (tries == 0) {
+            epicsTimeGetCurrent(&now);
+            nmc_rtt_sample(m, i, epicsTimeDiffInSeconds(&now, &sent));
+        }
+
         /*
          * Pick out the module response and return the data. If the
          * module returned a false status, signal it.
@@ -1347,33 +1671,404 @@ int nmc_sendcmd(int module, int command, void *data, int dsize, void *response,
          */
 
         if(*size > rsize) *size = rsize;
-        if(*size != 0) memcpy(response, m->in_pkt->ncp_packet_data, *size);
+        if(*size != 0) memcpy(response, b->pkt.response.ncp_packet_data, *size);
+        code = p->packet_code;
+        nmc_free_rx_buffer(b);
         /* Success ! */
         s = OK;
         goto done;
 
 retry:
-        if (aimDebug > 0) errlogPrintf("(nmc_sendcmd): tries=%d, max_tries=%d, timeout_time=%f\n", 
-               tries, i->max_tries, i->timeout_time);
+        if (aimDebug > 0) errlogPrintf("(nmc_sendcmd): tries=%d, timeout=%f\n", tries, timeout);
         s = NMC__INVMODRESP;
+        epicsTimeGetCurrent(&now);
+        elapsed = epicsTimeDiffInSeconds(&now, &start);
+        if (elapsed >= i->max_tries*i->timeout_time/1000.) break;
+        /* Don't wait past the time limit */
+        timeout = m->rto;
+        if (timeout > i->max_tries*i->timeout_time/1000. - elapsed)
+            timeout = i->max_tries*i->timeout_time/1000. - elapsed;
     }
 
-    /* If we get here then the module failed to respond after max_tries tries. */
+    /* If we get here then the module failed to respond within the time limit. */
+    MODULE_INTERLOCK_ON(module);
     m->module_comm_state = NMC_K_MCS_UNREACHABLE;
+    MODULE_INTERLOCK_OFF(module);
     s = NMC__MODNOTREACHABLE;
     if (aimDebug > 0) errlogPrintf("(nmc_sendcmd): module %d is unreachable\n", module);
 
 done:
-    MODULE_INTERLOCK_OFF(module);
+    if (slot >= 0) nmc_free_slot(module, slot);
     if (s == OK)
         /* Return the module packet code */
-        return p->packet_code;
+        return code;
     else {
         nmc_signal("nmc_sendcmd",s);      
         return ERROR;
     }
 }
 
+/*******************************************************************************
+*
+* NMC_SENDCMD_PIPELINED sends a series of commands to a module, keeping several
+* commands outstanding, and gets the responses.
+*
+* The calling format is:
+*
+*       status=NMC_SENDCMD_PIPELINED(module,command code,packet data,data size,
+*                       number of commands,response buffers,response sizes,
+*                       window,not owned flag)
+*
+* where
+*
+*  "status" is the status of the operation. Any errors have been signaled.
+*   If an error occurs status = ERROR. If the operation was sucessful then
+*   status = the module response packet code, which is the command code.
+*
+*  "module" (longword) is the number of the module.
+*
+*  "command code" (longword) is the host command code, which is the same for
+*   all of the commands.
+*
+*  "packet data" (array) contains the data for each command, "data size" bytes
+*   per command.
+*
+*  "data size" (longword) is the size of the packet data of each command.
+*
+*  "number of commands" (longword) is the number of commands to send.
+*
+*  "response buffers" (array of addresses) is where the module response data of
+*   each command is put.
+*
+*  "response sizes" (array of longwords) is the size in bytes of the response
+*   to each command.  A shorter response is treated as an error.
+*
+*  "window" (longword) is the maximum number of commands which are sent before
+*   their responses are received, 1 to NMC_K_MAX_WINDOW.  With a window of 1
+*   this is the same as calling nmc_sendcmd for each command.
+*
+*  "not owned flag" (longword) is a flag which indicates that is
+*   is legal to send the command to a module which is not owned by us.
+*
+* Each command is sent with its own message number, and the responses are matched
+* to the commands by message number, so they may arrive in any order.  Responses to
+* commands which are no longer outstanding are thrown away.  If no response arrives
+* within the timeout all outstanding commands are sent again, and if an invalid or
+* short response arrives that command is sent again.  The module is marked
+* unreachable if a command gets no response within max_tries*timeout_time, or
+* max_tries invalid responses.
+*
+* This routine is called by application programs.
+*
+* It interlocks access to global variables.
+*
+*******************************************************************************/
+
+int nmc_sendcmd_pipelined(int module, int command, void *data, int dsize, int ncmds,
+                          void **response, int *rsize, int window, int oflag)
+{
+    int s,k,c,next,nbusy,ncomplete,size,cmd_slot=-1;
+    epicsTimeStamp now;
+    struct ncp_comm_header *h;
+    struct ncp_comm_packet *p;
+    struct nmc_comm_info_struct *i;
+    struct nmc_module_info_struct *m;
+    struct nmc_rx_buffer *b=NULL;
+    struct response_packet *out_pkts=NULL;
+    int win_cmd[NMC_K_MAX_WINDOW];                 /* command in each window position, -1 if free */
+    int win_size[NMC_K_MAX_WINDOW];                /* message size in each slot */
+    unsigned char win_number[NMC_K_MAX_WINDOW];    /* message number in each slot */
+    epicsTimeStamp win_first[NMC_K_MAX_WINDOW];    /* time the command was first sent */
+    epicsTimeStamp win_sent[NMC_K_MAX_WINDOW];     /* time the command was last sent */
+    int *tries=NULL;
+
+    if (aimDebug > 7) errlogPrintf("(nmc_sendcmd_pipelined): enter\n");
+
+    if (window < 1) window = 1;
+    if (window > NMC_K_MAX_WINDOW) window = NMC_K_MAX_WINDOW;
+    if (window > ncmds) window = ncmds;
+
+    m = &nmc_module_info[module];
+    if (nmc_check_module(module, &s, &i) != NMC_K_MCS_REACHABLE) {
+        if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): module not reachable on entry\n");
+        goto done;
+    }
+    if(dsize > (i->max_msg_size - sizeof(*h) - sizeof(*p))) {
+        if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): message too big\n");
+        s=NMC__MSGTOOBIG;
+        goto done;
+    }
+    if(m->module_ownership_state != NMC_K_MOS_OWNEDBYUS && !oflag) {
+        if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): module not owned by us\n");
+        s=NMC__UNOWNEDMOD; 
+        goto done;
+    }
+
+    out_pkts = (struct response_packet *)malloc(window * sizeof(struct response_packet));
+    tries = (int *)calloc(ncmds, sizeof(int));
+    if (out_pkts == NULL || tries == NULL) {
+        s = errno;
+        goto done;
+    }
+    for (k=0; k<window; k++) win_cmd[k] = -1;
+    next = 0;
+    nbusy = 0;
+    ncomplete = 0;
+
+    /* All of the commands are sent from one command slot */
+    cmd_slot = nmc_alloc_slot(module);
+
+    while (ncomplete < ncmds) {
+        /* Return the previous response to the receive buffer pool */
+        nmc_free_rx_buffer(b);
+        b = NULL;
+
+        /*
+         * Fill the window with the next commands
+         */
+        for (k=0; k<window && next < ncmds; k++) {
+            if (win_cmd[k] >= 0) continue;
+            win_size[k] = nmc_buildcmd(module, cmd_slot, &out_pkts[k], command,
+                                        (char *)data + next*dsize, dsize);
+            if (win_size[k] == ERROR) {
+                s = NMC__MODCOMMERR;
+                goto done;
+            }
+            win_cmd[k] = next;
+            win_number[k] = out_pkts[k].ncp_comm_header.message_number;
+            if ((s=nmc_putmsg(module, &out_pkts[k], win_size[k])) == ERROR) goto done;
+            epicsTimeGetCurrent(&win_first[k]);
+            win_sent[k] = win_first[k];
+            nmc_count_command(m, 0);
+            next++;
+            nbusy++;
+        }
+
+        /*
+         * Receive the next response.  If none arrives send all outstanding
+         * commands again, with new message numbers.  The old numbers are freed, a
+         * late response to them is thrown away.
+         */
+        if (nmc_getmsg(module,cmd_slot,&b,m->rto) == ERROR) {
+            b = NULL;
+            if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): timeout with %d commands outstanding\n",
+                                           nbusy);
+            nmc_rtt_backoff(m, i);
+            epicsTimeGetCurrent(&now);
+            for (k=0; k<window; k++) {
+                if (win_cmd[k] < 0) continue;
+                if (epicsTimeDiffInSeconds(&now, &win_first[k]) >= 
+                    i->max_tries*i->timeout_time/1000.) goto unreachable;
+                tries[win_cmd[k]]++;
+                nmc_count_command(m, tries[win_cmd[k]]);
+                nmc_free_number(module, cmd_slot, win_number[k]);
+                win_size[k] = nmc_buildcmd(module, cmd_slot, &out_pkts[k], command,
+                                            (char *)data + win_cmd[k]*dsize, dsize);
+                if (win_size[k] == ERROR) {
+                    s = NMC__MODCOMMERR;
+                    goto done;
+                }
+                win_number[k] = out_pkts[k].ncp_comm_header.message_number;
+                if ((s=nmc_putmsg(module, &out_pkts[k], win_size[k])) == ERROR) goto done;
+                epicsTimeGetCurrent(&win_sent[k]);
+            }
+            continue;
+        }
+        /* Swap byte order */
+        nmc_byte_order_in(&b->pkt);
+
+        /*
+         * Find the command with this message number.  If there is none this is
+         * a late response to a command which has been sent again, throw it away.
+         */
+        h = &b->pkt.response.ncp_comm_header;
+        p = &b->pkt.response.ncp_comm_packet;
+        for (k=0; k<window; k++) {
+            if ((win_cmd[k] >= 0) && (win_number[k] == h->message_number)) break;
+        }
+        if (k == window) {
+            if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): discarding message_number=%d\n", 
+                                           h->message_number);
+            continue;
+        }
+        c = win_cmd[k];
+        size = p->packet_size;
+        if(h->checkword != NCP_K_CHECKWORD ||
+           h->protocol_type != NCP_C_PRTYPE_NAM ||
+           p->packet_type != NCP_C_PTYPE_MRESPONSE ||
+           size < rsize[c]) {
+            if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): invalid response to command %d, size=%d, expected=%d\n", 
+                                           c, size, rsize[c]);
+            if (++tries[c] >= i->max_tries) goto unreachable;
+            nmc_count_command(m, tries[c]);
+            nmc_free_number(module, cmd_slot, win_number[k]);
+            win_size[k] = nmc_buildcmd(module, cmd_slot, &out_pkts[k], command,
+                                        (char *)data + c*dsize, dsize);
+            if (win_size[k] == ERROR) {
+                s = NMC__MODCOMMERR;
+                goto done;
+            }
+            win_number[k] = out_pkts[k].ncp_comm_header.message_number;
+            if ((s=nmc_putmsg(module, &out_pkts[k], win_size[k])) == ERROR) goto done;
+            epicsTimeGetCurrent(&win_sent[k]);
+            continue;
+        }
+        if(p->packet_code != command) {
+            if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): bad response expected=%d, actual=%d\n",
+                                           command, p->packet_code);
+            s = NMC__INVMODRESP;
+            goto done;
+        }
+
+        /* Only time the response to the first try, a later response could be to any try */
+        if (tries[c] == 0) {
+            epicsTimeGetCurrent(&now);
+            nmc_rtt_sample(m, i, epicsTimeDiffInSeconds(&now, &win_sent[k]));
+        }
+
+        /* Copy the data directly from the receive buffer to the caller's buffer */
+        if(rsize[c] != 0) memcpy(response[c], b->pkt.response.ncp_packet_data, rsize[c]);
+        nmc_free_number(module, cmd_slot, win_number[k]);
+        win_cmd[k] = -1;
+        nbusy--;
+        ncomplete++;
+    }
+    /* Success ! */
+    s = OK;
+    goto done;
+
+unreachable:
+    /* If we get here then the module failed to respond within the time limit. */
+    MODULE_INTERLOCK_ON(module);
+    m->module_comm_state = NMC_K_MCS_UNREACHABLE;
+    MODULE_INTERLOCK_OFF(module);
+    s = NMC__MODNOTREACHABLE;
+    if (aimDebug > 0) errlogPrintf("(nmc_sendcmd_pipelined): module %d is unreachable\n", module);
+
+done:
+    if (cmd_slot >= 0) nmc_free_slot(module, cmd_slot);
+    nmc_free_rx_buffer(b);
+    free(out_pkts);
+    free(tries);
+    if (s == OK)
+        return command;
+    else {
+        nmc_signal("nmc_sendcmd_pipelined",s);      
+        return ERROR;
+    }
+}
+
+/*******************************************************************************
+*
+* nmc_rtt_sample updates the round trip time estimates of a module with a
+* measured round trip time "rtt" in seconds, and computes the timeout for
+* responses, as TCP does (RFC 6298).
+*
+* nmc_rtt_backoff doubles the timeout after a response was not received.  It
+* stays doubled until the next round trip time is measured.
+*
+* nmc_count_command counts a command sent to a module, "tries" is 0 for the
+* first time it is sent and is greater than 0 when it is sent again.
+*
+* The timeout is kept between NMC_K_MIN_RTO and the configured timeout_time.
+*
+* These routines are called from nmc_sendcmd and nmc_sendcmd_pipelined.
+* They interlock access to the module's round trip time estimates and
+* statistics.
+*
+*******************************************************************************/
+
+static void nmc_rtt_sample(struct nmc_module_info_struct *m,
+                           struct nmc_comm_info_struct *i, double rtt)
+{
+    int k;
+    double limit, diff;
+
+    epicsMutexLock(m->module_mutex);
+    if (m->srtt == 0.) {
+        m->srtt = rtt;
+        m->rttvar = rtt/2.;
+    } else {
+        diff = m->srtt - rtt;
+        if (diff < 0.) diff = -diff;
+        m->rttvar = 0.75*m->rttvar + 0.25*diff;
+        m->srtt = 0.875*m->srtt + 0.125*rtt;
+    }
+    m->rto = m->srtt + 4.*m->rttvar;
+    if (m->rto < NMC_K_MIN_RTO) m->rto = NMC_K_MIN_RTO;
+    if (m->rto > i->timeout_time/1000.) m->rto = i->timeout_time/1000.;
+
+    /* The histogram bins double in width, the last bin has all longer times */
+    for (k=0, limit=NMC_K_RTT_BIN0; k < NMC_K_RTT_BINS-1; k++, limit*=2.) {
+        if (rtt < limit) break;
+    }
+    m->rtt_histogram[k]++;
+    epicsMutexUnlock(m->module_mutex);
+}
+
+static void nmc_rtt_backoff(struct nmc_module_info_struct *m,
+                            struct nmc_comm_info_struct *i)
+{
+    epicsMutexLock(m->module_mutex);
+    m->timeouts++;
+    m->rto *= 2.;
+    if (m->rto > i->timeout_time/1000.) m->rto = i->timeout_time/1000.;
+    epicsMutexUnlock(m->module_mutex);
+}
+
+static void nmc_count_command(struct nmc_module_info_struct *m, int tries)
+{
+    epicsMutexLock(m->module_mutex);
+    if (tries == 0) m->commands++;
+    else m->retries++;
+    epicsMutexUnlock(m->module_mutex);
+}
+
+/*******************************************************************************
+*
+* NMC_REPORT_MODULE prints the communication statistics of a module: the number
+* of commands, retries and timeouts, the round trip time estimates and timeout,
+* and the histogram of round trip times.
+*
+* The calling format is:
+*
+*       NMC_REPORT_MODULE(fp,module)
+*
+* where
+*
+*  "fp" (FILE *) is the file to print to.
+*
+*  "module" (longword) is the number of the module.
+*
+* This routine is called from the report functions of the AIM and ICB drivers.
+* It does not interlock access to the statistics, they are only printed.
+*
+*******************************************************************************/
+
+void nmc_report_module(FILE *fp, int module)
+{
+    struct nmc_module_info_struct *m;
+    int k;
+    double limit;
+
+    if (nmc_module_info == NULL || module < 0 || module >= NMC_K_MAX_MODULES) return;
+    m = &nmc_module_info[module];
+    if (!m->valid) return;
+    fprintf(fp, "    NI module %d (%2.2X%2.2X%2.2X): commands=%lu, retries=%lu, timeouts=%lu\n",
+            module, m->address[3], m->address[4], m->address[5],
+            m->commands, m->retries, m->timeouts);
+    fprintf(fp, "      round trip time=%.3f ms, variation=%.3f ms, timeout=%.1f ms\n",
+            m->srtt*1000., m->rttvar*1000., m->rto*1000.);
+    fprintf(fp, "      round trip time histogram:\n");
+    for (k=0, limit=NMC_K_RTT_BIN0; k < NMC_K_RTT_BINS; k++, limit*=2.) {
+        if (m->rtt_histogram[k] == 0) continue;
+        if (k < NMC_K_RTT_BINS-1)
+            fprintf(fp, "        < %9.2f ms: %lu\n", limit*1000., m->rtt_histogram[k]);
+        else
+            fprintf(fp, "        >=%9.2f ms: %lu\n", limit/2.*1000., m->rtt_histogram[k]);
+    }
+}
+
 /*******************************************************************************
 *
 * NMC_GET_NIADDR returns the Ethernet network address of this system.
@@ -1507,8 +2202,8 @@ int nmc_get_niaddr(char *device, unsigned char *address)
 
 /*******************************************************************************
 *
-* NMC_FINDMOD_BY_ADDR looks through the module database to find the module with
-* the specified address.
+* NMC_FINDMOD_BY_ADDR looks up the module with the specified address in the
+* module database.
 *
 * The calling sequence is:
 *
@@ -1523,16 +2218,16 @@ int nmc_get_niaddr(char *device, unsigned char *address)
 *
 *  "address" (6 byte array) is the address of the module to find.
 *
-* This routine is called from application programs.
-* It interlocks access to global variables.
+* This routine is called from application programs, and for every response
+* packet from nmcEtherGrab in the capture thread.
+* It does not interlock access to global variables, see below.
 *
 *******************************************************************************/
 
 int nmc_findmod_by_addr(int *module, unsigned char *address)
 {
-
-    struct nmc_module_info_struct *p;
-    int s;
+    unsigned int slot;
+    int n, entry;
 
     if (aimDebug > 7) errlogPrintf("nmc_findmod_by_addr enter\n");
     /*
@@ -1543,41 +2238,73 @@ int nmc_findmod_by_addr(int *module, unsigned char *address)
 
     if(nmc_module_info == NULL) return NMC__NOSUCHMODULE;
 
-    /* GLOBAL_INTERLOCK_ON; */
-    /* Above call commented out, since this function is called from 
-     * nmcEtherGrab, which is the callback registered with etherInputHookAdd.
-     * It is not clear if the callback is called at interrupt level (in which
-     * case semTake(), done by GLOBAL_INTERLOCK_ON, is definitely illegal. In
-     * any case, using GLOBAL_INTERLOCK_ON in this function causes the vxWorks
-     * network to lock up from time to time.  We live with the low-risk chance
-     * that a new AIM module was added to the database while this routine is
-     * being called.
+    /* This function is called from nmcEtherGrab, which must not block, so it does not
+     * use GLOBAL_INTERLOCK_ON.  That used to cause the vxWorks network to lock up from
+     * time to time.  Instead the index is only changed by nmc_index_module, which
+     * fills an unused slot after the module's entry has been set up, and slots are
+     * never emptied while the network is running, so this can safely search the index
+     * while a module is being added.
      */
 
     /*
-     * Just look through the module database for the specified module
+     * Search the index, starting at the slot for this address, until the module or an
+     * unused slot is found
      */
-
-    for (*module=0; *module < NMC_K_MAX_MODULES; (*module)++) {
-        p = &nmc_module_info[*module];
-        if(!p->valid) break;       /* terminate after the last valid module */
-        if (COMPARE_ENET_ADDR(address, p->address)) {
-            s = OK;
-            goto done;
-        }
+    slot = nmc_hash_addr(address);
+    for (n=0; n < NMC_K_MODULE_INDEX_SIZE; n++) {
+        entry = epicsAtomicGetIntT(&nmc_module_index[slot]);
+        if (entry == 0) break;
+        /* Pairs with the write barrier in nmc_index_module, so the module's entry is read
+         * after the slot */
+        epicsAtomicReadMemoryBarrier();
+        *module = entry - 1;
+        if (COMPARE_ENET_ADDR(address, nmc_module_info[*module].address)) return OK;
+        slot = (slot + 1) & (NMC_K_MODULE_INDEX_SIZE - 1);
     }
 
-    s = ERROR;
-done:
-    /* GLOBAL_INTERLOCK_OFF; */
-    /* Not needed, see comment under GLOBAL_INTERLOCK_ON */
-    return s;       /* We don't signal errors, since sometimes we just
+    return ERROR;   /* We don't signal errors, since sometimes we just
                      *  want to check and see if a module is currently
                      *  in the database.
                      */
 }
 
-
+/*******************************************************************************
+*
+* nmc_hash_addr returns the slot in nmc_module_index at which to start looking for
+* a module address.  The first 3 bytes of the address are the Canberra company
+* code, so only the last 3 are used.
+*
+* nmc_index_module adds a module to nmc_module_index.  It is called from
+* nmc_status_hdl, after the module's entry in nmc_module_info has been set up.
+*
+* Interlocks for global variables are already on when nmc_index_module is called.
+*
+*******************************************************************************/
+
+static unsigned int nmc_hash_addr(unsigned char *address)
+{
+    unsigned int key;
+
+    key = (address[3] << 16) | (address[4] << 8) | address[5];
+    /* Multiplicative hashing, the top bits of the product are well mixed */
+    return ((key * 2654435761u) >> (32 - NMC_K_MODULE_INDEX_BITS)) &
+           (NMC_K_MODULE_INDEX_SIZE - 1);
+}
+
+static void nmc_index_module(int module)
+{
+    unsigned int slot;
+
+    slot = nmc_hash_addr(nmc_module_info[module].address);
+    while (nmc_module_index[slot] != 0)
+        slot = (slot + 1) & (NMC_K_MODULE_INDEX_SIZE - 1);
+    /* epicsAtomicSetIntT does not order the earlier stores, so the barrier is needed to
+     * make the module's entry visible to other threads before the slot */
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicSetIntT(&nmc_module_index[slot], module + 1);
+}
+
+
 /******************************************************************************
 * NMC_CHECK_MODULE(module, err, net);
 * Checks that "module" is a valid number. Returns the module comm_status field
@@ -438,6 +438,9 @@ int nmc_broadcast_inq(struct nmc_comm_info_struct *i, int inqtype, int addr)
       SSWAP_LITTLE(ipkt.enet_header.length);
       ret = pcap_sendpacket(i->pcap, &ipkt, sizeof(ipkt));
       if (ret == 0) ret=sizeof(ipkt); else ret=0;
+#elif defined(USE_AFPACKET)
+      ret = nmcAfPacketSend(i, ipkt.enet_header.dest, &ipkt.enet_header,
+                            sizeof(ipkt) - sizeof(struct enet_header));
 #endif
 
       if (aimDebug > 0) errlogPrintf("(nmc_broadcast_inq): wrote %d bytes of %d\n", ret, sizeof(ipkt));
@@ -453,11 +456,13 @@ int nmc_broadcast_inq(struct nmc_comm_info_struct *i, int inqtype, int addr)
             c = &nmc_module_info[module];
             /* terminate the loop upon the last module */
             if(!c->valid) break; 
+            MODULE_INTERLOCK_ON(module);
             if (c->module_comm_state == NMC_K_MCS_REACHABLE) {
                if(c->inqmsg_counter > NMC_K_MAX_UNANSMSG)
                   c->module_comm_state = NMC_K_MCS_UNREACHABLE;
                c->inqmsg_counter++;
             }
+            MODULE_INTERLOCK_OFF(module);
          }
       }
 
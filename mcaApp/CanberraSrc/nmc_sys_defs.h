@@ -20,8 +20,17 @@
 *       03-Sept-2000 MLR  Added interlocks per module rather than just global
 *                         Made response queue per module rather than global
 *                         Added nmc_broadcast_inq_task().
+*       19-Oct-2026       Added nmc_sendcmd_pipelined() and aimGetMemoryWindow.
+*                         Added the pool of receive buffers, the message queues now
+*                         pass pointers to the buffers.
+*                         Added USE_AFPACKET.
+*                         Added the round trip time estimates, the adaptive
+*                         command timeout, and nmc_report_module().
+*                         Added command slots, so several threads can have commands
+*                         outstanding to a module at once.
 *******************************************************************************/
 
+#include <stdio.h>
 #include <epicsTypes.h>
 #include <ellLib.h>
 #include <epicsMessageQueue.h>
@@ -30,7 +39,7 @@
 #include <epicsThread.h>
 #include <epicsString.h>
 
-#ifdef USE_SOCKETS
+#if defined(USE_SOCKETS) || defined(USE_AFPACKET)
   #include <sys/socket.h>
   #include <net/if.h>
 #endif
@@ -52,7 +61,7 @@
 #else
   #ifdef USE_SOCKETS
    #include "linux-llc.h"
-  #else
+  #elif !defined(USE_AFPACKET)
     #include <libnet.h>
     #include <pcap.h>
   #endif
@@ -98,10 +107,41 @@
 #endif /* vxWorks */
 
 extern volatile int aimDebug;
+extern volatile int aimGetMemoryWindow;
 
 #define NMC_K_MAX_MODULES 64                    /* we can know about 64 modules */
+#define NMC_K_MODULE_INDEX_BITS 7               /* index of modules by address has */
+#define NMC_K_MODULE_INDEX_SIZE (1<<NMC_K_MODULE_INDEX_BITS) /* 2*NMC_K_MAX_MODULES slots */
 #define NMC_K_CAPTURESIZE  2048                 /* Linux pcap Capture Buffer Size*/
 
+/* Response timeout.  The timeout is computed from the measured round trip time,
+ * between NMC_K_MIN_RTO and nmc_comm_info_struct.timeout_time, and doubled each
+ * time a response is not received.  A module is unreachable if no response is
+ * received within max_tries*timeout_time */
+#define NMC_K_MIN_RTO      0.05                 /* Minimum timeout in s */
+#define NMC_K_RTT_BINS     14                   /* Bins of the round trip time histogram: */
+#define NMC_K_RTT_BIN0     0.00025              /* <0.25 ms, <0.5 ms, ... <2048 ms, more */
+
+/* Receive ring for USE_AFPACKET */
+#define NMC_K_AFPACKET_BLOCK_SIZE   (1<<16)     /* Ring block size, multiple of the page size */
+#define NMC_K_AFPACKET_BLOCKS       32          /* Number of blocks in the ring */
+#define NMC_K_AFPACKET_FRAME_SIZE   NMC_K_CAPTURESIZE
+#define NMC_K_AFPACKET_BLOCK_TIMEOUT 1          /* ms before a partly filled block is passed to us */
+
+/*
+* A command slot is used by a thread while it sends commands to a module and
+* waits for the responses.  Each module has several, so several threads can
+* have commands outstanding to a module at once.  nmcEtherGrab passes each
+* response to the slot which sent the message with its message number.
+*/
+
+#define NMC_K_MAX_SLOTS 8                   /* Command slots per module */
+
+struct nmc_cmd_slot {
+   epicsMessageQueueId responseQ;      /* message queue for response messages */
+   struct response_packet *out_pkt;    /* Output packet buffer */
+};
+
 /*
 * This structure contains information concerning the state of networked modules
 * known to the system.
@@ -128,10 +168,20 @@ struct nmc_module_info_struct {
    unsigned char rcv_errors;           /* receive error counter */
    unsigned char timeout_errors;       /* timeout error counter */
    unsigned short int message_counter; /* total messages sent/received */
-   epicsMessageQueueId responseQ;      /* message queue for response messages */
-   epicsMutexId module_mutex;          /* Mutual exclusion semaphore */
-   struct response_packet *in_pkt;     /* Input packet buffer */
-   struct response_packet *out_pkt;    /* Output packet buffer */
+   double srtt;                        /* smoothed round trip time in s, 0 until measured */
+   double rttvar;                      /* round trip time variation in s */
+   double rto;                         /* timeout for a response in s */
+   /* The counters are interlocked by module_mutex, nmc_report_module prints them without it */
+   unsigned long commands;             /* commands sent, not counting retries */
+   unsigned long retries;              /* commands sent again */
+   unsigned long timeouts;             /* responses not received within rto */
+   unsigned long rtt_histogram[NMC_K_RTT_BINS]; /* round trip times, see nmc_rtt_sample */
+   struct nmc_cmd_slot slots[NMC_K_MAX_SLOTS]; /* Command slots */
+   epicsMessageQueueId free_slotQ;     /* Queue of free command slot numbers */
+   int message_slot[256];              /* Slot which sent each message number, -1 if none.
+                                          Written with the interlock, read atomically by nmcEtherGrab */
+   epicsMutexId module_mutex;          /* Interlocks the message numbers, round trip times,
+                                          counters and the communication and ownership state */
 };
 
 /*
@@ -179,15 +229,23 @@ struct nmc_comm_info_struct {
    epicsThreadId broadcast_pid;    /* Thread ID of broadcast poller  */
    epicsThreadId capture_pid;      /* Thread ID of ether capture thread */
    float timeout_time;            /* time in s */
+   epicsMutexId send_mutex;       /* Interlocks sending packets */
    int header_size;               /* The size of the device dependent header */
    int max_msg_size;              /* Largest possible message size */
    int max_tries;                 /* Number of command retries allowed */
    epicsMessageQueueId statusQ;   /* Message queue for status messages */
+   struct nmc_rx_buffer *rx_buffers;   /* Pool of receive buffers */
+   epicsMessageQueueId rx_freeQ;  /* Queue of free receive buffers */
    unsigned char response_snap[SNAP_SIZE]; /* NI SNAP ID for normal messages */
    unsigned char status_snap[SNAP_SIZE];  /* NI SNAP ID for status/event messages */
 #ifdef USE_SOCKETS
    int sockfd;                    /* Socket */
    struct sockaddr_llc dest;      /* addr struct for sending (address overwritten) */
+#elif defined(USE_AFPACKET)
+   int sockfd;                    /* AF_PACKET socket */
+   void *rx_ring;                 /* Memory-mapped TPACKET_V3 receive ring */
+   size_t rx_ring_size;           /* Size of rx_ring in bytes */
+   struct enet_header tx_header;  /* Ethernet header for sending, with our address */
 #else
    pcap_t *pcap;                          /* Pointer to pcap structure */
 #endif
@@ -202,11 +260,30 @@ struct nmc_comm_info_struct {
 
 #define NMC_K_DTYPE_ETHERNET 1                  /* Ethernet network type */
 
+/*
+* Received packets are put in buffers from a pool for each network device,
+* and the message queues pass pointers to the buffers.  The buffers are returned
+* to the pool with nmc_free_rx_buffer().
+*/
+struct nmc_rx_buffer {
+   union {
+      struct response_packet response;
+      struct status_packet status;
+      struct event_packet event;
+   } pkt;
+   int length;                         /* Length of the received packet */
+   struct nmc_comm_info_struct *net;   /* Network device which owns this buffer */
+};
+#define NMC_K_RX_BUFFERS        128
+
 /* Define parameters for the message queues used to pass Ethernet messages */
-#define MAX_RESPONSE_Q_MSG_SIZE sizeof(struct response_packet)
-/*The following assumes status packet is bigger than event packet */
-#define MAX_STATUS_Q_MSG_SIZE   sizeof(struct status_packet)
-#define MAX_RESPONSE_Q_MESSAGES 5
+#define MAX_RESPONSE_Q_MSG_SIZE sizeof(struct nmc_rx_buffer *)
+#define MAX_STATUS_Q_MSG_SIZE   sizeof(struct nmc_rx_buffer *)
+/* Maximum and default number of outstanding commands in nmc_sendcmd_pipelined.
+ * The response queue must be able to hold the responses to all of them. */
+#define NMC_K_MAX_WINDOW        16
+#define NMC_K_DEFAULT_WINDOW    8
+#define MAX_RESPONSE_Q_MESSAGES (2*NMC_K_MAX_WINDOW)
 #define MAX_STATUS_Q_MESSAGES   24
 
 /* Definitions for the linked list of semaphores for event messages */
@@ -243,16 +320,23 @@ IMPORT STATUS nmcStatusDispatch(struct nmc_comm_info_struct *net);
 IMPORT STATUS nmc_status_hdl(struct nmc_comm_info_struct *net,
                              struct status_packet *pkt);
 IMPORT STATUS nmc_owner_hdl(int module, struct ncp_comm_header *p);
-IMPORT STATUS nmc_getmsg(int module, struct response_packet *pkt, int size, int *actual);
-IMPORT STATUS nmc_flush_input(int module);
+IMPORT STATUS nmc_getmsg(int module, int slot, struct nmc_rx_buffer **buffer,
+                         double timeout);
+struct nmc_rx_buffer *nmc_alloc_rx_buffer(struct nmc_comm_info_struct *net);
+void nmc_free_rx_buffer(struct nmc_rx_buffer *buffer);
+IMPORT STATUS nmc_flush_input(int module, int slot);
 IMPORT STATUS nmc_putmsg(int module, struct response_packet *pkt, int size);
 IMPORT STATUS nmc_sendcmd(int module, int command, void *data, int dsize,
                        void *response, int rsize, int *size, int oflag);
+IMPORT STATUS nmc_sendcmd_pipelined(int module, int command, void *data, int dsize,
+                                 int ncmds, void **response, int *rsize,
+                                 int window, int oflag);
 IMPORT STATUS nmc_get_niaddr(char *device, unsigned char *addr);
 IMPORT STATUS nmc_findmod_by_addr(int *module, unsigned char *address);
 IMPORT int    nmc_check_module(int module, int *err,
                                struct nmc_comm_info_struct **net);
 IMPORT STATUS nmc_signal(char *from,int err);
+void nmc_report_module(FILE *fp, int module);
 
 /* These routines are in nmc_comm_subs_2.c" */
 IMPORT STATUS nmc_allocmodnum(int *module);
@@ -260,8 +344,8 @@ IMPORT STATUS nmc_buymodule(int module, int override);
 IMPORT STATUS nmc_allocate_memory(int module, int size, int *base_address);
 IMPORT STATUS nmc_build_enet_addr(int input_addr, unsigned char *output_addr);
 IMPORT STATUS nmc_broadcast_inq_task(struct nmc_comm_info_struct *net);
-#ifdef USE_SOCKETS
-  IMPORT void nmcEtherGrab(char *buffer, int length);
+#if defined(USE_SOCKETS) || defined(USE_AFPACKET)
+  IMPORT void nmcEtherGrab(struct nmc_rx_buffer *buffer);
 #else
   void nmcEtherGrab(unsigned char *,const struct pcap_pkthdr*, const unsigned char*);
 #endif
@@ -272,6 +356,15 @@ IMPORT STATUS nmc_freemodule(int module, int override);
 IMPORT STATUS nmc_byte_order_in(void *pkt);
 IMPORT STATUS nmc_byte_order_out(void *pkt);
 
+#ifdef USE_AFPACKET
+/* These routines are in nmcAfPacket.c */
+int  nmcAfPacketOpen(struct nmc_comm_info_struct *net, char *device);
+void nmcAfPacketClose(struct nmc_comm_info_struct *net);
+void nmcAfPacketCapture(struct nmc_comm_info_struct *net);
+int  nmcAfPacketSend(struct nmc_comm_info_struct *net, unsigned char *dest,
+                     struct enet_header *frame, int length);
+#endif
+
 /* These routines are in nmc_user_subs_1.c */
 IMPORT STATUS nmc_acqu_statusupdate(int module, int adc, int group, int address,
                                  int mode, int *live, int *real, int *totals,
@@ -282,6 +375,8 @@ IMPORT STATUS nmc_acqu_getmemory_cmp(int module, int adc, int saddress, int nrow
 IMPORT STATUS nmc_acqu_getmemory(int module, int adc, int saddress, int nrows,
                                    int start, int row, int channels,
                                    int *address);
+
+/* This routine is in ndl_diffdecm.c */
 IMPORT STATUS ndl_diffdecm(unsigned char *input, int channels, int *output,
                         int chans_left, int *actual_chans);
 
@@ -18,10 +18,17 @@
 *       17-Nov-1997     mlr   Minor mods to eliminate compilier warnings
 *       12-May-2000     mlr   Added "signed" qualifier to char in ndl_diffdecm
 *       06-Sep-2000     mlr   Added some debugging, improved formatting.
+*       19-Oct-2026           nmc_acqu_getmemory sends the retmemory commands with
+*                             nmc_sendcmd_pipelined.
+*       19-Oct-2026           ndl_diffdecm decodes runs of 8 bit differences 8
+*                             channels at a time.
+*       19-Oct-2026           Moved ndl_diffdecm to ndl_diffdecm.c.
 ******************************************************************************/
 
 #include "nmc_sys_defs.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 
 extern struct nmc_module_info_struct *nmc_module_info;
 
@@ -141,9 +148,10 @@ int module,adc,saddress,nrows,start,srow,channels,*address;
 
 {
 
-        int s=ERROR,max_chans,cur_chans,chans_left,max_bytes,actual,i;
-        char *mem_buffer;
-        struct ncp_hcmd_retmemory retmemory;
+        int s=ERROR,max_chans,nsegs,k,i;
+        struct ncp_hcmd_retmemory *retmemory=NULL;
+        void **buffers=NULL;
+        int *sizes=NULL;
 
 /*
 * Determine how many channels can be returned per message from the module
@@ -154,44 +162,54 @@ int module,adc,saddress,nrows,start,srow,channels,*address;
                 sizeof(struct ncp_comm_packet))/4;
 
 /*
-* Now transfer the data. Basically, each time through the loop, we just get 
-* either the number of channels left or the max/message, whichever is smaller.
+* Build one retmemory command per message, each for the max channels/message except
+* the last one.  The commands are sent with up to aimGetMemoryWindow of them
+* outstanding, rather than waiting for each response before sending the next command.
 */
 
-        chans_left = channels;                                /* init channels left to go */
-        mem_buffer = (char *)address;                                /* init current dest address */
-
-        while (chans_left > 0) {
-
-           cur_chans = chans_left;                        /* Get number of chans for this message */
-           if(cur_chans > max_chans) cur_chans = max_chans;
+        if (channels <= 0) return NCP_K_HCMD_RETMEMORY;
+        nsegs = (channels + max_chans - 1)/max_chans;
+        retmemory = (struct ncp_hcmd_retmemory *)malloc(nsegs * sizeof(*retmemory));
+        buffers = (void **)malloc(nsegs * sizeof(*buffers));
+        sizes = (int *)malloc(nsegs * sizeof(*sizes));
+        if (retmemory == NULL || buffers == NULL || sizes == NULL) {
+                nmc_signal("nmc_acqu_getmemory",errno);
+                s = ERROR;
+                goto done;
+        }
 
-           retmemory.address = saddress +                 /* compute source address and size */
-                        ((channels - chans_left) + 
+        for (k=0; k<nsegs; k++) {
+           retmemory[k].address = saddress +                 /* compute source address and size */
+                        (k*max_chans + 
                         (start-1) + (nrows * (srow-1))) * 4; 
-           retmemory.size = cur_chans * 4;
+           sizes[k] = channels - k*max_chans;
+           if (sizes[k] > max_chans) sizes[k] = max_chans;
+           sizes[k] *= 4;
+           retmemory[k].size = sizes[k];
+           buffers[k] = address + k*max_chans;
+        }
 
-           max_bytes = chans_left * 4;
-           s = nmc_sendcmd(module,NCP_K_HCMD_RETMEMORY, /* get the memory */
-                        &retmemory,sizeof(retmemory),mem_buffer,
-                        max_bytes,&actual,1);
-           if(s != NCP_K_HCMD_RETMEMORY || actual == 0) {
+        s = nmc_sendcmd_pipelined(module,NCP_K_HCMD_RETMEMORY, /* get the memory */
+                        retmemory,sizeof(*retmemory),nsegs,buffers,sizes,
+                        aimGetMemoryWindow,1);
+        if(s != NCP_K_HCMD_RETMEMORY) {
                 if (aimDebug > 0) errlogPrintf("(nmc_acqu_getmemory): bad response expected=%d, actual=%d\n",
                         NCP_K_HCMD_RETMEMORY, s);
                 nmc_signal("nmc_acqu_getmemory",NMC__INVMODRESP);
-                return ERROR;
-           }
-
-           chans_left -= actual/4;                        /* Update channels to go and dest address */
-           mem_buffer += (actual & ~3);
-
+                s = ERROR;
+                goto done;
         }
+
         /* Need to byte swap the data on big-endian hosts */
         for (i=0; i<channels; i++) LSWAP(address[i]);
 
 /*
 * All done, return (errors go thru here too)
 */
+done:
+        free(retmemory);
+        free(buffers);
+        free(sizes);
     return s;
 
 }
@@ -284,115 +302,6 @@ int module,adc,saddress,nrows,start,srow,channels,*address;
         return OK;
 }
 
-
-/*******************************************************************************
-*
-* This routine decodes 4 byte differential spectral data. It is specialized for
-* the situation where the data comes from an ND556 AIM, where we know the
-* number of channels (almost) to convert. The AIM can tell us that there is
-* one more channel than there really is if its buffer is full, so we knock one
-* off in this case.
-*
-* The calling format is:
-*
-*       status=NDL_DIFFDECM(input,channels in,output,max channels,actual channels)
-*
-* where
-*
-*  "status" is the status of the operation.
-*
-*  "input" (address) is the address of the encoded data.
-*
-*  "channels in" (longword) is the number of channels of encoded data.
-*
-*  "output" (address) is the address of the output longword array.
-*
-*  "max channels" (longword) is the number of channels in "output".
-*
-*  "actual channels" (returned longword, by reference) is the number of channels
-*   produced by the routine.
-*
-********************************************************************************
-*
-* Revision History:
-*
-*       31-Dec-1993     MLR     Modified from Nuclear Data source
-*       12-May-2000     MLR     Added "signed" keyword to "char".  Was not
-*                               portable, and failed on PowerPC.
-*
-*******************************************************************************/
-
-int ndl_diffdecm(input,channels,output,max_channels,actual_channels)
-   unsigned char *input;
-   int channels;
-   int *output;
-   int max_channels;
-   int *actual_channels;
-
-{
-        unsigned char *input_ptr;       /* points to item we're converting */
-        int value;                      /* current channel's value */
-        int *output_ptr;                /* points to current output channel */
-        int channels_left;              /* number of channels left to process */
-        short sdiff;
-/*
-* First, could the AIM have truncated a channel, or will the caller's buffer
-* overflow?
-*/
-        *actual_channels = channels;
-        if(channels > 285) *actual_channels -= 1;
-        if(*actual_channels > max_channels) *actual_channels = max_channels;
-/*
-* Set up to start the loop
-*/
-        channels_left = *actual_channels;
-        input_ptr = input;
-        output_ptr = output;
-        value = 0;
-/*
-* Loop while there are channels to decompress
-*/
-        while(channels_left) {
-           switch (*input_ptr)
-           {
-
-           /*
-           * Is this a 16 bit value?
-           */
-           case (unsigned char) 0x7f:
-                sdiff = *(short *) (input_ptr + 1);
-                SSWAP(sdiff);
-                value += sdiff;
-                input_ptr += 3;
-                break;
-
-           /*
-           * Is this a 32 bit value?
-           */
-           case (unsigned char) 0x80:
-                value = *(int *) (input_ptr + 1);
-                LSWAP(value);
-                input_ptr += 5;
-                break;
-
-           /*
-           * No, it's a 8 bit diff, so add it to the current value
-           */
-           default:
-                value += *(signed char *) input_ptr;
-                input_ptr++;
-                break;
-           }
-           /*
-           * Store the current value and bump the output pointer, etc.
-           */
-           *output_ptr = value;
-           output_ptr++;
-           channels_left -= 1;
-        }
-
-        return OK;
-}
 
 /******************************************************************************
 * NMC_SHOW_MODULES
@@ -0,0 +1,206 @@
+/* File:    SIS3801FifoBench.cpp
+ *
+ * Purpose:
+ * Standalone benchmark for reading the SIS3801 FIFO.
+ * It replays a FIFO trace through a model of the SIS3801 FIFO and its status flags,
+ * and compares the number of VME cycles (status and FIFO register reads) for the loop
+ * previously used in drvSIS3801::readFIFOThread, which checks the empty flag before each word,
+ * with the block reads based on the half full and almost empty flags.
+ *
+ * The trace is a series of drains.  Before each drain a random number of words (up to a full FIFO)
+ * are added to the FIFO, and during the drain one word arrives for every fillRatio words read,
+ * as when the board is counting while the FIFO is read.
+ *
+ * Usage: SIS3801FifoBench [drains] [fillRatio] [cycleTime (us)]
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "drvSIS3801.h"
+
+#define BUFFER_WORDS SIS3801_FIFO_BUFFER_WORDS
+
+/* Model of the FIFO.  The trace data are written to the FIFO in order, so the words read
+ * must be the same as the trace. */
+typedef struct {
+  const epicsUInt32 *trace;
+  int traceWords;
+  int head;         /* Next word to read */
+  int tail;         /* Next word to write */
+  int fillRatio;    /* A word is written for every fillRatio words read, 0 for none */
+  int sinceFill;
+  double csrReads;
+  double fifoReads;
+  bool underflow;
+} fifoModel;
+
+static void fifoFill(fifoModel *pFifo, int nWords)
+{
+  if (nWords > SIS3801_FIFO_WORDS - (pFifo->tail - pFifo->head))
+    nWords = SIS3801_FIFO_WORDS - (pFifo->tail - pFifo->head);
+  if (nWords > pFifo->traceWords - pFifo->tail)
+    nWords = pFifo->traceWords - pFifo->tail;
+  pFifo->tail += nWords;
+}
+
+static epicsUInt32 readCSR(fifoModel *pFifo)
+{
+  int count = pFifo->tail - pFifo->head;
+  epicsUInt32 status = 0;
+
+  pFifo->csrReads++;
+  if (count == 0) status |= STATUS_M_FIFO_FLAG_EMPTY;
+  if (count < SIS3801_FIFO_ALMOST_EMPTY_WORDS) status |= STATUS_M_FIFO_FLAG_ALMOST_EMPTY;
+  if (count >= SIS3801_FIFO_HALF_FULL_WORDS) status |= STATUS_M_FIFO_FLAG_HALF_FULL;
+  return status;
+}
+
+static epicsUInt32 readFIFO(fifoModel *pFifo)
+{
+  pFifo->fifoReads++;
+  if (pFifo->head >= pFifo->tail) {
+    pFifo->underflow = true;
+    return 0;
+  }
+  if (pFifo->fillRatio && (++pFifo->sinceFill >= pFifo->fillRatio)) {
+    pFifo->sinceFill = 0;
+    fifoFill(pFifo, 1);
+  }
+  return pFifo->trace[pFifo->head++];
+}
+
+/* The loop that was used in drvSIS3801::readFIFOThread before the block reads */
+static int drainReference(fifoModel *pFifo, epicsUInt32 *pOut)
+{
+  int count = 0;
+  int nWords;
+
+  while (!(readCSR(pFifo) & STATUS_M_FIFO_FLAG_EMPTY)) {
+    nWords = 0;
+    while (!(readCSR(pFifo) & STATUS_M_FIFO_FLAG_EMPTY) && (nWords < BUFFER_WORDS)) {
+      pOut[count + nWords++] = readFIFO(pFifo);
+    }
+    count += nWords;
+  }
+  return count;
+}
+
+/* The block reads now used in drvSIS3801::readFIFOThread */
+static int drainBlock(fifoModel *pFifo, epicsUInt32 *pOut)
+{
+  int count = 0;
+  int nWords, safeWords, i;
+
+  while (true) {
+    nWords = 0;
+    while (nWords < BUFFER_WORDS) {
+      safeWords = SIS3801FifoSafeWords(readCSR(pFifo), SIS3801_FIFO_WORDS, SIS3801_FIFO_ALMOST_EMPTY_WORDS);
+      if (safeWords == 0) break;
+      if (safeWords > BUFFER_WORDS - nWords) safeWords = BUFFER_WORDS - nWords;
+      for (i=0; i<safeWords; i++) pOut[count + nWords + i] = readFIFO(pFifo);
+      nWords += safeWords;
+    }
+    if (nWords == 0) break;
+    count += nWords;
+  }
+  return count;
+}
+
+static void runTrace(bool reference, fifoModel *pFifo, epicsUInt32 *pOut, int drains, double *pSeconds)
+{
+  int i;
+  int count = 0;
+  epicsTimeStamp t1, t2;
+
+  pFifo->head = 0;
+  pFifo->tail = 0;
+  pFifo->sinceFill = 0;
+  pFifo->csrReads = 0;
+  pFifo->fifoReads = 0;
+  pFifo->underflow = false;
+  srand(2);
+  epicsTimeGetCurrent(&t1);
+  for (i=0; i<drains; i++) {
+    fifoFill(pFifo, rand() % (SIS3801_FIFO_WORDS + 1));
+    if (reference)
+      count += drainReference(pFifo, pOut + count);
+    else
+      count += drainBlock(pFifo, pOut + count);
+  }
+  epicsTimeGetCurrent(&t2);
+  *pSeconds = epicsTimeDiffInSeconds(&t2, &t1);
+}
+
+int main(int argc, char *argv[])
+{
+  int drains    = 1000;
+  int fillRatio = 4;
+  double cycleTime = 1.0;
+  int i;
+  int traceWords;
+  size_t nBytes;
+  epicsUInt32 *trace, *outReference, *outBlock;
+  fifoModel fifo;
+  double tReference, tBlock;
+  double csrReference, fifoReference;
+
+  if (argc > 1) drains    = atoi(argv[1]);
+  if (argc > 2) fillRatio = atoi(argv[2]);
+  if (argc > 3) cycleTime = atof(argv[3]);
+  if ((drains < 1) || (fillRatio < 0) || (cycleTime <= 0)) {
+    printf("Usage: %s [drains] [fillRatio (0=no fill while reading)] [cycleTime (us)]\n", argv[0]);
+    return 1;
+  }
+
+  /* Enough trace for a full FIFO on each drain plus the words written while reading */
+  traceWords = drains*SIS3801_FIFO_WORDS;
+  if (fillRatio) traceWords += traceWords/fillRatio + 1;
+  nBytes = (size_t)traceWords*sizeof(epicsUInt32);
+  trace        = (epicsUInt32 *)malloc(nBytes);
+  outReference = (epicsUInt32 *)calloc(1, nBytes);
+  outBlock     = (epicsUInt32 *)calloc(1, nBytes);
+  if (!trace || !outReference || !outBlock) {
+    printf("Error allocating %lu bytes\n", (unsigned long)nBytes);
+    return 1;
+  }
+  for (i=0; i<traceWords; i++) trace[i] = (epicsUInt32)i;
+  memset(&fifo, 0, sizeof(fifo));
+  fifo.trace = trace;
+  fifo.traceWords = traceWords;
+  fifo.fillRatio = fillRatio;
+
+  runTrace(true, &fifo, outReference, drains, &tReference);
+  csrReference = fifo.csrReads;
+  fifoReference = fifo.fifoReads;
+  runTrace(false, &fifo, outBlock, drains, &tBlock);
+
+  if (fifo.underflow) {
+    printf("ERROR: block reads read past the end of the FIFO\n");
+    return 1;
+  }
+  if ((fifo.fifoReads != fifoReference) || (memcmp(outReference, outBlock, nBytes) != 0)) {
+    printf("ERROR: block read output differs from reference\n");
+    return 1;
+  }
+
+  printf("drains=%d, fillRatio=%d, words=%.0f, VME cycle time=%.2f us\n",
+         drains, fillRatio, fifoReference, cycleTime);
+  printf("  word at a time: %12.0f status reads, %6.3f cycles/word, %8.3f s VME, %8.4f s model\n",
+         csrReference, (csrReference + fifoReference)/fifoReference,
+         (csrReference + fifoReference)*cycleTime*1e-6, tReference);
+  printf("  block:          %12.0f status reads, %6.3f cycles/word, %8.3f s VME, %8.4f s model\n",
+         fifo.csrReads, (fifo.csrReads + fifo.fifoReads)/fifo.fifoReads,
+         (fifo.csrReads + fifo.fifoReads)*cycleTime*1e-6, tBlock);
+  printf("  speedup:        %8.2f\n", (csrReference + fifoReference)/(fifo.csrReads + fifo.fifoReads));
+
+  free(trace);
+  free(outReference);
+  free(outBlock);
+  return 0;
+}
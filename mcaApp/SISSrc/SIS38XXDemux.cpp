@@ -0,0 +1,235 @@
+/* File:    SIS38XXDemux.cpp
+ *
+ * Purpose:
+ * FIFO demultiplexing kernel for the SIS3820 and SIS3801 multichannel scalers.
+ *
+ * The previous code in readFIFOThread wrote each FIFO word to
+ * mcsData_ + signal*maxChans_ + chan, so consecutive words went to different rows
+ * and every word touched a different cache line.  Here whole channels are transposed
+ * in blocks of SIS38XX_DEMUX_BLOCK_CHANS, so the reads are sequential and each output
+ * row gets a contiguous run of words.  On hosts with SSE2 the block is transposed in
+ * 4x4 tiles.
+ *
+ */
+
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SIS38XXDemux.h"
+
+/* Transpose nChans whole channels starting at pIn into pOut, which points to
+ * signal 0, channel chan of the output array */
+static void demuxBlock(epicsUInt32 *pOut, int maxChans, int maxSignals,
+                       const epicsUInt32 *pIn, int nChans)
+{
+  int signal, chan;
+  int c0 = 0;
+
+#if defined(__SSE2__)
+  if ((maxSignals % 4) == 0) {
+    for (c0=0; c0+4<=nChans; c0+=4) {
+      const epicsUInt32 *pIn0 = pIn + c0*maxSignals;
+      for (signal=0; signal<maxSignals; signal+=4) {
+        __m128i r0 = _mm_loadu_si128((const __m128i *)(pIn0 + signal));
+        __m128i r1 = _mm_loadu_si128((const __m128i *)(pIn0 + maxSignals + signal));
+        __m128i r2 = _mm_loadu_si128((const __m128i *)(pIn0 + 2*maxSignals + signal));
+        __m128i r3 = _mm_loadu_si128((const __m128i *)(pIn0 + 3*maxSignals + signal));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        epicsUInt32 *pOut0 = pOut + signal*maxChans + c0;
+        _mm_storeu_si128((__m128i *)(pOut0),              _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(pOut0 + maxChans),   _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(pOut0 + 2*maxChans), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *)(pOut0 + 3*maxChans), _mm_unpackhi_epi64(t2, t3));
+      }
+    }
+  }
+#endif
+
+  if (c0 == nChans) return;
+  for (signal=0; signal<maxSignals; signal++) {
+    epicsUInt32 *pDest = pOut + signal*maxChans;
+    const epicsUInt32 *pSrc = pIn + signal;
+    for (chan=c0; chan<nChans; chan++) {
+      pDest[chan] = pSrc[chan*maxSignals];
+    }
+  }
+}
+
+int SIS38XXDemux(epicsUInt32 *pOut, int maxChans, int maxSignals,
+                 const epicsUInt32 *pIn, int count, int *pSignal, int *pChan)
+{
+  int signal = *pSignal;
+  int chan = *pChan;
+  int i = 0;
+  int nWhole, n;
+
+  /* Finish a partial channel left over from the previous buffer */
+  while ((signal != 0) && (i < count) && (chan < maxChans)) {
+    pOut[signal*maxChans + chan] = pIn[i++];
+    signal++;
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  /* Whole channels, a block at a time */
+  nWhole = (count - i) / maxSignals;
+  if (nWhole > maxChans - chan) nWhole = maxChans - chan;
+  while (nWhole > 0) {
+    n = nWhole;
+    if (n > SIS38XX_DEMUX_BLOCK_CHANS) n = SIS38XX_DEMUX_BLOCK_CHANS;
+    demuxBlock(pOut + chan, maxChans, maxSignals, pIn + i, n);
+    i += n*maxSignals;
+    chan += n;
+    nWhole -= n;
+  }
+
+  /* Start of a partial channel at the end of the buffer */
+  while ((i < count) && (chan < maxChans)) {
+    pOut[signal*maxChans + chan] = pIn[i++];
+    signal++;
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  *pSignal = signal;
+  *pChan = chan;
+  return i;
+}
+
+int SIS38XXDemuxBinned(epicsUInt32 *pOut, int maxChans, int maxSignals, int binFactor,
+                       const epicsUInt32 *pIn, int count, int *pSignal, int *pChan)
+{
+  int signal = *pSignal;
+  int chan = *pChan;
+  int maxRawChans = maxChans*binFactor;
+  int i = 0;
+  epicsUInt32 *pDest;
+
+  if (binFactor <= 1) return SIS38XXDemux(pOut, maxChans, maxSignals, pIn, count, pSignal, pChan);
+
+  /* One channel at a time, all of the channels of a bin go to the same column of pOut,
+   * so the output cache lines are reused binFactor times */
+  while ((i < count) && (chan < maxRawChans)) {
+    pDest = pOut + chan/binFactor;
+    if ((chan % binFactor) == 0) {
+      for (; (signal < maxSignals) && (i < count); signal++) pDest[signal*maxChans] = pIn[i++];
+    } else {
+      for (; (signal < maxSignals) && (i < count); signal++) pDest[signal*maxChans] += pIn[i++];
+    }
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  *pSignal = signal;
+  *pChan = chan;
+  return i;
+}
+
+/* Add count FIFO words to the binned sums, see SIS38XXAccumulate */
+static int accumulateBinned(epicsUInt64 *pSums, int maxChans, int maxSignals, int binFactor,
+                            const epicsUInt32 *pIn, int count, int *pSignal, int *pChan, int first)
+{
+  int signal = *pSignal;
+  int chan = *pChan;
+  int maxRawChans = maxChans*binFactor;
+  int i = 0;
+  epicsUInt64 *pDest;
+
+  while ((i < count) && (chan < maxRawChans)) {
+    pDest = pSums + chan/binFactor;
+    if (first && ((chan % binFactor) == 0)) {
+      for (; (signal < maxSignals) && (i < count); signal++) pDest[signal*maxChans] = pIn[i++];
+    } else {
+      for (; (signal < maxSignals) && (i < count); signal++) pDest[signal*maxChans] += pIn[i++];
+    }
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  *pSignal = signal;
+  *pChan = chan;
+  return i;
+}
+
+/* Add nChans whole channels starting at pIn to pSums, which points to
+ * signal 0, channel chan of the sums array */
+static void accumulateBlock(epicsUInt64 *pSums, int maxChans, int maxSignals,
+                            const epicsUInt32 *pIn, int nChans, int first)
+{
+  int signal, chan;
+
+  for (signal=0; signal<maxSignals; signal++) {
+    epicsUInt64 *pDest = pSums + signal*maxChans;
+    const epicsUInt32 *pSrc = pIn + signal;
+    if (first) {
+      for (chan=0; chan<nChans; chan++) pDest[chan] = pSrc[chan*maxSignals];
+    } else {
+      for (chan=0; chan<nChans; chan++) pDest[chan] += pSrc[chan*maxSignals];
+    }
+  }
+}
+
+int SIS38XXAccumulate(epicsUInt64 *pSums, int maxChans, int maxSignals, int binFactor,
+                      const epicsUInt32 *pIn, int count, int *pSignal, int *pChan, int first)
+{
+  int signal = *pSignal;
+  int chan = *pChan;
+  int i = 0;
+  int nWhole, n;
+  epicsUInt64 *pDest;
+
+  if (binFactor > 1)
+    return accumulateBinned(pSums, maxChans, maxSignals, binFactor, pIn, count, pSignal, pChan, first);
+
+  /* Finish a partial channel left over from the previous buffer */
+  while ((signal != 0) && (i < count) && (chan < maxChans)) {
+    pDest = pSums + signal*maxChans + chan;
+    if (first) *pDest = pIn[i++]; else *pDest += pIn[i++];
+    signal++;
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  /* Whole channels, a block at a time */
+  nWhole = (count - i) / maxSignals;
+  if (nWhole > maxChans - chan) nWhole = maxChans - chan;
+  while (nWhole > 0) {
+    n = nWhole;
+    if (n > SIS38XX_DEMUX_BLOCK_CHANS) n = SIS38XX_DEMUX_BLOCK_CHANS;
+    accumulateBlock(pSums + chan, maxChans, maxSignals, pIn + i, n, first);
+    i += n*maxSignals;
+    chan += n;
+    nWhole -= n;
+  }
+
+  /* Start of a partial channel at the end of the buffer */
+  while ((i < count) && (chan < maxChans)) {
+    pDest = pSums + signal*maxChans + chan;
+    if (first) *pDest = pIn[i++]; else *pDest += pIn[i++];
+    signal++;
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+    }
+  }
+
+  *pSignal = signal;
+  *pChan = chan;
+  return i;
+}
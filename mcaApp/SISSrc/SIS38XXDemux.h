@@ -0,0 +1,56 @@
+/* File:    SIS38XXDemux.h
+ *
+ * Purpose:
+ * FIFO demultiplexing kernel for the SIS3820 and SIS3801 multichannel scalers.
+ * The FIFO delivers data channel-major (all signals for channel 0, then all signals
+ * for channel 1, ...).  The driver stores data signal-major (all channels for signal 0,
+ * then all channels for signal 1, ...).  This module does that transpose in cache-sized
+ * blocks of channels, rather than one word at a time.
+ *
+ * This file does not depend on asyn, so it can be built into standalone test programs.
+ *
+ */
+
+#ifndef SIS38XX_DEMUX_H
+#define SIS38XX_DEMUX_H
+
+#include <epicsTypes.h>
+
+/* Number of channels transposed at once.  With 32 signals this is 2 KB of FIFO data,
+ * and each output row receives a full 64 byte cache line. */
+#define SIS38XX_DEMUX_BLOCK_CHANS 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Copy count FIFO words from pIn to the signal-major array pOut.
+  * pOut is maxSignals rows of maxChans words.
+  * *pSignal and *pChan are the signal and channel of the first word in pIn, and are
+  * updated to the position of the next word on return.  They need not be at a channel
+  * boundary, a partial channel at the start or end of the buffer is handled.
+  * Words that would be written beyond maxChans are not copied.
+  * Returns the number of words copied. */
+int SIS38XXDemux(epicsUInt32 *pOut, int maxChans, int maxSignals,
+                 const epicsUInt32 *pIn, int count, int *pSignal, int *pChan);
+
+/** Same as SIS38XXDemux, but binFactor adjacent channels are summed into each channel of pOut.
+  * *pChan is the channel number before binning, channel chan is added to channel chan/binFactor
+  * of pOut.  The first channel of each bin is stored rather than added, so pOut does not need
+  * to be cleared.  Words that would be written beyond maxChans binned channels are not copied.
+  * Returns the number of words copied. */
+int SIS38XXDemuxBinned(epicsUInt32 *pOut, int maxChans, int maxSignals, int binFactor,
+                       const epicsUInt32 *pIn, int count, int *pSignal, int *pChan);
+
+/** Add count FIFO words from pIn to the signal-major array of 64-bit sums pSums.
+  * The arguments are the same as SIS38XXDemuxBinned, use binFactor=1 for no binning.
+  * If first is non-zero the first channel of each bin is stored rather than added, so the sums
+  * do not need to be cleared before the first sweep.
+  * Returns the number of words added. */
+int SIS38XXAccumulate(epicsUInt64 *pSums, int maxChans, int maxSignals, int binFactor,
+                      const epicsUInt32 *pIn, int count, int *pSignal, int *pChan, int first);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
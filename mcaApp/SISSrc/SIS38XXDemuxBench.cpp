@@ -0,0 +1,123 @@
+/* File:    SIS38XXDemuxBench.cpp
+ *
+ * Purpose:
+ * Standalone benchmark for the SIS38XX FIFO demultiplexing kernel.
+ * It builds a synthetic FIFO stream, splits it into buffers whose sizes are not
+ * multiples of the number of signals (as happens when reading a partially filled FIFO),
+ * and compares SIS38XXDemux() with the word-at-a-time loop previously used in readFIFOThread.
+ *
+ * Usage: SIS38XXDemuxBench [maxSignals] [maxChans] [bufferWords] [repeat]
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "SIS38XXDemux.h"
+
+/* The loop that was used in drvSIS3820::readFIFOThread before SIS38XXDemux */
+static void demuxReference(epicsUInt32 *mcsData, int maxChans, int maxSignals,
+                           const epicsUInt32 *pIn, int count, int *pSignal, int *pChan)
+{
+  int i;
+  int signal = *pSignal;
+  int chan = *pChan;
+  epicsUInt32 *pOut = mcsData + signal*maxChans + chan;
+
+  for (i=0; i<count; i++) {
+    *pOut = *pIn++;
+    signal++;
+    if (signal == maxSignals) {
+      signal = 0;
+      chan++;
+      pOut = mcsData + chan;
+    } else {
+      pOut += maxChans;
+    }
+  }
+  *pSignal = signal;
+  *pChan = chan;
+}
+
+static double runDemux(bool reference, epicsUInt32 *mcsData, int maxChans, int maxSignals,
+                       const epicsUInt32 *fifo, int bufferWords, int repeat)
+{
+  int totalWords = maxChans*maxSignals;
+  int i, start, count, signal, chan;
+  epicsTimeStamp t1, t2;
+
+  epicsTimeGetCurrent(&t1);
+  for (i=0; i<repeat; i++) {
+    signal = 0;
+    chan = 0;
+    start = 0;
+    while (start < totalWords) {
+      /* Vary the buffer size so that buffers start and end part way through a channel */
+      count = bufferWords - (start % 7);
+      if (count > totalWords - start) count = totalWords - start;
+      if (reference)
+        demuxReference(mcsData, maxChans, maxSignals, fifo + start, count, &signal, &chan);
+      else
+        SIS38XXDemux(mcsData, maxChans, maxSignals, fifo + start, count, &signal, &chan);
+      start += count;
+    }
+  }
+  epicsTimeGetCurrent(&t2);
+  return epicsTimeDiffInSeconds(&t2, &t1);
+}
+
+int main(int argc, char *argv[])
+{
+  int maxSignals  = 32;
+  int maxChans    = 100000;
+  int bufferWords = 4096;
+  int repeat      = 20;
+  int i;
+  size_t nBytes;
+  epicsUInt32 *fifo, *outReference, *outBlocked;
+  double tReference, tBlocked, mWords;
+
+  if (argc > 1) maxSignals  = atoi(argv[1]);
+  if (argc > 2) maxChans    = atoi(argv[2]);
+  if (argc > 3) bufferWords = atoi(argv[3]);
+  if (argc > 4) repeat      = atoi(argv[4]);
+  if ((maxSignals < 1) || (maxSignals > 32) || (maxChans < 1) || (bufferWords < 8) || (repeat < 1)) {
+    printf("Usage: %s [maxSignals (1-32)] [maxChans] [bufferWords (>=8)] [repeat]\n", argv[0]);
+    return 1;
+  }
+
+  nBytes = (size_t)maxSignals*maxChans*sizeof(epicsUInt32);
+  fifo         = (epicsUInt32 *)malloc(nBytes);
+  outReference = (epicsUInt32 *)calloc(1, nBytes);
+  outBlocked   = (epicsUInt32 *)calloc(1, nBytes);
+  if (!fifo || !outReference || !outBlocked) {
+    printf("Error allocating %lu bytes\n", (unsigned long)nBytes);
+    return 1;
+  }
+  srand(1);
+  for (i=0; i<maxSignals*maxChans; i++) fifo[i] = (epicsUInt32)rand();
+
+  tReference = runDemux(true,  outReference, maxChans, maxSignals, fifo, bufferWords, repeat);
+  tBlocked   = runDemux(false, outBlocked,   maxChans, maxSignals, fifo, bufferWords, repeat);
+
+  if (memcmp(outReference, outBlocked, nBytes) != 0) {
+    printf("ERROR: SIS38XXDemux output differs from reference\n");
+    return 1;
+  }
+
+  mWords = (double)maxSignals*maxChans*repeat/1.e6;
+  printf("maxSignals=%d, maxChans=%d, bufferWords=%d, repeat=%d\n",
+         maxSignals, maxChans, bufferWords, repeat);
+  printf("  word at a time: %8.4f s, %8.1f Mwords/s\n", tReference, mWords/tReference);
+  printf("  blocked:        %8.4f s, %8.1f Mwords/s\n", tBlocked,   mWords/tBlocked);
+  printf("  speedup:        %8.2f\n", tReference/tBlocked);
+
+  free(fifo);
+  free(outReference);
+  free(outBlocked);
+  return 0;
+}
@@ -0,0 +1,245 @@
+/* File:    SIS38XXSim.cpp
+ *
+ * Purpose:
+ * Software simulation of the SIS3820 and SIS3801 multichannel scalers.
+ * See SIS38XXSim.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <cantProceed.h>
+
+#include "SIS38XXSim.h"
+
+static void simThreadC(void *pvt)
+{
+  SIS38XXSim *pSim = (SIS38XXSim *)pvt;
+  pSim->simThread();
+}
+
+SIS38XXSim::SIS38XXSim(const char *name, int maxSignals, double countRate, size_t registerBytes,
+                       int fifoWords, SIS38XXSimIntFunc intFunc, void *intPvt)
+  : counting_(false), acqDone_(false), fifoWords_(fifoWords), maxSignals_(maxSignals),
+    chans_(0), countRate_(countRate), lneToFIFO_(false), lnePeriod_(0.), lneElapsed_(0.),
+    presetChans_(0), wordIndex_(0), fifoHead_(0), fifoTail_(0), fifoNum_(0),
+    intFunc_(intFunc), intPvt_(intPvt),
+    wordsWritten_(0.), wordsRead_(0.), wordsLost_(0.), interrupts_(0)
+{
+  strncpy(name_, name, sizeof(name_)-1);
+  name_[sizeof(name_)-1] = 0;
+  if (maxSignals_ > 32) maxSignals_ = 32;
+  memset(counters_, 0, sizeof(counters_));
+  memset(lastCounters_, 0, sizeof(lastCounters_));
+  registers_ = callocMustSucceed(1, registerBytes, "SIS38XXSim::SIS38XXSim");
+  fifo_ = (epicsUInt32 *)callocMustSucceed(fifoWords_, sizeof(epicsUInt32), "SIS38XXSim::SIS38XXSim");
+  lock_ = epicsMutexCreate();
+  epicsTimeGetCurrent(&lastTime_);
+}
+
+SIS38XXSim::~SIS38XXSim()
+{
+  free(fifo_);
+  free(registers_);
+}
+
+/** Start the thread that emulates the board */
+void SIS38XXSim::start()
+{
+  epicsThreadCreate(name_, epicsThreadPriorityHigh,
+                    epicsThreadGetStackSize(epicsThreadStackMedium),
+                    (EPICSTHREADFUNC)simThreadC, this);
+}
+
+/** The register file that the driver uses in place of the VME registers */
+volatile void *SIS38XXSim::registers()
+{
+  return registers_;
+}
+
+/** Read the register pReg.  The simulator thread updates the status registers, so this takes the lock. */
+epicsUInt32 SIS38XXSim::readRegister(volatile epicsUInt32 *pReg)
+{
+  epicsUInt32 value;
+
+  epicsMutexLock(lock_);
+  value = *pReg;
+  epicsMutexUnlock(lock_);
+  return value;
+}
+
+/** Write value to the register pReg in the register file, and act on it as the board would */
+void SIS38XXSim::writeRegister(volatile epicsUInt32 *pReg, epicsUInt32 value)
+{
+  epicsMutexLock(lock_);
+  *pReg = value;
+  registerWritten(pReg, value);
+  updateRegisters();
+  epicsMutexUnlock(lock_);
+}
+
+/** Read up to maxWords from the FIFO.  Returns the number of words read. */
+int SIS38XXSim::readFIFO(epicsUInt32 *pOut, int maxWords)
+{
+  int n, n1;
+
+  epicsMutexLock(lock_);
+  n = fifoNum_;
+  if (n > maxWords) n = maxWords;
+  n1 = fifoWords_ - fifoTail_;
+  if (n1 > n) n1 = n;
+  memcpy(pOut, fifo_ + fifoTail_, n1*sizeof(epicsUInt32));
+  memcpy(pOut + n1, fifo_, (n - n1)*sizeof(epicsUInt32));
+  fifoTail_ = (fifoTail_ + n) % fifoWords_;
+  fifoNum_ -= n;
+  wordsRead_ += n;
+  updateRegisters();
+  epicsMutexUnlock(lock_);
+  return n;
+}
+
+int SIS38XXSim::fifoCount()
+{
+  int n;
+
+  epicsMutexLock(lock_);
+  n = fifoNum_;
+  epicsMutexUnlock(lock_);
+  return n;
+}
+
+void SIS38XXSim::report(FILE *fp, int details)
+{
+  epicsMutexLock(lock_);
+  fprintf(fp, "  Simulator:\n");
+  fprintf(fp, "    count rate       = %f\n", countRate_);
+  fprintf(fp, "    counting         = %d\n", counting_);
+  fprintf(fp, "    LNE period       = %g\n", lnePeriod_);
+  fprintf(fp, "    preset channels  = %d\n", presetChans_);
+  fprintf(fp, "    channels         = %d\n", chans_);
+  fprintf(fp, "    FIFO words       = %d/%d\n", fifoNum_, fifoWords_);
+  fprintf(fp, "    words written    = %.0f\n", wordsWritten_);
+  fprintf(fp, "    words read       = %.0f\n", wordsRead_);
+  fprintf(fp, "    words lost       = %.0f\n", wordsLost_);
+  fprintf(fp, "    interrupts       = %d\n", interrupts_);
+  epicsMutexUnlock(lock_);
+}
+
+void SIS38XXSim::simThread()
+{
+  epicsTimeStamp now;
+  double seconds;
+  bool pending;
+
+  while (1) {
+    epicsThreadSleep(SIS38XX_SIM_TICK);
+    epicsMutexLock(lock_);
+    epicsTimeGetCurrent(&now);
+    seconds = epicsTimeDiffInSeconds(&now, &lastTime_);
+    lastTime_ = now;
+    // Don't try to catch up after the thread was not run for a long time
+    if (seconds > 0.1) seconds = 0.1;
+    count(seconds);
+    updateRegisters();
+    pending = interruptPending();
+    if (pending) interrupts_++;
+    epicsMutexUnlock(lock_);
+    // Call the interrupt function without the lock, it writes to the registers
+    if (pending) intFunc_(intPvt_);
+  }
+}
+
+/** Start counting.  If lneToFIFO is true each channel advance writes the counts to the FIFO.
+  * lnePeriod is the time between channel advances, 0 if there are only software channel advances.
+  * If presetChans is not 0 counting stops after that many channel advances. */
+void SIS38XXSim::startCounting(bool lneToFIFO, double lnePeriod, int presetChans)
+{
+  counting_ = true;
+  acqDone_ = false;
+  lneToFIFO_ = lneToFIFO;
+  lnePeriod_ = lnePeriod;
+  lneElapsed_ = 0.;
+  presetChans_ = presetChans;
+  chans_ = 0;
+}
+
+void SIS38XXSim::stopCounting()
+{
+  counting_ = false;
+}
+
+void SIS38XXSim::clearFIFO()
+{
+  fifoHead_ = 0;
+  fifoTail_ = 0;
+  fifoNum_ = 0;
+}
+
+void SIS38XXSim::clearCounters()
+{
+  memset(counters_, 0, sizeof(counters_));
+  memset(lastCounters_, 0, sizeof(lastCounters_));
+  wordIndex_ = 0;
+}
+
+/** Latch the counts since the last channel advance into the FIFO */
+void SIS38XXSim::channelAdvance()
+{
+  int signal;
+
+  if (!counting_) return;
+  if (lneToFIFO_) {
+    for (signal=0; signal<maxSignals_; signal++) {
+      if (countRate_ == 0.) {
+        pushFIFO(wordIndex_++);
+      } else {
+        pushFIFO((epicsUInt32)(floor(counters_[signal]) - floor(lastCounters_[signal])));
+        lastCounters_[signal] = counters_[signal];
+      }
+    }
+  }
+  chans_++;
+  if ((presetChans_ > 0) && (chans_ >= presetChans_)) {
+    counting_ = false;
+    acqDone_ = true;
+  }
+}
+
+/* Count for the specified time, doing the channel advances that occur in that time */
+void SIS38XXSim::count(double seconds)
+{
+  int signal;
+  double dt;
+
+  while (counting_ && (seconds > 0.)) {
+    dt = seconds;
+    if ((lnePeriod_ > 0.) && (lneElapsed_ + dt >= lnePeriod_)) dt = lnePeriod_ - lneElapsed_;
+    for (signal=0; signal<maxSignals_; signal++) {
+      counters_[signal] += countRate_*(signal+1)*dt;
+    }
+    seconds -= dt;
+    lneElapsed_ += dt;
+    if ((lnePeriod_ > 0.) && (lneElapsed_ >= lnePeriod_)) {
+      lneElapsed_ = 0.;
+      channelAdvance();
+    }
+  }
+}
+
+void SIS38XXSim::pushFIFO(epicsUInt32 value)
+{
+  if (fifoNum_ == fifoWords_) {
+    wordsLost_++;
+    return;
+  }
+  fifo_[fifoHead_] = value;
+  fifoHead_ = (fifoHead_ + 1) % fifoWords_;
+  fifoNum_++;
+  wordsWritten_++;
+}
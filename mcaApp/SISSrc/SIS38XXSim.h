@@ -0,0 +1,101 @@
+/* File:    SIS38XXSim.h
+ *
+ * Purpose:
+ * Software simulation of the SIS3820 and SIS3801 multichannel scalers, so that the
+ * drivers can run on a host without a VME crate.
+ *
+ * The simulator provides an in-memory register file that the driver uses in place
+ * of the VME registers, and a thread that emulates the board.  The driver accesses the
+ * registers with readRegister() and writeRegister().  writeRegister() acts on each write
+ * (reset, enable, disable, channel advance, ...) with the simulator lock held, so writes
+ * of the same value are not lost.  The thread counts the input signals, generates a
+ * channel advance (LNE) from the prescaler, writes the counts to a FIFO, stops at the
+ * preset number of channels, and calls the driver's interrupt function.  The model
+ * specific register handling is done in the derived classes in drvSIS3820.cpp and
+ * drvSIS3801.cpp.
+ *
+ * If countRate is 0 each FIFO word is its index since the counters were cleared, i.e.
+ * word number channel*maxSignals + signal.  This is intended for checking the FIFO
+ * and demultiplexing code.  If countRate is > 0 then signal N counts at
+ * (N+1)*countRate Hz.
+ *
+ */
+
+#ifndef SIS38XX_SIM_H
+#define SIS38XX_SIM_H
+
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+/* Period of the simulator thread */
+#define SIS38XX_SIM_TICK 0.001
+
+/* The internal clock that the prescaler divides to generate channel advance.
+ * The simulator also uses this for the external channel advance source. */
+#define SIS38XX_SIM_LNE_CLOCK 10000000
+
+typedef void (*SIS38XXSimIntFunc)(void *pvt);
+
+class SIS38XXSim
+{
+  public:
+  SIS38XXSim(const char *name, int maxSignals, double countRate, size_t registerBytes,
+             int fifoWords, SIS38XXSimIntFunc intFunc, void *intPvt);
+  virtual ~SIS38XXSim();
+  void start();
+  volatile void *registers();
+  epicsUInt32 readRegister(volatile epicsUInt32 *pReg);
+  void writeRegister(volatile epicsUInt32 *pReg, epicsUInt32 value);
+  int readFIFO(epicsUInt32 *pOut, int maxWords);
+  int fifoCount();
+  void report(FILE *fp, int details);
+  void simThread();  // Should be private, but called from C callback function
+
+  protected:
+  // These are called with the simulator lock held
+  virtual void registerWritten(volatile epicsUInt32 *pReg, epicsUInt32 value) = 0;  // Act on a write by the driver
+  virtual void updateRegisters() = 0;    // Update the registers that the driver reads
+  virtual bool interruptPending() = 0;   // True if the board would assert its interrupt
+  void startCounting(bool lneToFIFO, double lnePeriod, int presetChans);
+  void stopCounting();
+  void channelAdvance();
+  void clearFIFO();
+  void clearCounters();
+  bool counting_;
+  bool acqDone_;          // Set when presetChans_ channels have been acquired
+  double counters_[32];   // Counts since the counters were cleared
+  int fifoWords_;         // Size of the FIFO
+  int maxSignals_;
+  int chans_;             // Channels since counting started
+
+  private:
+  void count(double seconds);
+  void pushFIFO(epicsUInt32 value);
+  char name_[64];
+  double countRate_;
+  bool lneToFIFO_;        // Each channel advance writes the counts to the FIFO
+  double lnePeriod_;      // Seconds per channel advance, 0 if only software channel advance
+  double lneElapsed_;     // Time since the last channel advance
+  int presetChans_;       // 0 for no preset
+  double lastCounters_[32];
+  epicsUInt32 wordIndex_; // Used when countRate_ is 0
+  epicsUInt32 *fifo_;
+  int fifoHead_;
+  int fifoTail_;
+  int fifoNum_;
+  void *registers_;
+  SIS38XXSimIntFunc intFunc_;
+  void *intPvt_;
+  epicsMutexId lock_;
+  epicsTimeStamp lastTime_;
+  // Statistics
+  double wordsWritten_;
+  double wordsRead_;
+  double wordsLost_;
+  int interrupts_;
+};
+
+#endif
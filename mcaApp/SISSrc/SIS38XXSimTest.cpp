@@ -0,0 +1,247 @@
+/* File:    SIS38XXSimTest.cpp
+ *
+ * Purpose:
+ * Test of the SIS38XX board simulator, see SIS38XXSim.h.  It does not need VME or asyn.
+ * A small board with a few registers is derived from SIS38XXSim, in the same way as the
+ * SIS3820 and SIS3801 simulations in the drivers, and the simulator thread runs while
+ * the test writes the registers.
+ *
+ * - Repeated writes: two threads write the channel advance key register, always with the
+ *   same value, while the simulator thread runs.  Every write must be a channel advance.
+ * - Preset: the simulator counts with an internal channel advance and must stop at the
+ *   preset number of channels, raise the acquisition done flag and call the interrupt function.
+ * - Command/status register: writes to the status register clear the flags, reads return
+ *   the status.  Writing the same clear value again must clear the flag again.
+ *
+ * The FIFO words are checked with countRate 0, where each word is its index since the
+ * counters were cleared.
+ *
+ * Usage: SIS38XXSimTest [writes]
+ *
+ * Exits with status 1 if any check fails.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include "SIS38XXSim.h"
+
+#define TEST_SIGNALS      4
+#define TEST_FIFO_WORDS   0x100000
+#define TEST_PRESET_CHANS 500
+/* 100 microseconds per channel */
+#define TEST_PRESCALE     999
+
+#define STATUS_COUNTING   0x1
+#define STATUS_DONE       0x2
+
+typedef volatile struct {
+  epicsUInt32 key_start_reg;       /* Start counting, the channel advance is from prescale_reg if it is not 0 */
+  epicsUInt32 key_stop_reg;
+  epicsUInt32 key_lne_pulse_reg;   /* Software channel advance */
+  epicsUInt32 key_reset_reg;       /* Stop counting, clear the FIFO, the counters and the flags */
+  epicsUInt32 prescale_reg;
+  epicsUInt32 preset_reg;          /* Number of channels to acquire, 0 for no limit */
+  epicsUInt32 irq_enable_reg;
+  epicsUInt32 status_reg;          /* Write STATUS_DONE to clear the done flag, read returns the status */
+  epicsUInt32 fifo_count_reg;
+} TEST_REGS;
+
+class TestSim : public SIS38XXSim
+{
+  public:
+  TestSim(SIS38XXSimIntFunc intFunc, void *intPvt)
+    : SIS38XXSim("SIS38XXSimTest", TEST_SIGNALS, 0., sizeof(TEST_REGS), TEST_FIFO_WORDS, intFunc, intPvt),
+      done_(false)
+  {
+    regs_ = (TEST_REGS *)registers();
+  }
+  TEST_REGS *regs_;
+
+  protected:
+  void registerWritten(volatile epicsUInt32 *pReg, epicsUInt32 value)
+  {
+    if (pReg == &regs_->key_start_reg) {
+      double lnePeriod = 0.;
+      if (regs_->prescale_reg) lnePeriod = (regs_->prescale_reg + 1.) / SIS38XX_SIM_LNE_CLOCK;
+      startCounting(true, lnePeriod, regs_->preset_reg);
+    }
+    else if (pReg == &regs_->key_stop_reg) {
+      stopCounting();
+    }
+    else if (pReg == &regs_->key_lne_pulse_reg) {
+      channelAdvance();
+    }
+    else if (pReg == &regs_->key_reset_reg) {
+      stopCounting();
+      clearFIFO();
+      clearCounters();
+      done_ = false;
+    }
+    else if (pReg == &regs_->status_reg) {
+      if (value & STATUS_DONE) done_ = false;
+    }
+  }
+
+  void updateRegisters()
+  {
+    if (acqDone_) {
+      acqDone_ = false;
+      done_ = true;
+    }
+    regs_->status_reg = (counting_ ? STATUS_COUNTING : 0) | (done_ ? STATUS_DONE : 0);
+    regs_->fifo_count_reg = fifoCount();
+  }
+
+  bool interruptPending()
+  {
+    return regs_->irq_enable_reg && done_;
+  }
+
+  private:
+  bool done_;
+};
+
+static TestSim *pSim;
+static epicsEventId intEvent;
+static epicsEventId writerDone;
+static int interrupts;
+static int writes = 100000;
+static int failures;
+
+/* The simulator thread updates the status registers, so they are read with the simulator lock */
+static int readStatus()
+{
+  return pSim->readRegister(&pSim->regs_->status_reg);
+}
+
+static void check(bool ok, const char *message, int value, int expected)
+{
+  if (ok) return;
+  printf("FAIL: %s, got %d, expected %d\n", message, value, expected);
+  failures++;
+}
+
+/* Called from the simulator thread, as the driver's interrupt function is */
+static void intFunc(void *pvt)
+{
+  // Disable the interrupt, as the drivers do, so it is not called again until re-enabled
+  pSim->writeRegister(&pSim->regs_->irq_enable_reg, 0);
+  interrupts++;
+  epicsEventSignal(intEvent);
+}
+
+static void writerThread(void *pvt)
+{
+  int i;
+
+  for (i=0; i<writes; i++) pSim->writeRegister(&pSim->regs_->key_lne_pulse_reg, 1);
+  epicsEventSignal(writerDone);
+}
+
+/* Reads the whole FIFO and checks that the words are consecutive, starting at first.
+ * Returns the number of words. */
+static int readAndCheckFIFO(epicsUInt32 first, const char *test)
+{
+  static epicsUInt32 buffer[4096];
+  int n, i, total = 0;
+  epicsUInt32 expected = first;
+  bool ok = true;
+
+  while ((n = pSim->readFIFO(buffer, sizeof(buffer)/sizeof(buffer[0]))) > 0) {
+    for (i=0; i<n && ok; i++) {
+      if (buffer[i] != expected) {
+        printf("FAIL: %s, FIFO word %d is %u, expected %u\n", test, total + i, buffer[i], expected);
+        failures++;
+        ok = false;
+      }
+      expected++;
+    }
+    total += n;
+  }
+  return total;
+}
+
+static void testRepeatedWrites()
+{
+  int i, words;
+
+  pSim->writeRegister(&pSim->regs_->key_reset_reg, 1);
+  pSim->writeRegister(&pSim->regs_->prescale_reg, 0);
+  pSim->writeRegister(&pSim->regs_->preset_reg, 0);
+  pSim->writeRegister(&pSim->regs_->key_start_reg, 1);
+  epicsThreadCreate("SIS38XXSimTestWriter", epicsThreadPriorityMedium,
+                    epicsThreadGetStackSize(epicsThreadStackSmall), writerThread, NULL);
+  for (i=0; i<writes; i++) pSim->writeRegister(&pSim->regs_->key_lne_pulse_reg, 1);
+  epicsEventWait(writerDone);
+  pSim->writeRegister(&pSim->regs_->key_stop_reg, 1);
+  words = pSim->readRegister(&pSim->regs_->fifo_count_reg);
+  check(words == 2*writes*TEST_SIGNALS, "repeated writes, FIFO count register", words, 2*writes*TEST_SIGNALS);
+  words = readAndCheckFIFO(0, "repeated writes");
+  check(words == 2*writes*TEST_SIGNALS, "repeated writes, FIFO words", words, 2*writes*TEST_SIGNALS);
+  check(pSim->fifoCount() == 0, "repeated writes, FIFO count after reading", pSim->fifoCount(), 0);
+}
+
+static void testPreset()
+{
+  int words;
+  int status;
+
+  pSim->writeRegister(&pSim->regs_->key_reset_reg, 1);
+  pSim->writeRegister(&pSim->regs_->prescale_reg, TEST_PRESCALE);
+  pSim->writeRegister(&pSim->regs_->preset_reg, TEST_PRESET_CHANS);
+  pSim->writeRegister(&pSim->regs_->irq_enable_reg, 1);
+  pSim->writeRegister(&pSim->regs_->key_start_reg, 1);
+  check(readStatus() == STATUS_COUNTING, "preset, status after start", readStatus(), STATUS_COUNTING);
+  status = epicsEventWaitWithTimeout(intEvent, 10.);
+  check(status == epicsEventWaitOK, "preset, interrupt", status, epicsEventWaitOK);
+  check(interrupts == 1, "preset, interrupts", interrupts, 1);
+  check(readStatus() == STATUS_DONE, "preset, status when done", readStatus(), STATUS_DONE);
+  words = readAndCheckFIFO(0, "preset");
+  check(words == TEST_PRESET_CHANS*TEST_SIGNALS, "preset, FIFO words", words, TEST_PRESET_CHANS*TEST_SIGNALS);
+  // No more channels after the preset
+  epicsThreadSleep(0.05);
+  check(pSim->fifoCount() == 0, "preset, FIFO count after stop", pSim->fifoCount(), 0);
+}
+
+static void testStatusRegister()
+{
+  int i;
+
+  // Each cycle sets the done flag with a one channel preset and clears it with the same write
+  pSim->writeRegister(&pSim->regs_->key_reset_reg, 1);
+  pSim->writeRegister(&pSim->regs_->prescale_reg, 0);
+  pSim->writeRegister(&pSim->regs_->preset_reg, 1);
+  for (i=0; i<3; i++) {
+    pSim->writeRegister(&pSim->regs_->key_start_reg, 1);
+    pSim->writeRegister(&pSim->regs_->key_lne_pulse_reg, 1);
+    check(readStatus() == STATUS_DONE, "status register, status when done",
+          readStatus(), STATUS_DONE);
+    pSim->writeRegister(&pSim->regs_->status_reg, STATUS_DONE);
+    check(readStatus() == 0, "status register, status after clear", readStatus(), 0);
+  }
+  check(pSim->fifoCount() == 3*TEST_SIGNALS, "status register, FIFO count", pSim->fifoCount(), 3*TEST_SIGNALS);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1) writes = atoi(argv[1]);
+
+  intEvent = epicsEventCreate(epicsEventEmpty);
+  writerDone = epicsEventCreate(epicsEventEmpty);
+  pSim = new TestSim(intFunc, NULL);
+  pSim->start();
+
+  testRepeatedWrites();
+  testPreset();
+  testStatusRegister();
+
+  printf("SIS38XXSimTest: %d writes per thread, %d failures\n", writes, failures);
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+/* File:    SIS38XXStream.cpp
+ *
+ * Purpose:
+ * Streaming of SIS3820 and SIS3801 MCS data to a rotating set of segment files.
+ * See SIS38XXStream.h for the file layout.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+
+#include "SIS38XXStream.h"
+
+#ifdef SIS38XX_STREAM_MMAP
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+SIS38XXStream::SIS38XXStream()
+  : maxSignals_(0), segmentChans_(0), numSegments_(0), sequence_(0),
+    segmentWords_(0), wordsInSegment_(0), firstChan_(0.), open_(false)
+{
+  path_[0] = 0;
+  errorString_[0] = 0;
+#ifdef SIS38XX_STREAM_MMAP
+  fd_ = -1;
+  mapBytes_ = 0;
+  pMap_ = NULL;
+  pData_ = NULL;
+#else
+  fp_ = NULL;
+#endif
+}
+
+SIS38XXStream::~SIS38XXStream()
+{
+  close();
+}
+
+int SIS38XXStream::open(const char *path, int maxSignals, int segmentChans, int numSegments)
+{
+  if (open_) close();
+  if ((path == NULL) || (strlen(path) == 0) || (strlen(path) >= sizeof(path_)))
+    return setError("invalid file path", 0);
+  if ((maxSignals < 1) || (segmentChans < 1) || (numSegments < 1) ||
+      ((double)segmentChans*maxSignals > 0x10000000))
+    return setError("invalid segment size", 0);
+  strcpy(path_, path);
+  maxSignals_ = maxSignals;
+  segmentChans_ = segmentChans;
+  numSegments_ = numSegments;
+  segmentWords_ = segmentChans*maxSignals;
+  sequence_ = 0;
+  firstChan_ = 0.;
+  errorString_[0] = 0;
+  return openSegment();
+}
+
+int SIS38XXStream::write(const epicsUInt32 *pIn, int count)
+{
+  int n;
+
+  if (!open_) return setError("stream is not open", 0);
+  while (count > 0) {
+    n = segmentWords_ - wordsInSegment_;
+    if (n > count) n = count;
+#ifdef SIS38XX_STREAM_MMAP
+    memcpy(pData_ + wordsInSegment_, pIn, n*sizeof(epicsUInt32));
+#else
+    if ((fseek(fp_, sizeof(header_) + wordsInSegment_*sizeof(epicsUInt32), SEEK_SET) != 0) ||
+        (fwrite(pIn, sizeof(epicsUInt32), n, fp_) != (size_t)n))
+      return setError("error writing segment file", errno);
+#endif
+    wordsInSegment_ += n;
+    pIn += n;
+    count -= n;
+    if (wordsInSegment_ == segmentWords_) {
+      closeSegment(true);
+      firstChan_ += segmentChans_;
+      sequence_++;
+      if (openSegment()) return -1;
+    }
+  }
+  updateHeader();
+  return 0;
+}
+
+void SIS38XXStream::discardPartialChannel()
+{
+  if (!open_) return;
+  wordsInSegment_ -= wordsInSegment_ % maxSignals_;
+}
+
+void SIS38XXStream::close()
+{
+  if (!open_) return;
+  closeSegment(true);
+}
+
+bool SIS38XXStream::isOpen()
+{
+  return open_;
+}
+
+double SIS38XXStream::channels()
+{
+  if (maxSignals_ == 0) return 0.;
+  return firstChan_ + wordsInSegment_/maxSignals_;
+}
+
+int SIS38XXStream::sequence()
+{
+  return sequence_;
+}
+
+const char *SIS38XXStream::errorString()
+{
+  return errorString_;
+}
+
+int SIS38XXStream::openSegment()
+{
+  char fileName[SIS38XX_STREAM_MAX_PATH + 16];
+  epicsTimeStamp now;
+
+  epicsSnprintf(fileName, sizeof(fileName), "%s_%3.3d.sis", path_, sequence_ % numSegments_);
+  epicsTimeGetCurrent(&now);
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, SIS38XX_STREAM_MAGIC, sizeof(header_.magic));
+  header_.version       = SIS38XX_STREAM_VERSION;
+  header_.headerBytes   = sizeof(header_);
+  header_.maxSignals    = maxSignals_;
+  header_.segmentChans  = segmentChans_;
+  header_.sequence      = sequence_;
+  header_.firstChanLow  = (epicsUInt32)fmod(firstChan_, 4294967296.);
+  header_.firstChanHigh = (epicsUInt32)(firstChan_ / 4294967296.);
+  header_.secPastEpoch  = now.secPastEpoch;
+  header_.nsec          = now.nsec;
+  wordsInSegment_ = 0;
+
+#ifdef SIS38XX_STREAM_MMAP
+  mapBytes_ = sizeof(header_) + (size_t)segmentWords_*sizeof(epicsUInt32);
+  fd_ = ::open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) return setError(fileName, errno);
+  if (ftruncate(fd_, mapBytes_) != 0) {
+    int error = errno;
+    ::close(fd_);
+    return setError(fileName, error);
+  }
+  pMap_ = (SIS38XXStreamHeader *)mmap(NULL, mapBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (pMap_ == (SIS38XXStreamHeader *)MAP_FAILED) {
+    pMap_ = NULL;
+    int error = errno;
+    ::close(fd_);
+    return setError(fileName, error);
+  }
+  *pMap_ = header_;
+  pData_ = (epicsUInt32 *)(pMap_ + 1);
+#else
+  fp_ = fopen(fileName, "wb");
+  if (fp_ == NULL) return setError(fileName, errno);
+  if (fwrite(&header_, sizeof(header_), 1, fp_) != 1) {
+    int error = errno;
+    fclose(fp_);
+    fp_ = NULL;
+    return setError(fileName, error);
+  }
+#endif
+  open_ = true;
+  return 0;
+}
+
+/* Writes the final header and closes the file.
+ * A mapped file that was not filled is truncated to the channels that were written. */
+void SIS38XXStream::closeSegment(bool complete)
+{
+  header_.complete = complete ? 1 : 0;
+  updateHeader();
+#ifdef SIS38XX_STREAM_MMAP
+  size_t usedBytes = sizeof(header_) + (size_t)header_.numChans*maxSignals_*sizeof(epicsUInt32);
+  msync(pMap_, mapBytes_, MS_ASYNC);
+  munmap(pMap_, mapBytes_);
+  pMap_ = NULL;
+  pData_ = NULL;
+  if (usedBytes < mapBytes_) {
+    if (ftruncate(fd_, usedBytes) != 0) setError("error truncating segment file", errno);
+  }
+  ::close(fd_);
+  fd_ = -1;
+#else
+  fclose(fp_);
+  fp_ = NULL;
+#endif
+  open_ = false;
+}
+
+void SIS38XXStream::updateHeader()
+{
+  header_.numChans = wordsInSegment_ / maxSignals_;
+#ifdef SIS38XX_STREAM_MMAP
+  pMap_->numChans = header_.numChans;
+  pMap_->complete = header_.complete;
+#else
+  if ((fseek(fp_, 0, SEEK_SET) != 0) || (fwrite(&header_, sizeof(header_), 1, fp_) != 1))
+    setError("error writing segment header", errno);
+  fflush(fp_);
+#endif
+}
+
+int SIS38XXStream::setError(const char *message, int error)
+{
+  if (error != 0)
+    epicsSnprintf(errorString_, sizeof(errorString_), "%s: %s", message, strerror(error));
+  else
+    epicsSnprintf(errorString_, sizeof(errorString_), "%s", message);
+  return -1;
+}
@@ -0,0 +1,105 @@
+/* File:    SIS38XXStream.h
+ *
+ * Purpose:
+ * Streaming of SIS3820 and SIS3801 MCS data to a rotating set of segment files.
+ * This lets an acquisition run for much longer than the maxChans channels that fit
+ * in the driver's memory.
+ *
+ * File layout
+ * A run is written to numSegments files named <path>_000.sis, <path>_001.sis, ...
+ * Segment number N of the run is written to file (N % numSegments), so once all
+ * the files have been used the oldest one is overwritten.
+ * Each file is a SIS38XXStreamHeader followed by segmentChans*maxSignals 32-bit
+ * words in FIFO order, i.e. all signals for the first channel, then all signals
+ * for the next channel, ... All values are in the byte order of the IOC.
+ * The headers are the index of the run. A reader finds the data by sorting the
+ * files by sequence. Only numChans channels of each file are valid. firstChan is
+ * the channel number since the start of the run of the first channel in the file.
+ * numChans is updated as data are written, so a file can be read while it is
+ * being written.
+ *
+ * On hosts with mmap() the segment files are memory mapped, otherwise they are
+ * written with stdio.
+ *
+ * This file does not depend on asyn, so it can be built into standalone test programs.
+ *
+ */
+
+#ifndef SIS38XX_STREAM_H
+#define SIS38XX_STREAM_H
+
+#include <stdio.h>
+
+#include <epicsTypes.h>
+
+#define SIS38XX_STREAM_MAGIC   "SIS38XXS"
+#define SIS38XX_STREAM_VERSION 1
+#define SIS38XX_STREAM_MAX_PATH 256
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(vxWorks) && !defined(__rtems__)
+#define SIS38XX_STREAM_MMAP
+#endif
+
+/* The segment file header, 64 bytes */
+typedef struct {
+  char        magic[8];       /* SIS38XX_STREAM_MAGIC, not nil terminated */
+  epicsUInt32 version;        /* SIS38XX_STREAM_VERSION */
+  epicsUInt32 headerBytes;    /* Size of this header, the data start at this offset */
+  epicsUInt32 maxSignals;     /* Number of words per channel */
+  epicsUInt32 segmentChans;   /* Number of channels the file can hold */
+  epicsUInt32 sequence;       /* Segment number in the run, starting at 0 */
+  epicsUInt32 numChans;       /* Number of complete channels in the file */
+  epicsUInt32 firstChanLow;   /* Channel number in the run of the first channel in the file, */
+  epicsUInt32 firstChanHigh;  /* low and high 32 bits */
+  epicsUInt32 secPastEpoch;   /* EPICS time stamp when the segment was started */
+  epicsUInt32 nsec;
+  epicsUInt32 complete;       /* 1 when the file is full or the run was closed */
+  epicsUInt32 reserved[3];
+} SIS38XXStreamHeader;
+
+class SIS38XXStream
+{
+  public:
+  SIS38XXStream();
+  ~SIS38XXStream();
+  /** Starts a new run. Returns 0 on success, -1 on error. */
+  int open(const char *path, int maxSignals, int segmentChans, int numSegments);
+  /** Appends count words in FIFO order. Returns 0 on success, -1 on error. */
+  int write(const epicsUInt32 *pIn, int count);
+  /** Discards the words written for a channel that is not complete. */
+  void discardPartialChannel();
+  /** Marks the current segment complete and closes it. */
+  void close();
+  bool isOpen();
+  /** Number of complete channels written since open() */
+  double channels();
+  int sequence();
+  const char *errorString();
+
+  private:
+  int openSegment();
+  void closeSegment(bool complete);
+  void updateHeader();
+  int setError(const char *message, int error);
+  char path_[SIS38XX_STREAM_MAX_PATH];
+  char errorString_[SIS38XX_STREAM_MAX_PATH + 64];
+  int maxSignals_;
+  int segmentChans_;
+  int numSegments_;
+  int sequence_;
+  int segmentWords_;
+  int wordsInSegment_;
+  double firstChan_;
+  bool open_;
+  SIS38XXStreamHeader header_;
+#ifdef SIS38XX_STREAM_MMAP
+  int fd_;
+  size_t mapBytes_;
+  SIS38XXStreamHeader *pMap_;
+  epicsUInt32 *pData_;
+#else
+  FILE *fp_;
+#endif
+};
+
+#endif
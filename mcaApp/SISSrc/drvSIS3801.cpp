@@ -29,6 +29,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
 /******************/
 /* EPICS includes */
@@ -51,6 +52,7 @@
 #include "drvMca.h"
 #include "devScalerAsyn.h"
 #include "drvSIS3801.h"
+#include "SIS38XXSim.h"
 
 static const char *driverName="drvSIS3801";
 static void intFuncC(void *drvPvt);
@@ -60,47 +62,97 @@ static void readFIFOThreadC(void *drvPvt);
 /* Definitions */
 /***************/
 
+/** Simulation of the SIS3801 registers, see SIS38XXSim.h.
+  * csr_reg is written with control bits and read as status, the simulator tracks the user LED
+  * and publishes the FIFO flags.  The FIFO almost full interrupt is always enabled. */
+class SIS3801Sim : public SIS38XXSim
+{
+  public:
+  SIS3801Sim(const char *portName, int maxSignals, double countRate, SIS38XXSimIntFunc intFunc, void *intPvt)
+    : SIS38XXSim(portName, maxSignals, countRate, sizeof(SIS3801_REGS), SIS3801_FIFO_WORDS,
+                 intFunc, intPvt),
+      led_(false)
+  {
+    regs_ = (SIS3801_REGS *)registers();
+    // Module ID and firmware version 5
+    regs_->irq_reg = (0x3801 << 16) | (5 << 12);
+  }
+
+  protected:
+  void registerWritten(volatile epicsUInt32 *pReg, epicsUInt32 value)
+  {
+    if (pReg == &regs_->key_reset_reg) {
+      stopCounting();
+      clearFIFO();
+      clearCounters();
+      led_ = false;
+    }
+    else if (pReg == &regs_->clear_fifo_reg) {
+      clearFIFO();
+      // Restart the test pattern
+      clearCounters();
+    }
+    else if (pReg == &regs_->csr_reg) {
+      if (value & CONTROL_M_SET_USER_LED) led_ = true;
+      if (value & CONTROL_M_CLEAR_USER_LED) led_ = false;
+    }
+    else if (pReg == &regs_->disable_next_reg) {
+      stopCounting();
+    }
+    else if (pReg == &regs_->enable_next_reg) {
+      startCounting(true, (regs_->prescale_factor_reg + 1.) / SIS38XX_SIM_LNE_CLOCK, 0);
+    }
+    else if (pReg == &regs_->soft_next_reg) {
+      channelAdvance();
+    }
+  }
+
+  void updateRegisters()
+  {
+    int count = fifoCount();
+    epicsUInt32 csrStatus = 0;
+
+    if (led_) csrStatus |= STATUS_M_USER_LED;
+    if (counting_) csrStatus |= STATUS_M_ENABLE_NEXT_LOGIC;
+    if (count == 0) csrStatus |= STATUS_M_FIFO_FLAG_EMPTY;
+    if (count < SIS3801_FIFO_ALMOST_EMPTY_WORDS) csrStatus |= STATUS_M_FIFO_FLAG_ALMOST_EMPTY;
+    if (count >= SIS3801_FIFO_HALF_FULL_WORDS) csrStatus |= STATUS_M_FIFO_FLAG_HALF_FULL;
+    if (count >= fifoWords_/4*3) csrStatus |= STATUS_M_FIFO_FLAG_ALMOST_FULL;
+    if (count == fifoWords_) csrStatus |= STATUS_M_FIFO_FLAG_FULL;
+    regs_->csr_reg = csrStatus;
+  }
+
+  bool interruptPending()
+  {
+    return (regs_->irq_reg & IRQ_M_VME_IRQ_ENABLE) && (fifoCount() >= fifoWords_/4*3);
+  }
+
+  private:
+  SIS3801_REGS *regs_;
+  bool led_;
+};
+
 /*Constructor */
 drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-                       int maxChans, int maxSignals)
-  :  drvSIS38XX(portName, maxChans, maxSignals)
+                       int maxChans, int maxSignals, int fifoWords, int fifoAlmostEmptyWords,
+                       bool simulate, double simCountRate)
+  :  drvSIS38XX(portName, maxChans, maxSignals),
+     fifoWords_(fifoWords), fifoAlmostEmptyWords_(fifoAlmostEmptyWords)
 
 {
   int status;
-  epicsUInt32 controlStatusReg;
   epicsUInt32 moduleID;
   static const char* functionName="SIS3801";
 
   setIntegerParam(SIS38XXModel_, MODEL_SIS3801);
   
-  /* Call devLib to get the system address that corresponds to the VME
-   * base address of the board.
-   */
-  status = devRegisterAddress("drvSIS3801",
-                               SIS3801_ADDRESS_TYPE,
-                               (size_t)baseAddress,
-                               SIS3801_BOARD_SIZE,
-                               (volatile void **)&registers_);
-
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: %s, Can't register VME address %p\n", 
-              driverName, functionName, portName, baseAddress);
-    return;
-  }
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: Registered VME address: 0x%lX to local address: %p size: 0x%X\n", 
-            driverName, functionName, (long)baseAddress, registers_, SIS3801_BOARD_SIZE);
-
-  /* Probe VME bus to see if card is there */
-  status = devReadProbe(4, (char *) &registers_->csr_reg,
-                       (char *) &controlStatusReg);
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: devReadProbe failure = %d\n", 
-              driverName, functionName, status);
-    return;
+  if (simulate) {
+    /* Use the simulator's register file in place of the VME registers */
+    pSim_ = new SIS3801Sim(portName, maxSignals, simCountRate, intFuncC, this);
+    registers_ = (SIS3801_REGS *)pSim_->registers();
+    pSim_->start();
   }
+  else if (mapBoard(baseAddress)) return;
 
   /* Get the module info from the card */
   moduleID = (registers_->irq_reg & 0xFFFF0000) >> 16;
@@ -116,11 +168,21 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
   // Create the mutex used to lock access to the FIFO
   fifoLockId_ = epicsMutexCreate();
 
+  // Allocate FIFO readout buffer
+  fifoBufferWords_ = SIS3801_FIFO_BUFFER_WORDS;
+  fifoBuffer_ = (epicsUInt32 *)malloc(fifoBufferWords_*sizeof(epicsUInt32));
+  if (fifoBuffer_ == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: malloc failure for fifoBuffer_\n", 
+              driverName, functionName);
+    return;
+  }
+
   /* Reset card */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: resetting port %s\n", 
             driverName, functionName, portName);
-  registers_->key_reset_reg = 1;
+  writeRegister(&registers_->key_reset_reg, 1);
 
   /* Clear FIFO */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -138,7 +200,7 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
    * channels will be at the upper end of the channel range.
    * Create a mask with zeros in the rightmost maxSignals bits,
    * 1 in all higher order bits. */
-  registers_->copy_disable_reg = 0xffffffff<<maxSignals_;
+  writeRegister(&registers_->copy_disable_reg, 0xffffffff<<maxSignals_);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
             "%s:%s: setting copy disable register=0x%08x\n",
             driverName, functionName, 0xffffffff<<maxSignals_);
@@ -148,7 +210,10 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
             "%s:%s: interruptServiceRoutine pointer %p\n",
             driverName, functionName, intFuncC);
 
-  status = devConnectInterruptVME(interruptVector, intFuncC, this);
+  if (pSim_)
+    status = 0;
+  else
+    status = devConnectInterruptVME(interruptVector, intFuncC, this);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't connect to vector % d\n", 
@@ -164,13 +229,13 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
             "%s:%s: irq before setting IntLevel= 0x%x\n", 
             driverName, functionName, registers_->irq_reg);
 
-  registers_->irq_reg |= (interruptLevel << 8);
+  writeRegister(&registers_->irq_reg, registers_->irq_reg | (interruptLevel << 8));
 
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq after setting IntLevel= 0x%x\n", 
              driverName, functionName, registers_->irq_reg);
 
-  registers_->irq_reg |= interruptVector;
+  writeRegister(&registers_->irq_reg, registers_->irq_reg | interruptVector);
 
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "m%s:%s: irq config register after setting interrupt vector = 0x%08x\n", 
@@ -202,7 +267,10 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
   enableInterrupts();
 
   /* Enable interrupt level in EPICS */
-  status = devEnableInterruptLevel(intVME, interruptLevel);
+  if (pSim_)
+    status = 0;
+  else
+    status = devEnableInterruptLevel(intVME, interruptLevel);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't enable enterrupt level %d\n", 
@@ -216,6 +284,45 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
 
 
 
+/** Maps the VME registers of the board and checks that it is present */
+int drvSIS3801::mapBoard(int baseAddress)
+{
+  int status;
+  epicsUInt32 controlStatusReg;
+  static const char* functionName="mapBoard";
+
+  /* Call devLib to get the system address that corresponds to the VME
+   * base address of the board.
+   */
+  status = devRegisterAddress("drvSIS3801",
+                               SIS3801_ADDRESS_TYPE,
+                               (size_t)baseAddress,
+                               SIS3801_BOARD_SIZE,
+                               (volatile void **)&registers_);
+
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: %s, Can't register VME address 0x%lX\n", 
+              driverName, functionName, portName, (long)baseAddress);
+    return -1;
+  }
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+            "%s:%s: Registered VME address: 0x%lX to local address: %p size: 0x%X\n", 
+            driverName, functionName, (long)baseAddress, registers_, SIS3801_BOARD_SIZE);
+
+  /* Probe VME bus to see if card is there */
+  status = devReadProbe(4, (char *) &registers_->csr_reg,
+                       (char *) &controlStatusReg);
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: devReadProbe failure = %d\n", 
+              driverName, functionName, status);
+    return -1;
+  }
+
+  return 0;
+}
+
 /* Report  parameters */
 void drvSIS3801::report(FILE *fp, int details)
 {
@@ -231,6 +338,8 @@ void drvSIS3801::report(FILE *fp, int details)
     fprintf(fp, "    csr_reg              = 0x%x\n",   registers_->csr_reg);
     fprintf(fp, "    irq_reg              = 0x%x\n",   registers_->irq_reg);
     fprintf(fp, "    prescale_factor_reg  = 0x%x\n",   registers_->prescale_factor_reg);
+    fprintf(fp, "  FIFO words             = %d\n",   fifoWords_);
+    fprintf(fp, "  FIFO almost empty words= %d\n",   fifoAlmostEmptyWords_);
   }
   // Call the base class method
   drvSIS38XX::report(fp, details);
@@ -277,7 +386,7 @@ void drvSIS3801::startMCSAcquire()
          */
         double dwellTime;
         getDoubleParam(mcaDwellTime_, &dwellTime);
-        registers_->csr_reg = CONTROL_M_ENABLE_10MHZ_LNE_PRESCALER;
+        writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_10MHZ_LNE_PRESCALER);
         prescale = (epicsUInt32) (SIS3801_10MHZ_CLOCK * dwellTime) - 1;
       }
     else if (channelAdvanceSource == mcaChannelAdvance_External) {
@@ -287,7 +396,7 @@ void drvSIS3801::startMCSAcquire()
          * here, so the user sees the actual number at the record level.
          */
         prescale--;
-        registers_->csr_reg = CONTROL_M_DISABLE_10MHZ_LNE_PRESCALER;
+        writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_10MHZ_LNE_PRESCALER);
       } 
     else {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -301,16 +410,16 @@ void drvSIS3801::startMCSAcquire()
      *  - Write prescale factor
      *  - Enable prescaler
      */
-    registers_->csr_reg = CONTROL_M_DISABLE_LNE_PRESCALER;
-    registers_->prescale_factor_reg = prescale;
-    registers_->csr_reg = CONTROL_M_ENABLE_LNE_PRESCALER;
+    writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_LNE_PRESCALER);
+    writeRegister(&registers_->prescale_factor_reg, prescale);
+    writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_LNE_PRESCALER);
   }
 
   /* Enable next logic */
-  registers_->enable_next_reg = 1;
+  writeRegister(&registers_->enable_next_reg, 1);
 
   /* Enable counting bit in CSR */
-  registers_->csr_reg = CONTROL_M_CLEAR_SOFTWARE_DISABLE;
+  writeRegister(&registers_->csr_reg, CONTROL_M_CLEAR_SOFTWARE_DISABLE);
 
   /* Do one software next_clock if enabled */
   if (countOnStart != 0)
@@ -320,7 +429,7 @@ void drvSIS3801::startMCSAcquire()
 void drvSIS3801::softwareChannelAdvance()
 {
   //static const char *functionName="softwareChannelAdvance";
-  registers_->soft_next_reg = 1; 
+  writeRegister(&registers_->soft_next_reg, 1); 
 }
 
 
@@ -330,10 +439,10 @@ void drvSIS3801::stopMCSAcquire()
 
   /* Turn off hardware acquisition */
   /* Disable counting bit in CSR */
-  registers_->csr_reg = CONTROL_M_SET_SOFTWARE_DISABLE;
+  writeRegister(&registers_->csr_reg, CONTROL_M_SET_SOFTWARE_DISABLE);
 
   /* Disable next logic */
-  registers_->disable_next_reg = 1;
+  writeRegister(&registers_->disable_next_reg, 1);
   acquiring_ = false;
 }
 
@@ -343,14 +452,14 @@ void drvSIS3801::startScaler()
 
   setAcquireMode(ACQUIRE_MODE_SCALER);
   
-  registers_->csr_reg = CONTROL_M_ENABLE_10MHZ_LNE_PRESCALER;
-  registers_->csr_reg = CONTROL_M_DISABLE_LNE_PRESCALER;
-  registers_->prescale_factor_reg = ((SIS3801_10MHZ_CLOCK / SIS3801_SCALER_MODE_RATE) - 1);
-  registers_->csr_reg = CONTROL_M_ENABLE_LNE_PRESCALER;
-  registers_->enable_next_reg = 1;
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_10MHZ_LNE_PRESCALER);
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_LNE_PRESCALER);
+  writeRegister(&registers_->prescale_factor_reg, ((SIS3801_10MHZ_CLOCK / SIS3801_SCALER_MODE_RATE) - 1));
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_LNE_PRESCALER);
+  writeRegister(&registers_->enable_next_reg, 1);
   /* Enable counting bit in CSR */
-  registers_->csr_reg = CONTROL_M_CLEAR_SOFTWARE_DISABLE;
-  registers_->soft_next_reg = 1; 
+  writeRegister(&registers_->csr_reg, CONTROL_M_CLEAR_SOFTWARE_DISABLE);
+  writeRegister(&registers_->soft_next_reg, 1); 
   // Wake up the FIFO reading thread
   eventType_ = EventStartScaler;
   epicsEventSignal(readFIFOEventId_);
@@ -396,9 +505,9 @@ void drvSIS3801::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   
   /* Enable or disable 25 MHz channel 1 reference pulses. */
   if ((channel1Source == CHANNEL1_SOURCE_INTERNAL) && (firmwareVersion_ >= 5))
-    registers_->enable_ch1_pulser = 1;
+    writeRegister(&registers_->enable_ch1_pulser, 1);
   else
-    registers_->disable_ch1_pulser = 1;
+    writeRegister(&registers_->disable_ch1_pulser, 1);
 
   acquireMode_ = acquireMode;
   setIntegerParam(SIS38XXAcquireMode_, acquireMode);
@@ -411,7 +520,7 @@ void drvSIS3801::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   setControlStatusReg();
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
             "%s:%s: control status register = 0x%08x\n",
-            driverName, functionName, registers_->csr_reg);
+            driverName, functionName, readRegister(&registers_->csr_reg));
 
 }
 
@@ -426,10 +535,10 @@ void drvSIS3801::setInputMode()
    * requested by the correct number of bits, and add to the register. */
   if (inputMode < 0 || inputMode > 3) inputMode = 0;
 
-  if (inputMode & 1) registers_->csr_reg = CONTROL_M_SET_INPUT_MODE_BIT_0;
-  else               registers_->csr_reg = CONTROL_M_CLEAR_INPUT_MODE_BIT_0;
-  if (inputMode & 2) registers_->csr_reg = CONTROL_M_SET_INPUT_MODE_BIT_1;
-  else               registers_->csr_reg = CONTROL_M_CLEAR_INPUT_MODE_BIT_1;
+  if (inputMode & 1) writeRegister(&registers_->csr_reg, CONTROL_M_SET_INPUT_MODE_BIT_0);
+  else               writeRegister(&registers_->csr_reg, CONTROL_M_CLEAR_INPUT_MODE_BIT_0);
+  if (inputMode & 2) writeRegister(&registers_->csr_reg, CONTROL_M_SET_INPUT_MODE_BIT_1);
+  else               writeRegister(&registers_->csr_reg, CONTROL_M_CLEAR_INPUT_MODE_BIT_1);
 }
 
 void drvSIS3801::setOutputMode()
@@ -445,16 +554,16 @@ void drvSIS3801::setLED()
   
   getIntegerParam(SIS38XXLED_, &value);
   if (value == 0)
-    registers_->csr_reg = CONTROL_M_CLEAR_USER_LED;
+    writeRegister(&registers_->csr_reg, CONTROL_M_CLEAR_USER_LED);
   else
-    registers_->csr_reg = CONTROL_M_SET_USER_LED;
+    writeRegister(&registers_->csr_reg, CONTROL_M_SET_USER_LED);
 }
 
 int drvSIS3801::getLED()
 {
   int value;
   
-  value = registers_->csr_reg & STATUS_M_USER_LED;
+  value = readRegister(&registers_->csr_reg) & STATUS_M_USER_LED;
   return (value == 0) ? 0:1;
 }
 
@@ -476,21 +585,21 @@ void drvSIS3801::setControlStatusReg()
   //static const char* functionName="setControlStatusReg";
 
   /* Set up the default behaviour of the card */
-  registers_->csr_reg = CONTROL_M_DISABLE_FIFO_TEST_MODE;    /* Disable FIFO test mode */
-  registers_->csr_reg = CONTROL_M_DISABLE_25MHZ_TEST_PULSES; /* No 25MHz test pulses */
-  registers_->csr_reg = CONTROL_M_DISABLE_INPUT_TEST_MODE;   /* Disable test input */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_FIFO_TEST_MODE);    /* Disable FIFO test mode */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_25MHZ_TEST_PULSES); /* No 25MHz test pulses */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_INPUT_TEST_MODE);   /* Disable test input */
   if (firmwareVersion_ < 5) {
-  registers_->csr_reg = CONTROL_M_DISABLE_BROADCAST_MODE;    /* No broadcast mode */
-  registers_->csr_reg = CONTROL_M_DISABLE_BROADCAST_HAND;    /* No broadcast handshake */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_BROADCAST_MODE);    /* No broadcast mode */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_BROADCAST_HAND);    /* No broadcast handshake */
   }
-  registers_->csr_reg = CONTROL_M_ENABLE_EXTERNAL_NEXT;      /* Enable external NEXT */
-  registers_->csr_reg = CONTROL_M_ENABLE_EXTERNAL_CLEAR;     /* Enable external CLEAR */
-  registers_->csr_reg = CONTROL_M_ENABLE_EXTERNAL_DISABLE;   /* Enable external DISABLE */
-  registers_->csr_reg = CONTROL_M_SET_SOFTWARE_DISABLE;      /* Disable counting */
-  registers_->csr_reg = CONTROL_M_DISABLE_IRQ_0;             /* Disable start of CIP IRQ */
-  registers_->csr_reg = CONTROL_M_DISABLE_IRQ_1;             /* Disable FIFO almost empty (full?) */
-  registers_->csr_reg = CONTROL_M_DISABLE_IRQ_2;             /* Disable FIFO half full */
-  registers_->csr_reg = CONTROL_M_ENABLE_IRQ_3;              /* Enable FIFO almost full */
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_EXTERNAL_NEXT);      /* Enable external NEXT */
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_EXTERNAL_CLEAR);     /* Enable external CLEAR */
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_EXTERNAL_DISABLE);   /* Enable external DISABLE */
+  writeRegister(&registers_->csr_reg, CONTROL_M_SET_SOFTWARE_DISABLE);      /* Disable counting */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_IRQ_0);             /* Disable start of CIP IRQ */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_IRQ_1);             /* Disable FIFO almost empty (full?) */
+  writeRegister(&registers_->csr_reg, CONTROL_M_DISABLE_IRQ_2);             /* Disable FIFO half full */
+  writeRegister(&registers_->csr_reg, CONTROL_M_ENABLE_IRQ_3);              /* Enable FIFO almost full */
 }
 
 
@@ -502,14 +611,14 @@ void drvSIS3801::enableInterrupts()
 {
   //static const char* functionName="enableInterrupts";
 
- registers_->irq_reg |= IRQ_M_VME_IRQ_ENABLE;
+ writeRegister(&registers_->irq_reg, registers_->irq_reg | IRQ_M_VME_IRQ_ENABLE);
 }
 
 void drvSIS3801::disableInterrupts()
 {
   //static const char* functionName="disableInterrupts";
 
- registers_->irq_reg &= ~IRQ_M_VME_IRQ_ENABLE;
+ writeRegister(&registers_->irq_reg, registers_->irq_reg & ~IRQ_M_VME_IRQ_ENABLE);
 }
 
 
@@ -538,10 +647,35 @@ void drvSIS3801::resetFIFO()
   //static const char* functionName="resetFIFO";
 
   epicsMutexLock(fifoLockId_);
-  registers_->clear_fifo_reg = 1;
+  writeRegister(&registers_->clear_fifo_reg, 1);
   epicsMutexUnlock(fifoLockId_);
 }  
 
+/** The csr_reg and fifo_reg registers have side effects that the simulator can't emulate with
+  * its register file, so the FIFO is accessed through these functions.
+  * Returns the number of words that can be read with readFIFOBlock without checking the empty flag.
+  * The simulator updates the FIFO flags in csr_reg on every FIFO read and register write and when
+  * it adds words, so they are used in the same way as the board's.  Between updates the simulator
+  * only adds words, so the flags never show more words than there are.  drvSIS3801SimConfig passes
+  * SIS3801_FIFO_WORDS and SIS3801_FIFO_ALMOST_EMPTY_WORDS, which are the sizes the simulator uses
+  * for the half full and almost empty flags. */
+int drvSIS3801::fifoSafeWords()
+{
+  return SIS3801FifoSafeWords(readRegister(&registers_->csr_reg), fifoWords_, fifoAlmostEmptyWords_);
+}
+
+/** Reads nWords from the FIFO.  nWords must not be more than fifoSafeWords() returned. */
+void drvSIS3801::readFIFOBlock(epicsUInt32 *pOut, int nWords)
+{
+  int i;
+
+  if (pSim_) {
+    pSim_->readFIFO(pOut, nWords);
+    return;
+  }
+  for (i=0; i<nWords; i++) pOut[i] = registers_->fifo_reg;
+}
+
 void readFIFOThreadC(void *drvPvt)
 {
   drvSIS3801 *pSIS3801 = (drvSIS3801*)drvPvt;
@@ -557,13 +691,16 @@ void drvSIS3801::readFIFOThread()
   int count;
   int signal;
   int chan;
+  int epoch;
   int nChans;
   int status;
   int i;
   bool acquiring;  // We have a separate flag because we need to continue processing one last
                    // time even if acquiring_ goes to false because acquisition was manually stopped
   epicsUInt32 scalerPresets[SIS38XX_MAX_SIGNALS];
-  epicsUInt32 *pOut=NULL;
+  int maxWords;
+  int nWords;
+  int safeWords;
   epicsTimeStamp t1, t2;
   static const char* functionName="readFIFOThread";
 
@@ -573,7 +710,7 @@ void drvSIS3801::readFIFOThread()
     // We got an event, which can come from acquisition starting, or FIFO full interrupt
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
               "%s:%s: got readFIFOEvent, eventType=%d, interrupt status=0x%8.8x\n",
-              driverName, functionName, eventType_, registers_->csr_reg & 0xFFF00000);
+              driverName, functionName, eventType_, readRegister(&registers_->csr_reg) & 0xFFF00000);
     lock();
     acquiring = acquiring_;
     unlock();
@@ -583,10 +720,11 @@ void drvSIS3801::readFIFOThread()
         getIntegerParam(i, scalerPresets_, (int *)&scalerPresets[i]);
       getIntegerParam(mcaNumChannels_, &nChans);
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                "%s:%s: scaler presets[0]=%d, scalerData[0]=%d\n",
-                driverName, functionName, scalerPresets[0], scalerData_[0]);
+                "%s:%s: scaler presets[0]=%d, scalerData[0]=%llu\n",
+                driverName, functionName, scalerPresets[0], (unsigned long long)scalerData_[0]);
       signal = nextSignal_;
       chan = nextChan_;
+      epoch = epoch_;
       count = 0;
       // This block of code can be slow and does not require the asynPortDriver lock because we are not
       // accessing object data that could change.  
@@ -595,34 +733,41 @@ void drvSIS3801::readFIFOThread()
       unlock();
       epicsTimeGetCurrent(&t1);
 
-      /* Read out FIFO. It would be more efficient not to check the empty
-       * flag on each transfer, using the almost empty flag.  But this has gotten
-       * too complex, and is unlikely to save time on new boards with lots of
-       * memory.
+      /* Read out FIFO.  The half full and almost empty flags give a number of words that
+       * can be read without checking the empty flag before each word, which would double
+       * the number of VME cycles.  The empty flag is only checked word by word for the last
+       * fifoAlmostEmptyWords_ words, or for every word if the FIFO size and almost empty level
+       * were not given to drvSIS3801Config.
        */
       if (acquireMode_== ACQUIRE_MODE_MCS) {
-        // Copy the data from the FIFO to the mcsBuffer
-        pOut = mcsData_ + signal*maxChans_ + chan;
+        // Read the FIFO into fifoBuffer_ and copy each buffer to the mcsBuffer
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                  "%s:%s: pOut=%p, signal=%d, chan=%d\n",
-                  driverName, functionName, pOut, signal, chan);
-        while (((registers_->csr_reg & STATUS_M_FIFO_FLAG_EMPTY)==0) && (chan < nChans) && acquiring_) {
-          *pOut = registers_->fifo_reg;
-          signal++;
-          count++;
-          if (signal >= maxSignals_) {
-            signal = 0;
-            chan++;
-            pOut = mcsData_ + chan;
-          } else {
-            pOut += maxChans_;
+                  "%s:%s: signal=%d, chan=%d\n",
+                  driverName, functionName, signal, chan);
+        maxWords = (nChans - chan)*maxSignals_ - signal;
+        // When streaming or in pre-trigger mode read to the end of the ring buffer, demuxFIFO wraps to the start
+        if (streaming_ || pretrigger_) maxWords = (maxChans_ - chan)*maxSignals_ - signal;
+        while ((count < maxWords) && acquiring_) {
+          nWords = 0;
+          while ((nWords < fifoBufferWords_) && (count + nWords < maxWords)) {
+            safeWords = fifoSafeWords();
+            if (safeWords == 0) break;
+            if (safeWords > fifoBufferWords_ - nWords) safeWords = fifoBufferWords_ - nWords;
+            if (safeWords > maxWords - count - nWords) safeWords = maxWords - count - nWords;
+            readFIFOBlock(fifoBuffer_ + nWords, safeWords);
+            nWords += safeWords;
           }
+          if (nWords == 0) break;
+          demuxFIFO(fifoBuffer_, nWords, epoch, &signal, &chan);
+          count += nWords;
         }
       } else if (acquireMode_ == ACQUIRE_MODE_SCALER) {
-        while ((registers_->csr_reg & STATUS_M_FIFO_FLAG_EMPTY)==0 && acquiring_) {
-          scalerData_[signal] += registers_->fifo_reg;
-          signal++;
-          count++;
+        // Read at most to the end of the current set of scalers, so no words are read after a preset is reached
+        while (acquiring_ && ((nWords = fifoSafeWords()) > 0)) {
+          if (nWords > maxSignals_ - signal) nWords = maxSignals_ - signal;
+          readFIFOBlock(fifoBuffer_, nWords);
+          for (i=0; i<nWords; i++) scalerData_[signal++] += fifoBuffer_[i];
+          count += nWords;
           if (signal >= maxSignals_) {
             for (i=0; i<maxSignals_; i++) {
               if ((scalerPresets[i] != 0) && 
@@ -630,7 +775,7 @@ void drvSIS3801::readFIFOThread()
                 acquiring = false;
             }
             asynPrintIO(pasynUserSelf, ASYN_TRACEIO_DRIVER, 
-                      (const char*)scalerData_, maxSignals_*sizeof(epicsUInt32), 
+                      (const char*)scalerData_, maxSignals_*sizeof(epicsUInt64), 
                       "%s:%s:\n",
                       driverName, functionName);
             if (!acquiring) break;
@@ -648,12 +793,11 @@ void drvSIS3801::readFIFOThread()
       
       // Take the lock since we are now changing object data
       lock();
-      nextChan_ = chan;
-      nextSignal_ = signal;
+      storeFIFOPosition(epoch, signal, chan);
       if (acquireMode_ == ACQUIRE_MODE_MCS) {
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                  "%s:%s: pOut=%p,signal=%d, chan=%d\n",
-                  driverName, functionName, pOut, signal, chan);
+                  "%s:%s: signal=%d, chan=%d\n",
+                  driverName, functionName, signal, chan);
         checkMCSDone();
       } else if (acquireMode_ == ACQUIRE_MODE_SCALER) {
         if (!acquiring) acquiring_ = false;
@@ -685,10 +829,10 @@ void drvSIS3801::readFIFOThread()
 
 extern "C" {
 int drvSIS3801Config(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-                     int maxChans, int maxSignals)
+                     int maxChans, int maxSignals, int fifoWords, int fifoAlmostEmptyWords)
 {
   drvSIS3801 *pSIS3801 = new drvSIS3801(portName, baseAddress, interruptVector, interruptLevel,
-                                        maxChans, maxSignals);
+                                        maxChans, maxSignals, fifoWords, fifoAlmostEmptyWords);
   pSIS3801 = NULL;
   return 0;
 }
@@ -700,6 +844,8 @@ static const iocshArg drvSIS3801ConfigArg2 = { "Interrupt vector", iocshArgInt};
 static const iocshArg drvSIS3801ConfigArg3 = { "Interrupt level",  iocshArgInt};
 static const iocshArg drvSIS3801ConfigArg4 = { "MaxChannels",      iocshArgInt};
 static const iocshArg drvSIS3801ConfigArg5 = { "MaxSignals",       iocshArgInt};
+static const iocshArg drvSIS3801ConfigArg6 = { "FIFO words",       iocshArgInt};
+static const iocshArg drvSIS3801ConfigArg7 = { "FIFO almost empty words", iocshArgInt};
 
 static const iocshArg * const drvSIS3801ConfigArgs[] = 
 { &drvSIS3801ConfigArg0,
@@ -707,21 +853,53 @@ static const iocshArg * const drvSIS3801ConfigArgs[] =
   &drvSIS3801ConfigArg2,
   &drvSIS3801ConfigArg3,
   &drvSIS3801ConfigArg4,
-  &drvSIS3801ConfigArg5
+  &drvSIS3801ConfigArg5,
+  &drvSIS3801ConfigArg6,
+  &drvSIS3801ConfigArg7
 };
 
 static const iocshFuncDef drvSIS3801ConfigFuncDef = 
-  {"drvSIS3801Config",6,drvSIS3801ConfigArgs};
+  {"drvSIS3801Config",8,drvSIS3801ConfigArgs};
 
 static void drvSIS3801ConfigCallFunc(const iocshArgBuf *args)
 {
   drvSIS3801Config(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
-                   args[4].ival, args[5].ival);
+                   args[4].ival, args[5].ival, args[6].ival, args[7].ival);
+}
+
+int drvSIS3801SimConfig(const char *portName, int maxChans, int maxSignals, double countRate)
+{
+  drvSIS3801 *pSIS3801 = new drvSIS3801(portName, 0, 0, 0, maxChans, maxSignals,
+                                        SIS3801_FIFO_WORDS, SIS3801_FIFO_ALMOST_EMPTY_WORDS, true, countRate);
+  pSIS3801 = NULL;
+  return 0;
+}
+
+/* iocsh config function */
+static const iocshArg drvSIS3801SimConfigArg0 = { "Asyn port name", iocshArgString};
+static const iocshArg drvSIS3801SimConfigArg1 = { "MaxChannels",    iocshArgInt};
+static const iocshArg drvSIS3801SimConfigArg2 = { "MaxSignals",     iocshArgInt};
+static const iocshArg drvSIS3801SimConfigArg3 = { "Count rate",     iocshArgDouble};
+
+static const iocshArg * const drvSIS3801SimConfigArgs[] = 
+{ &drvSIS3801SimConfigArg0,
+  &drvSIS3801SimConfigArg1,
+  &drvSIS3801SimConfigArg2,
+  &drvSIS3801SimConfigArg3
+};
+
+static const iocshFuncDef drvSIS3801SimConfigFuncDef = 
+  {"drvSIS3801SimConfig",4,drvSIS3801SimConfigArgs};
+
+static void drvSIS3801SimConfigCallFunc(const iocshArgBuf *args)
+{
+  drvSIS3801SimConfig(args[0].sval, args[1].ival, args[2].ival, args[3].dval);
 }
 
 void drvSIS3801Register(void)
 {
   iocshRegister(&drvSIS3801ConfigFuncDef,drvSIS3801ConfigCallFunc);
+  iocshRegister(&drvSIS3801SimConfigFuncDef,drvSIS3801SimConfigCallFunc);
 }
 
 epicsExportRegistrar(drvSIS3801Register);
@@ -33,6 +33,16 @@
 #define SIS3801_FIFO_BYTE_SIZE    0x100
 #define SIS3801_FIFO_WORD_SIZE    0x040
 
+/* Number of words read from the FIFO before they are copied to mcsData_ */
+#define SIS3801_FIFO_BUFFER_WORDS 4096
+
+/* Size of the FIFO and almost empty level of the simulator and of SIS3801FifoBench.
+ * They are not used for real boards, where the FIFO size and almost empty level depend on the
+ * FIFO chips fitted, and are given to drvSIS3801Config. */
+#define SIS3801_FIFO_WORDS              0x10000
+#define SIS3801_FIFO_HALF_FULL_WORDS    (SIS3801_FIFO_WORDS/2)
+#define SIS3801_FIFO_ALMOST_EMPTY_WORDS (SIS3801_FIFO_WORDS/64)
+
 #define SIS3801_SCALER_MODE_RATE     100   /* 100 Hz readout of FIFO */
 
 #define SIS3801_INTERNAL_CLOCK  10000000  /* The internal clock on the SIS3801 */
@@ -157,7 +167,8 @@ class drvSIS3801 : public drvSIS38XX
 {
   public:
   drvSIS3801(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-             int maxChans, int maxSignals);
+             int maxChans, int maxSignals, int fifoWords=0, int fifoAlmostEmptyWords=0,
+             bool simulate=false, double simCountRate=0.);
 
   // Public methods we override from drvSIS38XX
   void report(FILE *fp, int details);
@@ -190,12 +201,29 @@ class drvSIS3801 : public drvSIS38XX
   int getMuxOut();
 
   private:
+  int mapBoard(int baseAddress);
+  int fifoSafeWords();
+  void readFIFOBlock(epicsUInt32 *pOut, int nWords);
   void resetFIFO();
   void setOpModeReg();
   void setControlStatusReg();
   SIS3801_REGS *registers_;
+  int fifoWords_;              // Size of the FIFO, 0 if not known
+  int fifoAlmostEmptyWords_;   // The almost empty flag is clear above this many words, 0 if not known
 };
 
+/** Returns the number of words that can be read from the FIFO without checking the
+  * empty flag, given the value of the status register, the size of the FIFO and the
+  * almost empty level.  If the size or the level is 0 that flag is not used, and with
+  * both 0 every word is checked. */
+static inline int SIS3801FifoSafeWords(epicsUInt32 status, int fifoWords, int almostEmptyWords)
+{
+  if (status & STATUS_M_FIFO_FLAG_EMPTY) return 0;
+  if ((fifoWords > 0) && (status & STATUS_M_FIFO_FLAG_HALF_FULL)) return fifoWords/2;
+  if ((almostEmptyWords > 0) && !(status & STATUS_M_FIFO_FLAG_ALMOST_EMPTY)) return almostEmptyWords;
+  return 1;
+}
+
 /***********************/
 /* Function prototypes */
 /***********************/
@@ -204,7 +232,8 @@ class drvSIS3801 : public drvSIS38XX
 /* iocsh functions */
 extern "C" {
 int drvSIS3801Config(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-                     int maxChans, int maxSignals);
+                     int maxChans, int maxSignals, int fifoWords, int fifoAlmostEmptyWords);
+int drvSIS3801SimConfig(const char *portName, int maxChans, int maxSignals, double countRate);
 }
 #endif
 
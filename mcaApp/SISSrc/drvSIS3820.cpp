@@ -16,9 +16,11 @@
 /*********/
 
 /*
- * - Track down problem with FIFO threshold interrupts.  
- *     Works fine with 1024 word threshold down to 100 microsecond dwell time,
- *     below that it messes up, 100% CPU time.
+ * - FIFO threshold interrupts used to give 100% CPU time with a fixed 1024 word
+ *     threshold below 100 microsecond dwell time, because the interrupt rate followed
+ *     the channel rate.  readFIFOThread now sets the threshold from the measured fill
+ *     rate so interrupts come about every DrainPeriod seconds.  This has not yet been
+ *     checked on hardware at the shortest dwell times.
  */
 
 /*******************/
@@ -29,6 +31,8 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <errno.h>
 
 // Needed for memalign on vxWorks
 #ifdef vxWorks
@@ -58,6 +62,7 @@
 #include "devScalerAsyn.h"
 #include "drvSIS3820.h"
 #include "sis3820.h"
+#include "SIS38XXSim.h"
 
 static const char *driverName="drvSIS3820";
 static void intFuncC(void *drvPvt);
@@ -68,69 +73,136 @@ static void dmaCallbackC(void *drvPvt);
 /* Definitions */
 /***************/
 
+/** Simulation of the SIS3820 registers, see SIS38XXSim.h.
+  * irq_control_status_reg is emulated as on the board: writes enable, disable and clear the
+  * interrupt sources, reads return the enabled sources in bits 0-7 and the flags in bits 24-31. */
+class SIS3820Sim : public SIS38XXSim
+{
+  public:
+  SIS3820Sim(const char *portName, int maxSignals, double countRate, SIS38XXSimIntFunc intFunc, void *intPvt)
+    : SIS38XXSim(portName, maxSignals, countRate, sizeof(SIS3820_REGS), SIS3820_FIFO_WORD_SIZE,
+                 intFunc, intPvt),
+      irqEnables_(0), irqFlags_(0)
+  {
+    regs_ = (SIS3820_REGS *)registers();
+    regs_->moduleID_reg = 0x3820010A;
+  }
+
+  protected:
+  void registerWritten(volatile epicsUInt32 *pReg, epicsUInt32 value)
+  {
+    epicsUInt32 lneSource;
+
+    if (pReg == &regs_->key_reset_reg) {
+      stopCounting();
+      clearFIFO();
+      clearCounters();
+      irqEnables_ = 0;
+      irqFlags_ = 0;
+    }
+    else if (pReg == &regs_->key_fifo_reset_reg) {
+      clearFIFO();
+    }
+    else if (pReg == &regs_->key_counter_clear) {
+      clearCounters();
+    }
+    else if (pReg == &regs_->irq_control_status_reg) {
+      irqEnables_ |= value & 0xFF;
+      irqEnables_ &= ~((value >> 8) & 0xFF);
+      irqFlags_ &= ~((value >> 16) & 0xFF);
+    }
+    else if (pReg == &regs_->key_op_disable_reg) {
+      stopCounting();
+    }
+    else if ((pReg == &regs_->key_op_enable_reg) || (pReg == &regs_->key_op_arm_reg)) {
+      if ((regs_->op_mode_reg & SIS3820_OP_MODE_REG_MODE_MASK) == SIS3820_OP_MODE_MULTI_CHANNEL_SCALER) {
+        double lnePeriod = 0.;
+        lneSource = regs_->op_mode_reg & SIS3820_OP_MODE_REG_LNE_MASK;
+        if ((lneSource == SIS3820_LNE_SOURCE_INTERNAL_10MHZ) || (lneSource == SIS3820_LNE_SOURCE_CONTROL_SIGNAL))
+          lnePeriod = (regs_->lne_prescale_factor_reg + 1.) / SIS38XX_SIM_LNE_CLOCK;
+        startCounting(true, lnePeriod, regs_->acq_preset_reg);
+      } else {
+        startCounting(false, 0., 0);
+      }
+    }
+    else if (pReg == &regs_->key_lne_pulse_reg) {
+      channelAdvance();
+    }
+  }
+
+  void updateRegisters()
+  {
+    int i;
+
+    if (counting_ && scalerPresetReached()) {
+      stopCounting();
+      acqDone_ = true;
+    }
+    if (acqDone_) {
+      acqDone_ = false;
+      irqFlags_ |= SIS3820_IRQ_SOURCE2_ENABLE;
+    }
+    // The FIFO threshold and almost full sources are level sensitive
+    irqFlags_ &= ~(SIS3820_IRQ_SOURCE1_ENABLE | SIS3820_IRQ_SOURCE4_ENABLE);
+    if (fifoCount() > (int)regs_->fifo_word_threshold_reg) irqFlags_ |= SIS3820_IRQ_SOURCE1_ENABLE;
+    if (fifoCount() >= fifoWords_/4*3) irqFlags_ |= SIS3820_IRQ_SOURCE4_ENABLE;
+    regs_->irq_control_status_reg = irqEnables_ | (irqFlags_ << 24);
+    regs_->fifo_word_count_reg = fifoCount();
+    regs_->acq_count_reg = chans_;
+    for (i=0; i<maxSignals_; i++)
+      regs_->counter_regs[i] = (epicsUInt32)fmod(counters_[i], 4294967296.);
+  }
+
+  bool interruptPending()
+  {
+    return (regs_->irq_config_reg & SIS3820_IRQ_ENABLE) && (irqFlags_ & irqEnables_);
+  }
+
+  private:
+  bool scalerPresetReached()
+  {
+    int chan;
+
+    if ((regs_->op_mode_reg & SIS3820_OP_MODE_REG_MODE_MASK) != SIS3820_OP_MODE_SCALER) return false;
+    if (regs_->preset_enable_reg & SIS3820_PRESET_STATUS_ENABLE_GROUP1) {
+      chan = regs_->preset_channel_select_reg & SIS3820_FOUR_BIT_MASK;
+      if ((chan < maxSignals_) && (counters_[chan] >= regs_->preset_group1_reg)) return true;
+    }
+    if (regs_->preset_enable_reg & SIS3820_PRESET_STATUS_ENABLE_GROUP2) {
+      chan = (regs_->preset_channel_select_reg >> 16) & SIS3820_FOUR_BIT_MASK;
+      if ((chan < maxSignals_) && (counters_[chan] >= regs_->preset_group2_reg)) return true;
+    }
+    return false;
+  }
+  SIS3820_REGS *regs_;
+  epicsUInt32 irqEnables_;
+  epicsUInt32 irqFlags_;
+};
+
 /*Constructor */
 drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-                       int maxChans, int maxSignals, bool useDma, int fifoBufferWords)
+                       int maxChans, int maxSignals, bool useDma, int fifoBufferWords,
+                       bool simulate, double simCountRate)
   :  drvSIS38XX(portName, maxChans, maxSignals),
-     useDma_(useDma)
+     useDma_(useDma), fifoRate_(0.), fifoLeftover_(0), drainLatency_(0.), drainLatencyMax_(0.),
+     wakeups_(0), intWakeups_(0)
 {
   int status;
-  epicsUInt32 controlStatusReg;
   epicsUInt32 moduleID;
   static const char* functionName="SIS3820";
   
   setIntegerParam(SIS38XXModel_, MODEL_SIS3820);
   
-  /* Call devLib to get the system address that corresponds to the VME
-   * base address of the board.
-   */
-  status = devRegisterAddress("drvSIS3820",
-                               SIS3820_ADDRESS_TYPE,
-                               (size_t)baseAddress,
-                               SIS3820_BOARD_SIZE,
-                               (volatile void **)&registers_);
-
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: %s, Can't register VME address %p\n", 
-              driverName, functionName, portName, baseAddress);
-    return;
-  }
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: Registered VME address: %p to local address: %p size: 0x%X\n", 
-            driverName, functionName, baseAddress, registers_, SIS3820_BOARD_SIZE);
-
-  /* Call devLib to get the system address that corresponds to the VME
-   * FIFO address of the board.
-   */
-  fifoBaseVME_ = (epicsUInt32 *)(baseAddress + SIS3820_FIFO_BASE);
-  status = devRegisterAddress("drvSIS3820",
-                              SIS3820_ADDRESS_TYPE,
-                              (size_t)fifoBaseVME_,
-                              SIS3820_FIFO_BYTE_SIZE,
-                              (volatile void **)&fifoBaseCPU_);
-
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: %s, Can't register FIFO address %p\n", 
-              driverName, functionName, portName, baseAddress + SIS3820_FIFO_BASE);
-    return;
-  }
-
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: Registered VME FIFO address: %p to local address: %p size: 0x%X\n", 
-            driverName, functionName, fifoBaseVME_, 
-            fifoBaseCPU_, SIS3820_FIFO_BYTE_SIZE);
-
-  /* Probe VME bus to see if card is there */
-  status = devReadProbe(4, (char *) &(registers_->control_status_reg),
-                       (char *) &controlStatusReg);
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: devReadProbe failure for address %p = %d\n", 
-              driverName, functionName, &registers_->control_status_reg, status);
-    return;
+  if (simulate) {
+    /* Use the simulator's register file in place of the VME registers */
+    pSim_ = new SIS3820Sim(portName, maxSignals, simCountRate, intFuncC, this);
+    registers_ = (SIS3820_REGS *)pSim_->registers();
+    fifoBaseVME_ = NULL;
+    fifoBaseCPU_ = NULL;
+    useDma_ = false;
+    pSim_->start();
   }
+  else if (mapBoard(baseAddress)) return;
 
   /* Get the module info from the card */
   moduleID = (registers_->moduleID_reg & 0xFFFF0000) >> 16;
@@ -165,11 +237,16 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
     return;
   }
   
+  // The FIFO buffer is divided into SIS3820_DMA_BUFFERS buffers for overlapped DMA.
+  // Keep each one 8-byte aligned.
+  dmaBufferWords_ = (fifoBufferWords_ / SIS3820_DMA_BUFFERS) & ~1;
+  memset(lastCounterRegs_, 0, sizeof(lastCounterRegs_));
+
   dmaDoneEventId_ = epicsEventCreate(epicsEventEmpty);
   // Create the DMA ID
   if (useDma_) {
     dmaId_ = sysDmaCreate(dmaCallbackC, (void*)this);
-    if (dmaId_ == 0 || (int)dmaId_ == -1) {
+    if (dmaId_ == 0 || dmaId_ == (DMA_ID)-1) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s:%s: sysDmaCreate failed, errno=%d. Disabling use of DMA.\n",
                 driverName, functionName, errno);
@@ -181,7 +258,7 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: resetting port %s\n", 
             driverName, functionName, portName);
-  registers_->key_reset_reg = 1;
+  writeRegister(&registers_->key_reset_reg, 1);
 
   /* Clear FIFO */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -190,15 +267,18 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
   resetFIFO();
   
   // Disable 25MHz test pulses and test mode
-  registers_->control_status_reg = CTRL_COUNTER_TEST_25MHZ_DISABLE;
-  registers_->control_status_reg = CTRL_COUNTER_TEST_MODE_DISABLE;
+  writeRegister(&registers_->control_status_reg, CTRL_COUNTER_TEST_25MHZ_DISABLE);
+  writeRegister(&registers_->control_status_reg, CTRL_COUNTER_TEST_MODE_DISABLE);
 
   /* Set up the interrupt service routine */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: interruptServiceRoutine pointer %p\n",
             driverName, functionName, intFuncC);
 
-  status = devConnectInterruptVME(interruptVector, intFuncC, this);
+  if (pSim_)
+    status = 0;
+  else
+    status = devConnectInterruptVME(interruptVector, intFuncC, this);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't connect to vector % d\n", 
@@ -210,15 +290,15 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
             driverName, functionName, interruptVector);
   
   /* Write interrupt level to hardware */
-  registers_->irq_config_reg &= ~SIS3820_IRQ_LEVEL_MASK;
-  registers_->irq_config_reg |= (interruptLevel << 8);
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg & ~SIS3820_IRQ_LEVEL_MASK);
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg | (interruptLevel << 8));
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq after setting IntLevel= 0x%x\n", 
              driverName, functionName, registers_->irq_config_reg);
 
   /* Write interrupt vector to hardware */
-  registers_->irq_config_reg &= ~SIS3820_IRQ_VECTOR_MASK;
-  registers_->irq_config_reg |= interruptVector;
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg & ~SIS3820_IRQ_VECTOR_MASK);
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg | interruptVector);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq = 0x%08x\n", 
             driverName, functionName, registers_->irq_config_reg);
@@ -249,10 +329,13 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
             "%s:%s: irq before enabling interrupts= 0x%08x\n", 
             driverName, functionName, registers_->irq_config_reg);
 
-  registers_->irq_config_reg |= SIS3820_IRQ_ENABLE;
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg | SIS3820_IRQ_ENABLE);
 
   /* Enable interrupt level in EPICS */
-  status = devEnableInterruptLevel(intVME, interruptLevel);
+  if (pSim_)
+    status = 0;
+  else
+    status = devEnableInterruptLevel(intVME, interruptLevel);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't enable enterrupt level %d\n", 
@@ -266,6 +349,67 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
 
 
 
+/** Maps the VME registers and FIFO of the board and checks that it is present */
+int drvSIS3820::mapBoard(int baseAddress)
+{
+  int status;
+  epicsUInt32 controlStatusReg;
+  static const char* functionName="mapBoard";
+
+  /* Call devLib to get the system address that corresponds to the VME
+   * base address of the board.
+   */
+  status = devRegisterAddress("drvSIS3820",
+                               SIS3820_ADDRESS_TYPE,
+                               (size_t)baseAddress,
+                               SIS3820_BOARD_SIZE,
+                               (volatile void **)&registers_);
+
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: %s, Can't register VME address 0x%lX\n", 
+              driverName, functionName, portName, (long)baseAddress);
+    return -1;
+  }
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+            "%s:%s: Registered VME address: 0x%lX to local address: %p size: 0x%X\n", 
+            driverName, functionName, (long)baseAddress, registers_, SIS3820_BOARD_SIZE);
+
+  /* Call devLib to get the system address that corresponds to the VME
+   * FIFO address of the board.
+   */
+  fifoBaseVME_ = (epicsUInt32 *)(size_t)(baseAddress + SIS3820_FIFO_BASE);
+  status = devRegisterAddress("drvSIS3820",
+                              SIS3820_ADDRESS_TYPE,
+                              (size_t)fifoBaseVME_,
+                              SIS3820_FIFO_BYTE_SIZE,
+                              (volatile void **)&fifoBaseCPU_);
+
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: %s, Can't register FIFO address 0x%lX\n", 
+              driverName, functionName, portName, (long)(baseAddress + SIS3820_FIFO_BASE));
+    return -1;
+  }
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+            "%s:%s: Registered VME FIFO address: %p to local address: %p size: 0x%X\n", 
+            driverName, functionName, fifoBaseVME_, 
+            fifoBaseCPU_, SIS3820_FIFO_BYTE_SIZE);
+
+  /* Probe VME bus to see if card is there */
+  status = devReadProbe(4, (char *) &(registers_->control_status_reg),
+                       (char *) &controlStatusReg);
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: devReadProbe failure for address %p = %d\n", 
+              driverName, functionName, &registers_->control_status_reg, status);
+    return -1;
+  }
+
+  return 0;
+}
+
 /* Report  parameters */
 void drvSIS3820::report(FILE *fp, int details)
 {
@@ -308,6 +452,10 @@ void drvSIS3820::report(FILE *fp, int details)
                 "    shadow_regs[%d]            = 0x%x\n",   i, registers_->shadow_regs[i]);         
     for (i=0; i<32; i++) fprintf(fp,
                 "    counter_regs[%d]           = 0x%x\n",   i, registers_->counter_regs[i]);         
+    fprintf(fp, "  DMA buffers:\n");
+    for (i=0; i<SIS3820_DMA_BUFFERS; i++) fprintf(fp,
+                "    buffer %d                  = %p, %d words\n",
+                i, fifoBuffer_ + i*dmaBufferWords_, dmaBufferWords_);
   }
   // Call the base class method
   drvSIS38XX::report(fp, details);
@@ -324,7 +472,8 @@ void drvSIS3820::erase()
   
   /* Erase FIFO and counters on board */
   resetFIFO();
-  registers_->key_counter_clear = 1;
+  writeRegister(&registers_->key_counter_clear, 1);
+  memset(lastCounterRegs_, 0, sizeof(lastCounterRegs_));
 
   return;
 }
@@ -341,38 +490,44 @@ void drvSIS3820::startMCSAcquire()
   setAcquireMode(ACQUIRE_MODE_MCS);
 
   if (channelAdvanceSource == mcaChannelAdvance_Internal) 
-    registers_->key_op_enable_reg = 1;
+    writeRegister(&registers_->key_op_enable_reg, 1);
   else if (channelAdvanceSource == mcaChannelAdvance_External) {
     if (countOnStart)
-      registers_->key_op_enable_reg = 1;
+      writeRegister(&registers_->key_op_enable_reg, 1);
     else
-      registers_->key_op_arm_reg = 1;
+      writeRegister(&registers_->key_op_arm_reg, 1);
   }
 }
 
 void drvSIS3820::stopMCSAcquire()
 {
   /* Turn off hardware acquisition */
-  registers_->key_op_disable_reg = 1;
+  writeRegister(&registers_->key_op_disable_reg, 1);
 }
 
 void drvSIS3820::startScaler()
 {
   setAcquireMode(ACQUIRE_MODE_SCALER);
-  registers_->key_op_enable_reg = 1;
+  writeRegister(&registers_->key_op_enable_reg, 1);
 }
 
 void drvSIS3820::stopScaler()
 {
-  registers_->key_op_disable_reg = 1;
+  writeRegister(&registers_->key_op_disable_reg, 1);
   resetFIFO();
 }
 
 void drvSIS3820::readScalers()
 {
   int i;
+  epicsUInt32 counts;
+
+  // The counters are 32 bits.  Add the change since the last read to the 64-bit scalerData_,
+  // this is correct as long as the scalers are read before a counter wraps twice.
   for (i=0; i<maxSignals_; i++) {
-    scalerData_[i] = registers_->counter_regs[i];
+    counts = readRegister(&registers_->counter_regs[i]);
+    scalerData_[i] += (epicsUInt32)(counts - lastCounterRegs_[i]);
+    lastCounterRegs_[i] = counts;
   }
 }
 
@@ -380,20 +535,21 @@ void drvSIS3820::resetScaler()
 {
   /* Reset scaler */
   setAcquireMode(ACQUIRE_MODE_SCALER);
-  registers_->key_op_disable_reg = 1;
+  writeRegister(&registers_->key_op_disable_reg, 1);
   resetFIFO();
-  registers_->key_counter_clear = 1;
+  writeRegister(&registers_->key_counter_clear, 1);
+  memset(lastCounterRegs_, 0, sizeof(lastCounterRegs_));
 }
 
 
 void drvSIS3820::clearScalerPresets()
 {
-  registers_->preset_channel_select_reg &= ~SIS3820_FOUR_BIT_MASK;
-  registers_->preset_channel_select_reg &= ~(SIS3820_FOUR_BIT_MASK << 16);
-  registers_->preset_enable_reg &= ~SIS3820_PRESET_STATUS_ENABLE_GROUP1;
-  registers_->preset_enable_reg &= ~SIS3820_PRESET_STATUS_ENABLE_GROUP2;
-  registers_->preset_group1_reg = 0;
-  registers_->preset_group2_reg = 0;
+  writeRegister(&registers_->preset_channel_select_reg, registers_->preset_channel_select_reg & ~SIS3820_FOUR_BIT_MASK);
+  writeRegister(&registers_->preset_channel_select_reg, registers_->preset_channel_select_reg & ~(SIS3820_FOUR_BIT_MASK << 16));
+  writeRegister(&registers_->preset_enable_reg, registers_->preset_enable_reg & ~SIS3820_PRESET_STATUS_ENABLE_GROUP1);
+  writeRegister(&registers_->preset_enable_reg, registers_->preset_enable_reg & ~SIS3820_PRESET_STATUS_ENABLE_GROUP2);
+  writeRegister(&registers_->preset_group1_reg, 0);
+  writeRegister(&registers_->preset_group2_reg, 0);
 }
 
 void drvSIS3820::setScalerPresets()
@@ -414,23 +570,23 @@ void drvSIS3820::setScalerPresets()
       getIntegerParam(i, scalerPresets_, &preset);
       if (preset != 0) {
         if (i < 16) {
-          registers_->preset_group1_reg = preset;
+          writeRegister(&registers_->preset_group1_reg, preset);
           /* Enable this bank of counters for preset checking */
-          registers_->preset_enable_reg |= SIS3820_PRESET_STATUS_ENABLE_GROUP1;
+          writeRegister(&registers_->preset_enable_reg, registers_->preset_enable_reg | SIS3820_PRESET_STATUS_ENABLE_GROUP1);
           /* Set the correct channel for checking against the preset value */
           presetChannelSelectRegister = registers_->preset_channel_select_reg;
           presetChannelSelectRegister &= ~SIS3820_FOUR_BIT_MASK;
           presetChannelSelectRegister |= i;
-          registers_->preset_channel_select_reg = presetChannelSelectRegister;
+          writeRegister(&registers_->preset_channel_select_reg, presetChannelSelectRegister);
         } else {
-          registers_->preset_group2_reg = preset;
+          writeRegister(&registers_->preset_group2_reg, preset);
           /* Enable this bank of counters for preset checking */
-          registers_->preset_enable_reg |= SIS3820_PRESET_STATUS_ENABLE_GROUP2;
+          writeRegister(&registers_->preset_enable_reg, registers_->preset_enable_reg | SIS3820_PRESET_STATUS_ENABLE_GROUP2);
           /* Set the correct channel for checking against the preset value */
           presetChannelSelectRegister = registers_->preset_channel_select_reg;
           presetChannelSelectRegister &= ~(SIS3820_FOUR_BIT_MASK << 16);
           presetChannelSelectRegister |= (i << 16);
-          registers_->preset_channel_select_reg = presetChannelSelectRegister;
+          writeRegister(&registers_->preset_channel_select_reg, presetChannelSelectRegister);
         }
       }
     }
@@ -452,9 +608,9 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   getIntegerParam(SIS38XXChannel1Source_, (int*)&channel1Source);
   /* Enable or disable 50 MHz channel 1 reference pulses. */
   if (channel1Source == CHANNEL1_SOURCE_INTERNAL)
-    registers_->control_status_reg |= CTRL_REFERENCE_CH1_ENABLE;
+    writeRegister(&registers_->control_status_reg, registers_->control_status_reg | CTRL_REFERENCE_CH1_ENABLE);
   else
-    registers_->control_status_reg |= CTRL_REFERENCE_CH1_DISABLE;
+    writeRegister(&registers_->control_status_reg, registers_->control_status_reg | CTRL_REFERENCE_CH1_DISABLE);
 
   /* Set the interrupt control register */
   setIrqControlStatusReg();
@@ -473,31 +629,34 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
       clearScalerPresets();
       
       /* Disable channel in MCS mode. We enable the first maxSignals_ inputs */
-      registers_->copy_disable_reg = 0xFFFFFFFF << maxSignals_;
+      writeRegister(&registers_->copy_disable_reg, 0xFFFFFFFF << maxSignals_);
       
       /* Set the number of channels to acquire.  
-       * We could be resuming acquisition so subtract nextChan_ */
-      registers_->acq_preset_reg = nChans - nextChan_;
+       * We could be resuming acquisition so subtract nextChan_.
+       * When streaming or in pre-trigger mode there is no limit. */
+      if (streaming_ || pretrigger_)
+        writeRegister(&registers_->acq_preset_reg, 0);
+      else
+        writeRegister(&registers_->acq_preset_reg, nChans - nextChan_);
 
       /* Set the LNE channel NOTE: This should allow other sources in the future */
-      registers_->lne_channel_select_reg = 0;
+      writeRegister(&registers_->lne_channel_select_reg, 0);
 
       if (channelAdvanceSource == mcaChannelAdvance_Internal) {
         /* The SIS3820 requires the value in the LNE prescale register to be one
          * less than the actual number of incoming signals. We do this adjustment
          * here, so the user sees the actual number at the record level.
          */
-        registers_->op_mode_reg = (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_INTERNAL_10MHZ;
-        registers_->lne_prescale_factor_reg = 
-          (epicsUInt32) (SIS3820_10MHZ_CLOCK * dwellTime) - 1;
+        writeRegister(&registers_->op_mode_reg, (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_INTERNAL_10MHZ);
+        writeRegister(&registers_->lne_prescale_factor_reg, (epicsUInt32) (SIS3820_10MHZ_CLOCK * dwellTime) - 1);
       }
       else if (channelAdvanceSource == mcaChannelAdvance_External) {
         /* The SIS3820 requires the value in the LNE prescale register to be one
          * less than the actual number of incoming signals. We do this adjustment
          * here, so the user sees the actual number at the record level.
          */
-        registers_->op_mode_reg = (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_CONTROL_SIGNAL;
-        registers_->lne_prescale_factor_reg = prescale - 1;
+        writeRegister(&registers_->op_mode_reg, (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_CONTROL_SIGNAL);
+        writeRegister(&registers_->lne_prescale_factor_reg, prescale - 1);
       } 
       else {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -508,13 +667,13 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
       
     case ACQUIRE_MODE_SCALER:
       /* Clear the preset register from MCS mode */
-      registers_->acq_preset_reg = 0;
+      writeRegister(&registers_->acq_preset_reg, 0);
       
       /* Set the LNE channel */
-      registers_->lne_channel_select_reg = 0;
+      writeRegister(&registers_->lne_channel_select_reg, 0);
 
       /* Disable channel in scaler mode. */
-      registers_->count_disable_reg = 0xFFFFFFFF << maxSignals_;
+      writeRegister(&registers_->count_disable_reg, 0xFFFFFFFF << maxSignals_);
 
       break;
   }
@@ -564,7 +723,7 @@ void drvSIS3820::setOpModeReg()
     operationRegister |= SIS3820_HISCAL_START_SOURCE_VME;
     operationRegister |= SIS3820_OP_MODE_SCALER;
   }
-  registers_->op_mode_reg = operationRegister;
+  writeRegister(&registers_->op_mode_reg, operationRegister);
 }
 
 
@@ -576,9 +735,9 @@ void drvSIS3820::softwareChannelAdvance()
   // It appears to be necessary to set the LNE source to VME for this to work
   // Save the current value, clear the bits to set it to VME, restore
   regValue = registers_->op_mode_reg;
-  registers_->op_mode_reg = regValue & ~0xF0;
-  registers_->key_lne_pulse_reg = 1;
-  registers_->op_mode_reg = regValue;
+  writeRegister(&registers_->op_mode_reg, regValue & ~0xF0);
+  writeRegister(&registers_->key_lne_pulse_reg, 1);
+  writeRegister(&registers_->op_mode_reg, regValue);
 }
 
 void drvSIS3820::setInputMode()
@@ -598,9 +757,9 @@ void drvSIS3820::setLED()
   
   getIntegerParam(SIS38XXLED_, &value);
   if (value == 0)
-    registers_->control_status_reg = CTRL_USER_LED_OFF;
+    writeRegister(&registers_->control_status_reg, CTRL_USER_LED_OFF);
   else
-    registers_->control_status_reg = CTRL_USER_LED_ON;
+    writeRegister(&registers_->control_status_reg, CTRL_USER_LED_ON);
 }
 
 int drvSIS3820::getLED()
@@ -637,7 +796,7 @@ void drvSIS3820::setMuxOut()
               driverName, functionName, firmwareVersion_);
     return;
   }
-  registers_->mux_out_channel_select_reg = value - 1;
+  writeRegister(&registers_->mux_out_channel_select_reg, value - 1);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: scalerMuxOutCommand %d\n", 
             driverName, functionName, value);
@@ -664,7 +823,8 @@ void drvSIS3820::setIrqControlStatusReg()
   /* This register is set up the same for ACQUIRE_MODE_MCS and ACQUIRE_MODE_SCALER) */
 
   interruptRegister |= SIS3820_IRQ_SOURCE0_DISABLE;
-  /* NOTE: WE ARE NOT USING FIFO THRESHOLD INTERRUPTS FOR NOW */
+  /* The FIFO threshold interrupt starts disabled.  readFIFOThread sets the threshold and
+   * enables it after each time it reads the FIFO, and intFunc disables it again when it fires. */
   interruptRegister |= SIS3820_IRQ_SOURCE1_DISABLE;
   interruptRegister |= SIS3820_IRQ_SOURCE2_ENABLE;
   interruptRegister |= SIS3820_IRQ_SOURCE3_DISABLE;
@@ -682,7 +842,7 @@ void drvSIS3820::setIrqControlStatusReg()
   interruptRegister |= SIS3820_IRQ_SOURCE6_CLEAR;
   interruptRegister |= SIS3820_IRQ_SOURCE7_CLEAR;
 
-  registers_->irq_control_status_reg = interruptRegister;
+  writeRegister(&registers_->irq_control_status_reg, interruptRegister);
 }
 
 
@@ -708,12 +868,12 @@ void drvSIS3820::dmaCallback()
 
 void drvSIS3820::enableInterrupts()
 {
-  registers_->irq_config_reg |= SIS3820_IRQ_ENABLE;
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg | SIS3820_IRQ_ENABLE);
 }
 
 void drvSIS3820::disableInterrupts()
 {
-  registers_->irq_config_reg &= ~SIS3820_IRQ_ENABLE;
+  writeRegister(&registers_->irq_config_reg, registers_->irq_config_reg & ~SIS3820_IRQ_ENABLE);
 }
 
 
@@ -730,7 +890,7 @@ void drvSIS3820::intFunc()
   disableInterrupts();
 
   /* Test which interrupt source has triggered this interrupt. */
-  irqStatusReg_ = registers_->irq_control_status_reg;
+  irqStatusReg_ = readRegister(&registers_->irq_control_status_reg);
 
   /* Check for the FIFO threshold interrupt */
   if (irqStatusReg_ & SIS3820_IRQ_SOURCE1_FLAG)
@@ -738,7 +898,7 @@ void drvSIS3820::intFunc()
     /* Note that this is a level-sensitive interrupt, not edge sensitive, so it can't be cleared */
     /* Disable this interrupt, since it is caused by FIFO threshold, and that
      * condition is only cleared in the readFIFO routine */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE1_DISABLE;
+    writeRegister(&registers_->irq_control_status_reg, SIS3820_IRQ_SOURCE1_DISABLE);
     eventType_ = EventISR1;
   }
 
@@ -746,7 +906,7 @@ void drvSIS3820::intFunc()
   else if (irqStatusReg_ & SIS3820_IRQ_SOURCE2_FLAG)
   {
     /* Reset the interrupt source */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE2_CLEAR;
+    writeRegister(&registers_->irq_control_status_reg, SIS3820_IRQ_SOURCE2_CLEAR);
     // We only set acquiring_ false in scaler mode, in MCS mode we let checkMCSDone() handle this
     // otherwise we can stop reading the FIFO too soon
     if (acquireMode_ == ACQUIRE_MODE_SCALER) acquiring_ = false;
@@ -762,7 +922,7 @@ void drvSIS3820::intFunc()
      * Note that this is a level-sensitive interrupt, not edge sensitive, so it can't be cleared.
      * Instead we disable the interrupt, and re-enable it at the end of readFIFO.
      */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE4_DISABLE;
+    writeRegister(&registers_->irq_control_status_reg, SIS3820_IRQ_SOURCE4_DISABLE);
     eventType_ = EventISR4;
   }
 
@@ -772,11 +932,144 @@ void drvSIS3820::intFunc()
 
 void drvSIS3820::resetFIFO()
 {
+  // The DMA buffers are only used by readFIFOThread, and are safe without tracking their state:
+  //  - A DMA transfer is only pending while readFIFOThread holds the FIFO lock, so taking the lock
+  //    here waits for it to finish before the FIFO is reset.
+  //  - The last buffer is demultiplexed after the lock is released, so it can still hold data from
+  //    before an erase.  demuxFIFO drops them because epoch_ has changed, and storeFIFOPosition
+  //    only stores the new position if epoch_ has not changed.
   epicsMutexLock(fifoLockId_);
-  registers_->key_fifo_reset_reg= 1;
+  writeRegister(&registers_->key_fifo_reset_reg, 1);
   epicsMutexUnlock(fifoLockId_);
 }  
 
+/** Reads count words from the FIFO with DMA into the DMA buffers.
+  * While one buffer is being transferred the previous one is demultiplexed, so the DMA and
+  * the copy to mcsData_ overlap.  The last buffer is not demultiplexed, its index is returned in
+  * lastBuffer.  The caller demultiplexes it after releasing the FIFO lock.
+  * The earlier buffers are demultiplexed with the FIFO lock held, so erase() and resetFIFO() can
+  * wait up to the time of the whole DMA read, rather than only the transfers.
+  * count is updated to the number of words read, which can be less if there was a DMA error.
+  * epoch is passed to demuxFIFO.
+  * Returns the number of words in the last buffer.
+  * Must be called with the FIFO lock held, so no one can reset the FIFO while a transfer is pending. */
+int drvSIS3820::readFIFODma(int *count, int epoch, int *signal, int *chan, int *lastBuffer)
+{
+  int status;
+  int buffer = 0;
+  int prevBuffer = -1;
+  int prevWords = 0;
+  int remaining = *count;
+  int n;
+  epicsUInt32 *pBuffer;
+  static const char* functionName="readFIFODma";
+
+  while (remaining > 0) {
+    n = remaining;
+    if (n > dmaBufferWords_) n = dmaBufferWords_;
+    pBuffer = fifoBuffer_ + buffer*dmaBufferWords_;
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+              "%s:%s: doing DMA transfer, buffer=%d, pBuffer=%p, fifoBaseVME_=%p, count=%d\n",
+              driverName, functionName, buffer, pBuffer, fifoBaseVME_, n);
+    status = sysDmaFromVme(dmaId_, pBuffer, (epicsUInt32)(size_t)fifoBaseVME_, VME_AM_EXT_SUP_D64BLT, n*sizeof(int), 8);
+    if (status) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s: doing DMA transfer, error calling sysDmaFromVme, status=%d, error=%d, buff=%p, fifoBaseVME_=%p, count=%d\n",
+                driverName, functionName, status, errno, pBuffer, fifoBaseVME_, n);
+      break;
+    }
+    // Demultiplex the previous buffer while this one is transferred
+    if (prevBuffer >= 0) {
+      demuxFIFO(fifoBuffer_ + prevBuffer*dmaBufferWords_, prevWords, epoch, signal, chan);
+    }
+    epicsEventWait(dmaDoneEventId_);
+    status = sysDmaStatus(dmaId_);
+    if (status)
+       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                 "%s:%s: DMA error, errno=%d, message=%s\n",
+                 driverName, functionName, errno, strerror(errno));
+    prevBuffer = buffer;
+    prevWords = n;
+    remaining -= n;
+    buffer = (buffer + 1) % SIS3820_DMA_BUFFERS;
+  }
+  *count -= remaining;
+  *lastBuffer = prevBuffer;
+  return prevWords;
+}
+
+/** Resets the FIFO fill rate estimate and the statistics when acquisition starts.
+  * With internal channel advance the initial fill rate is known from the dwell time.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS3820::resetDrainStatistics()
+{
+  int channelAdvanceSource;
+  double dwellTime;
+
+  getIntegerParam(mcaChannelAdvanceSource_, &channelAdvanceSource);
+  getDoubleParam(mcaDwellTime_, &dwellTime);
+  fifoRate_ = 0.;
+  if ((channelAdvanceSource == mcaChannelAdvance_Internal) && (dwellTime > 0.))
+    fifoRate_ = maxSignals_ / dwellTime;
+  fifoLeftover_ = 0;
+  epicsTimeGetCurrent(&lastDrainTime_);
+  drainLatency_ = 0.;
+  drainLatencyMax_ = 0.;
+  wakeups_ = 0;
+  intWakeups_ = 0;
+}
+
+/** Updates the FIFO fill rate estimate and the drain latency before the FIFO is read.
+  * fifoCount is the FIFO word count now. */
+void drvSIS3820::updateDrainStatistics(int fifoCount, epicsTimeStamp *pNow)
+{
+  double interval = epicsTimeDiffInSeconds(pNow, &lastDrainTime_);
+  int arrived = fifoCount - fifoLeftover_;
+
+  if ((interval > 0.) && (arrived >= 0))
+    fifoRate_ += SIS3820_RATE_WEIGHT * (arrived/interval - fifoRate_);
+  // The oldest words in the FIFO have waited up to the time since the last read
+  if (fifoCount > 0) {
+    drainLatency_ += SIS3820_RATE_WEIGHT * (interval - drainLatency_);
+    if (interval > drainLatencyMax_) drainLatencyMax_ = interval;
+  }
+  lastDrainTime_ = *pNow;
+}
+
+/** Returns the FIFO threshold that gives an interrupt about every DrainPeriod seconds at the
+  * estimated fill rate.  It is at least one channel, so slow scans get each channel promptly,
+  * and it is limited by the readout buffer and to well below the FIFO almost full level.
+  * Must be called with the asynPortDriver lock held. */
+int drvSIS3820::computeFifoThreshold()
+{
+  double drainPeriod;
+  double threshold;
+  int maxThreshold;
+
+  getDoubleParam(SIS38XXDrainPeriod_, &drainPeriod);
+  threshold = fifoRate_ * drainPeriod;
+  maxThreshold = fifoBufferWords_;
+  if (maxThreshold > SIS3820_FIFO_WORD_SIZE/2) maxThreshold = SIS3820_FIFO_WORD_SIZE/2;
+  if (threshold > maxThreshold) threshold = maxThreshold;
+  if (threshold < maxSignals_) threshold = maxSignals_;
+  return (int)threshold;
+}
+
+/** Returns how long readFIFOThread waits for the threshold interrupt.
+  * Must be called with the asynPortDriver lock held. */
+double drvSIS3820::computeDrainWait()
+{
+  double presetReal, elapsedTime;
+  double waitTime = SIS3820_MAX_DRAIN_WAIT;
+
+  // Wake up in time to stop on the preset real time
+  getDoubleParam(mcaPresetRealTime_,  &presetReal);
+  getDoubleParam(mcaElapsedRealTime_, &elapsedTime);
+  if ((presetReal > 0) && (presetReal - elapsedTime < waitTime)) waitTime = presetReal - elapsedTime;
+  if (waitTime < epicsThreadSleepQuantum()) waitTime = epicsThreadSleepQuantum();
+  return waitTime;
+}
+
 void readFIFOThreadC(void *drvPvt)
 {
   drvSIS3820 *pSIS3820 = (drvSIS3820*)drvPvt;
@@ -794,8 +1087,13 @@ void drvSIS3820::readFIFOThread()
   int signal;
   int chan;
   int i;
+  int threshold;
+  int epoch;
+  int demuxCount;
+  int dmaBuffer;
+  epicsUInt32 *pDemux;
+  double waitTime;
   bool acquiring;
-  epicsUInt32 *pIn, *pOut;
   epicsTimeStamp t1, t2, t3;
   static const char* functionName="readFIFOThread";
 
@@ -826,38 +1124,34 @@ void drvSIS3820::readFIFOThread()
       continue;
     }
     acquiring = acquiring_;
+    if (acquiring && (acquireMode_ == ACQUIRE_MODE_MCS)) resetDrainStatistics();
     unlock();
     // MCS mode
     while (acquiring && (acquireMode_ == ACQUIRE_MODE_MCS)) {
       lock();
       signal = nextSignal_;
       chan = nextChan_;
+      epoch = epoch_;
       // This block of code can be slow and does not require the asynPortDriver lock because we are not
       // accessing object data that could change.  
       // It does require the FIFO lock so no one resets the FIFO while it executes
       epicsMutexLock(fifoLockId_);
       unlock();
-      count = registers_->fifo_word_count_reg;
-      if (count > fifoBufferWords_) count = fifoBufferWords_;
+      count = readRegister(&registers_->fifo_word_count_reg);
       epicsTimeGetCurrent(&t1);
-      if (useDma_ && (count >= MIN_DMA_TRANSFERS)) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                  "%s:%s: doing DMA transfer, fifoBuffer=%p, fifoBaseVME_=%p, count=%d\n",
-                  driverName, functionName, fifoBuffer_, fifoBaseVME_, count);
-        status = sysDmaFromVme(dmaId_, fifoBuffer_, (int)fifoBaseVME_, VME_AM_EXT_SUP_D64BLT, (count)*sizeof(int), 8);
-        if (status) {
-          asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s:%s: doing DMA transfer, error calling sysDmaFromVme, status=%d, error=%d, buff=%p, fifoBaseVME_=%p, count=%d\n",
-                    driverName, functionName, status, errno, fifoBuffer_, fifoBaseVME_, count);
-        } 
-        else {
-          epicsEventWait(dmaDoneEventId_);
-          status = sysDmaStatus(dmaId_);
-          if (status)
-             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                       "%s:%s: DMA error, errno=%d, message=%s\n",
-                       driverName, functionName, errno, strerror(errno));
-        }
+      updateDrainStatistics(count, &t1);
+      fifoLeftover_ = count;
+      if (count > fifoBufferWords_) count = fifoBufferWords_;
+      pDemux = fifoBuffer_;
+      demuxCount = count;
+      dmaBuffer = -1;
+      if (pSim_) {
+        count = pSim_->readFIFO(fifoBuffer_, count);
+        demuxCount = count;
+      } else if (useDma_ && (count >= MIN_DMA_TRANSFERS)) {
+        // This demuxes all but the last DMA buffer while the next one is transferred
+        demuxCount = readFIFODma(&count, epoch, &signal, &chan, &dmaBuffer);
+        if (dmaBuffer >= 0) pDemux = fifoBuffer_ + dmaBuffer*dmaBufferWords_;
       } else {    
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                   "%s:%s: programmed transfer, count=%d\n",
@@ -868,55 +1162,59 @@ void drvSIS3820::readFIFOThread()
         for (i=0; i<count; i++)
           fifoBuffer_[i] = fifoBaseCPU_[i];
       }
+      fifoLeftover_ -= count;
       epicsTimeGetCurrent(&t2);
 
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s:%s: read FIFO (%d) in %fs, fifo word count after=%d, fifoBuffer_=%p, fifoBaseCPU_=%p\n",
-                driverName, functionName, count, epicsTimeDiffInSeconds(&t2, &t1), registers_->fifo_word_count_reg, fifoBuffer_, fifoBaseCPU_);
+                driverName, functionName, count, epicsTimeDiffInSeconds(&t2, &t1), readRegister(&registers_->fifo_word_count_reg), fifoBuffer_, fifoBaseCPU_);
       // Release the FIFO lock, we are done accessing the FIFO
       epicsMutexUnlock(fifoLockId_);
       
       // Copy the data from the FIFO buffer to the mcsBuffer
-      pOut = mcsData_ + signal*maxChans_ + chan;
-      pIn = fifoBuffer_;
-      for (i=0; i<count; i++) {
-        *pOut = *pIn++;
-        signal++;
-        if (signal == maxSignals_) {
-          signal = 0;
-          chan++;
-          pOut = mcsData_ + chan;
-        } else {
-          pOut += maxChans_;
-        }
-      }
+      epicsTimeGetCurrent(&t3);
+      demuxFIFO(pDemux, demuxCount, epoch, &signal, &chan);
       
       epicsTimeGetCurrent(&t2);
       // Take the lock since we are now changing object data
       lock();
-      nextChan_ = chan;
-      nextSignal_ = signal;
+      storeFIFOPosition(epoch, signal, chan);
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s:%s: copied data to mcsBuffer in %fs, nextChan=%d, nextSignal=%d\n",
-                driverName, functionName, epicsTimeDiffInSeconds(&t3, &t3), nextChan_, nextSignal_);
+                driverName, functionName, epicsTimeDiffInSeconds(&t2, &t3), nextChan_, nextSignal_);
+
+      /* Set the FIFO threshold for the estimated fill rate, so the next interrupt comes
+       * after about DrainPeriod seconds.  The drain statistics are set here and published by
+       * checkMCSDone with the other status, at most once per CallbackPeriod. */
+      threshold = computeFifoThreshold();
+      setDoubleParam(SIS38XXFifoRate_, fifoRate_);
+      setIntegerParam(SIS38XXFifoThreshold_, threshold);
+      setDoubleParam(SIS38XXDrainLatency_, drainLatency_);
+      setDoubleParam(SIS38XXDrainLatencyMax_, drainLatencyMax_);
+      setIntegerParam(SIS38XXWakeups_, wakeups_);
+      setIntegerParam(SIS38XXIntWakeups_, intWakeups_);
 
       checkMCSDone();
       acquiring = acquiring_;
-      /* Re-enable FIFO threshold and FIFO almost full interrupts */
-      /* NOTE: WE ARE NOT USING FIFO THRESHOLD INTERRUPTS FOR NOW */
-      /* registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE1_ENABLE; */
-      registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE4_ENABLE;
+      // Re-enable the FIFO threshold and FIFO almost full interrupts
+      writeRegister(&registers_->fifo_word_threshold_reg, threshold);
+      writeRegister(&registers_->irq_control_status_reg, SIS3820_IRQ_SOURCE1_ENABLE | SIS3820_IRQ_SOURCE4_ENABLE);
+      waitTime = computeDrainWait();
 
       // Release the lock 
       unlock();
       enableInterrupts();
-      // If we are still acquiring sleep for a short time but wake up on interrupt
+      // If we are still acquiring wait for the threshold interrupt, the timeout catches
+      // the last partial block of data and the preset real time
       if (acquiring) {
-        status = epicsEventWaitWithTimeout(readFIFOEventId_, epicsThreadSleepQuantum());
-        if (status == epicsEventWaitOK) 
+        status = epicsEventWaitWithTimeout(readFIFOEventId_, waitTime);
+        wakeups_++;
+        if (status == epicsEventWaitOK) {
+          intWakeups_++;
           asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
                     "%s:%s: got interrupt in epicsEventWaitWithTimeout, eventType=%d\n",
                     driverName, functionName, eventType_);
+        }
       }
     }
   }
@@ -962,9 +1260,42 @@ static void drvSIS3820ConfigCallFunc(const iocshArgBuf *args)
                    args[4].ival, args[5].ival, args[6].ival, args[7].ival);
 }
 
+int drvSIS3820SimConfig(const char *portName, int maxChans, int maxSignals, int fifoBufferWords,
+                        double countRate)
+{
+  drvSIS3820 *pSIS3820 = new drvSIS3820(portName, 0, 0, 0, maxChans, maxSignals, false, fifoBufferWords,
+                                        true, countRate);
+  pSIS3820 = NULL;
+  return 0;
+}
+
+/* iocsh config function */
+static const iocshArg drvSIS3820SimConfigArg0 = { "Asyn port name",    iocshArgString};
+static const iocshArg drvSIS3820SimConfigArg1 = { "MaxChannels",       iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg2 = { "MaxSignals",        iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg3 = { "FIFO buffer words", iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg4 = { "Count rate",        iocshArgDouble};
+
+static const iocshArg * const drvSIS3820SimConfigArgs[] = 
+{ &drvSIS3820SimConfigArg0,
+  &drvSIS3820SimConfigArg1,
+  &drvSIS3820SimConfigArg2,
+  &drvSIS3820SimConfigArg3,
+  &drvSIS3820SimConfigArg4
+};
+
+static const iocshFuncDef drvSIS3820SimConfigFuncDef = 
+  {"drvSIS3820SimConfig",5,drvSIS3820SimConfigArgs};
+
+static void drvSIS3820SimConfigCallFunc(const iocshArgBuf *args)
+{
+  drvSIS3820SimConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].dval);
+}
+
 void drvSIS3820Register(void)
 {
   iocshRegister(&drvSIS3820ConfigFuncDef,drvSIS3820ConfigCallFunc);
+  iocshRegister(&drvSIS3820SimConfigFuncDef,drvSIS3820SimConfigCallFunc);
 }
 
 epicsExportRegistrar(drvSIS3820Register);
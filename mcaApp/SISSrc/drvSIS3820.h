@@ -25,6 +25,12 @@
 /* Definitions */
 /***************/
 #define MIN_DMA_TRANSFERS   256
+/* Number of buffers the FIFO buffer is divided into, so the DMA of one overlaps the copy of another */
+#define SIS3820_DMA_BUFFERS 2
+
+/* Adaptive FIFO draining */
+#define SIS3820_MAX_DRAIN_WAIT  1.0   /* Longest time readFIFOThread waits for the FIFO threshold interrupt */
+#define SIS3820_RATE_WEIGHT     0.25  /* Weight of the latest measurement in the fill rate and latency averages */
 
 /* FIFO information */
 #define SIS3820_FIFO_BYTE_SIZE    0x800000
@@ -159,7 +165,8 @@ class drvSIS3820 : public drvSIS38XX
 {
   public:
   drvSIS3820(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-             int maxChans, int maxSignals, bool useDma, int fifoBufferWords);
+             int maxChans, int maxSignals, bool useDma, int fifoBufferWords,
+             bool simulate=false, double simCountRate=0.);
 
   // Public methods we override from drvSIS38XX
   void report(FILE *fp, int details);
@@ -194,13 +201,29 @@ class drvSIS3820 : public drvSIS38XX
   int getMuxOut();
 
   private:
+  int mapBoard(int baseAddress);
   void resetFIFO();
+  int readFIFODma(int *count, int epoch, int *signal, int *chan, int *lastBuffer);
   void setOpModeReg();
   void setIrqControlStatusReg();
+  void resetDrainStatistics();
+  void updateDrainStatistics(int fifoCount, epicsTimeStamp *pNow);
+  int computeFifoThreshold();
+  double computeDrainWait();
   SIS3820_REGS *registers_;
   bool useDma_;
   DMA_ID dmaId_;
   epicsEventId dmaDoneEventId_;
+  int dmaBufferWords_;           // Size of each DMA buffer
+  // These are only used by readFIFOThread
+  double fifoRate_;              // Estimated FIFO fill rate, words/s
+  int fifoLeftover_;             // Words left in the FIFO after the last read
+  epicsTimeStamp lastDrainTime_; // Time of the last FIFO read
+  double drainLatency_;          // Average time between FIFO reads that returned data
+  double drainLatencyMax_;
+  int wakeups_;                  // Number of times readFIFOThread woke up during acquisition
+  int intWakeups_;               // Number of those wakeups that were caused by an interrupt
+  epicsUInt32 lastCounterRegs_[SIS38XX_MAX_SIGNALS]; // counter_regs at the last readScalers()
 };
 
 /***********************/
@@ -212,6 +235,8 @@ class drvSIS3820 : public drvSIS38XX
 extern "C" {
 int drvSIS3820Config(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
                      int maxChans, int maxSignals, int useDma, int fifoBufferWords);
+int drvSIS3820SimConfig(const char *portName, int maxChans, int maxSignals, int fifoBufferWords,
+                        double countRate);
 }
 #endif
 
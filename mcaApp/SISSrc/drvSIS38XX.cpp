@@ -19,6 +19,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
 /******************/
 /* EPICS includes */
@@ -41,8 +42,11 @@
 #include "drvMca.h"
 #include "devScalerAsyn.h"
 #include "drvSIS38XX.h"
+#include "SIS38XXDemux.h"
 
 static const char *driverName="drvSIS38XX";
+
+static void scalerRateThreadC(void *drvPvt);
 /***************/
 /* Definitions */
 /***************/
@@ -50,11 +54,17 @@ static const char *driverName="drvSIS38XX";
 /*Constructor */
 drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   :  asynPortDriver(portName, maxSignals, NUM_SIS38XX_PARAMS, 
-                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynDrvUserMask,
-                    asynInt32Mask | asynFloat64Mask,
+                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynFloat64ArrayMask | asynOctetMask | asynDrvUserMask,
+                    asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask,
                     ASYN_MULTIDEVICE, 1, 0, 0),
-     exists_(false), maxSignals_(maxSignals), maxChans_(maxChans),
-     acquiring_(false)
+     exists_(false), maxSignals_(maxSignals), maxChans_(maxChans), epoch_(0),
+     interleaved_(false), mcsExtract_(NULL), extractChan_(0),
+     streaming_(false), streamChans_(0.), streamError_(false),
+     accumulating_(false), sweepSums_(NULL), sweeps_(0), sumChans_(0),
+     pretrigger_(false), triggered_(false), pretriggerChans_(0), posttriggerChans_(0),
+     triggerSignal_(-1), triggerChan_(0.), ringBase_(0.), pendingLaps_(0), binFactor_(1),
+     rateAcquiring_(false), historyPos_(0), historyCount_(0),
+     acquiring_(false), pSim_(NULL)
 {
   int i;
   static const char* functionName="SIS38XX";
@@ -66,6 +76,7 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   createParam(mcaStopAcquireString,                 asynParamInt32, &mcaStopAcquire_);            /* int32, write */
   createParam(mcaEraseString,                       asynParamInt32, &mcaErase_);                  /* int32, write */
   createParam(mcaDataString,                        asynParamInt32, &mcaData_);                   /* int32Array, read/write */
+  createParam(mcaDataNewString,                asynParamInt32Array, &mcaDataNew_);                /* int32Array, read */
   createParam(mcaReadStatusString,                  asynParamInt32, &mcaReadStatus_);             /* int32, write */
   createParam(mcaChannelAdvanceSourceString,        asynParamInt32, &mcaChannelAdvanceSource_);   /* int32, write */
   createParam(mcaNumChannelsString,                 asynParamInt32, &mcaNumChannels_);            /* int32, write */
@@ -102,6 +113,37 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   createParam(SIS38XXCountOnStartString,            asynParamInt32, &SIS38XXCountOnStart_);       /* int32, write */
   createParam(SIS38XXModelString,                   asynParamInt32, &SIS38XXModel_);              /* int32, read */
   createParam(SIS38XXFirmwareString,                asynParamInt32, &SIS38XXFirmware_);           /* int32, read */
+  createParam(SIS38XXInterleavedString,             asynParamInt32, &SIS38XXInterleaved_);        /* int32, write */
+  createParam(SIS38XXStreamString,                  asynParamInt32, &SIS38XXStream_);             /* int32, write */
+  createParam(SIS38XXStreamPathString,              asynParamOctet, &SIS38XXStreamPath_);         /* octet, write */
+  createParam(SIS38XXStreamSegmentChansString,      asynParamInt32, &SIS38XXStreamSegmentChans_); /* int32, write */
+  createParam(SIS38XXStreamSegmentsString,          asynParamInt32, &SIS38XXStreamSegments_);     /* int32, write */
+  createParam(SIS38XXStreamChannelsString,        asynParamFloat64, &SIS38XXStreamChannels_);     /* float64, read */
+  createParam(SIS38XXStreamMessageString,           asynParamOctet, &SIS38XXStreamMessage_);      /* octet, read */
+  createParam(SIS38XXDrainPeriodString,           asynParamFloat64, &SIS38XXDrainPeriod_);        /* float64, write */
+  createParam(SIS38XXFifoRateString,              asynParamFloat64, &SIS38XXFifoRate_);           /* float64, read */
+  createParam(SIS38XXFifoThresholdString,           asynParamInt32, &SIS38XXFifoThreshold_);      /* int32, read */
+  createParam(SIS38XXDrainLatencyString,          asynParamFloat64, &SIS38XXDrainLatency_);       /* float64, read */
+  createParam(SIS38XXDrainLatencyMaxString,       asynParamFloat64, &SIS38XXDrainLatencyMax_);    /* float64, read */
+  createParam(SIS38XXWakeupsString,                 asynParamInt32, &SIS38XXWakeups_);            /* int32, read */
+  createParam(SIS38XXIntWakeupsString,              asynParamInt32, &SIS38XXIntWakeups_);         /* int32, read */
+  createParam(SIS38XXSweepsString,                  asynParamInt32, &SIS38XXSweeps_);             /* int32, read */
+  createParam(SIS38XXSweepSumsString,        asynParamFloat64Array, &SIS38XXSweepSums_);          /* float64Array, read */
+  createParam(SIS38XXPretriggerString,              asynParamInt32, &SIS38XXPretrigger_);         /* int32, write */
+  createParam(SIS38XXPretriggerChansString,         asynParamInt32, &SIS38XXPretriggerChans_);    /* int32, write */
+  createParam(SIS38XXPosttriggerChansString,        asynParamInt32, &SIS38XXPosttriggerChans_);   /* int32, write */
+  createParam(SIS38XXTriggerSignalString,           asynParamInt32, &SIS38XXTriggerSignal_);      /* int32, write */
+  createParam(SIS38XXTriggerString,                 asynParamInt32, &SIS38XXTrigger_);            /* int32, write */
+  createParam(SIS38XXTriggeredString,               asynParamInt32, &SIS38XXTriggered_);          /* int32, read */
+  createParam(SIS38XXScalerCountsString,          asynParamFloat64, &SIS38XXScalerCounts_);       /* float64, read */
+  createParam(SIS38XXScalerRateString,            asynParamFloat64, &SIS38XXScalerRate_);         /* float64, read */
+  createParam(SIS38XXScalerOverflowString,          asynParamInt32, &SIS38XXScalerOverflow_);     /* int32, read */
+  createParam(SIS38XXRatePeriodString,            asynParamFloat64, &SIS38XXRatePeriod_);         /* float64, write */
+  createParam(SIS38XXScalerHistoryString,    asynParamFloat64Array, &SIS38XXScalerHistory_);      /* float64Array, read */
+  createParam(SIS38XXCallbackPeriodString,        asynParamFloat64, &SIS38XXCallbackPeriod_);     /* float64, write */
+  createParam(SIS38XXBinFactorString,               asynParamInt32, &SIS38XXBinFactor_);          /* int32, write */
+  createParam(SIS38XXAllDataString,            asynParamInt32Array, &SIS38XXAllData_);            /* int32Array, read */
+  createParam(SIS38XXAllChansString,                asynParamInt32, &SIS38XXAllChans_);           /* int32, read */
 
   /* Allocate sufficient memory space to hold all of the data collected from the
    * SIS38XX.
@@ -114,14 +156,28 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
     return;
   }
   
-  scalerData_ = (epicsUInt32 *)calloc(maxSignals, sizeof(epicsUInt32));
-  if (scalerData_ == NULL) {
+  scalerData_ = (epicsUInt64 *)calloc(maxSignals, sizeof(epicsUInt64));
+  rateCounts_ = (epicsUInt64 *)calloc(maxSignals, sizeof(epicsUInt64));
+  if ((scalerData_ == NULL) || (rateCounts_ == NULL)) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: malloc failure for scalerData_\n", 
               driverName, functionName);
     return;
   }
 
+  scalerHistory_ = (epicsFloat64 *)calloc(maxSignals*SIS38XX_SCALER_HISTORY_SIZE, sizeof(epicsFloat64));
+  historyBuffer_ = (epicsFloat64 *)calloc(SIS38XX_SCALER_HISTORY_SIZE, sizeof(epicsFloat64));
+  if ((scalerHistory_ == NULL) || (historyBuffer_ == NULL)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: malloc failure for scalerHistory_\n", 
+              driverName, functionName);
+    return;
+  }
+
+  pStream_ = new SIS38XXStream();
+  streamLockId_ = epicsMutexCreate();
+  demuxLockId_ = epicsMutexCreate();
+
   /* Initialise the pointers to the start of the buffer area */
   nextChan_ = 0;
   nextSignal_ = 0;
@@ -141,6 +197,31 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   setIntegerParam(SIS38XXInputMode_, 3);
   setIntegerParam(SIS38XXOutputMode_, 0);
   setIntegerParam(SIS38XXMaxChannels_, maxChans_);
+  setIntegerParam(SIS38XXInterleaved_, 0);
+  setIntegerParam(SIS38XXStream_, 0);
+  setStringParam(SIS38XXStreamPath_, "");
+  setIntegerParam(SIS38XXStreamSegmentChans_, maxChans);
+  setIntegerParam(SIS38XXStreamSegments_, 10);
+  setDoubleParam(SIS38XXStreamChannels_, 0.0);
+  setStringParam(SIS38XXStreamMessage_, "");
+  setDoubleParam(SIS38XXDrainPeriod_, 0.1);
+  setDoubleParam(SIS38XXFifoRate_, 0.0);
+  setIntegerParam(SIS38XXFifoThreshold_, 0);
+  setDoubleParam(SIS38XXDrainLatency_, 0.0);
+  setDoubleParam(SIS38XXDrainLatencyMax_, 0.0);
+  setIntegerParam(SIS38XXWakeups_, 0);
+  setIntegerParam(SIS38XXIntWakeups_, 0);
+  setIntegerParam(SIS38XXSweeps_, 0);
+  setIntegerParam(SIS38XXPretrigger_, 0);
+  setIntegerParam(SIS38XXPretriggerChans_, maxChans/2);
+  setIntegerParam(SIS38XXPosttriggerChans_, maxChans/2);
+  setIntegerParam(SIS38XXTriggerSignal_, -1);
+  setIntegerParam(SIS38XXTriggered_, 0);
+  setDoubleParam(SIS38XXRatePeriod_, 1.0);
+  setDoubleParam(SIS38XXCallbackPeriod_, 0.1);
+  setIntegerParam(SIS38XXBinFactor_, 1);
+  setIntegerParam(SIS38XXAllChans_, 0);
+  epicsTimeGetCurrent(&callbackTime_);
   elapsedPrevious_ = 0.;
   for (i=0; i<maxSignals; i++) {
     setIntegerParam(i, mcaChannelAdvanceSource_, mcaChannelAdvance_Internal);
@@ -150,8 +231,23 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
     setDoubleParam(i, mcaElapsedRealTime_, 0.0);
     setDoubleParam(i, mcaElapsedLiveTime_, 0.0);
     setIntegerParam(i, scalerPresets_, 0);
+    setDoubleParam(i, SIS38XXScalerCounts_, 0.0);
+    setDoubleParam(i, SIS38XXScalerRate_, 0.0);
+    setIntegerParam(i, SIS38XXScalerOverflow_, 0);
     callParamCallbacks(i);
   }
+
+  /* Create the thread that computes the scaler rates.  It does nothing until the derived
+   * class constructor sets exists_. */
+  if (epicsThreadCreate("SIS38XXRateThread",
+                         epicsThreadPriorityLow,
+                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                         (EPICSTHREADFUNC)scalerRateThreadC,
+                         this) == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: epicsThreadCreate failure for rate thread\n", 
+              driverName, functionName);
+  }
   
   return;
 }
@@ -164,6 +260,8 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
   int signal;
   int i;
   int nChans;
+  int presetSweeps;
+  bool triggered;
   asynStatus status=asynError;
   static const char* functionName = "writeInt32";
 
@@ -187,13 +285,52 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
       goto done;
     }
     // If we have already completed acquisition due to nextChan_, don't start, signal error
-    if (nextChan_ >= nChans) {
+    // When streaming nextChan_ is the position in the ring buffer, so there is no limit.
+    // In pre-trigger mode acquisition is complete once there has been a trigger.
+    epicsMutexLock(demuxLockId_);
+    triggered = triggered_;
+    epicsMutexUnlock(demuxLockId_);
+    if ((!streaming_ && !pretrigger_ && (nextChan_ >= nChans)) || (pretrigger_ && triggered)) {
         // Must toggle mcaAcquiring to 1 and back to 0 to signal SNL program to clear Acquiring
       setIntegerParam(mcaAcquiring_, 1);
       callParamCallbacks();
       setIntegerParam(mcaAcquiring_, 0);
       goto done;
     }
+    // Start a new set of stream files if the data were erased
+    if (streaming_ && !pStream_->isOpen()) {
+      if (openStream()) goto done;
+    }
+    // With PresetSweeps > 1 the sweeps are added to sweepSums_, and acquisition is restarted
+    // at the end of each sweep.  This is not done when streaming.
+    getIntegerParam(mcaPresetSweeps_, &presetSweeps);
+    accumulating_ = (presetSweeps > 1) && !streaming_ && !pretrigger_;
+    if (accumulating_ && (sweepSums_ == NULL)) {
+      sweepSums_ = (epicsUInt64 *)calloc(maxSignals_*maxChans_, sizeof(epicsUInt64));
+      if (sweepSums_ == NULL) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s:%s: malloc failure for sweepSums_\n", 
+                  driverName, functionName);
+        accumulating_ = false;
+        goto done;
+      }
+    }
+    if (pretrigger_) {
+      // The pre-trigger and post-trigger channels must fit in nChans
+      getIntegerParam(SIS38XXPretriggerChans_, &pretriggerChans_);
+      getIntegerParam(SIS38XXPosttriggerChans_, &posttriggerChans_);
+      getIntegerParam(SIS38XXTriggerSignal_, &triggerSignal_);
+      if (posttriggerChans_ < 1) posttriggerChans_ = 1;
+      if (posttriggerChans_ > nChans) posttriggerChans_ = nChans;
+      if (pretriggerChans_ < 0) pretriggerChans_ = 0;
+      if (pretriggerChans_ > nChans - posttriggerChans_) {
+        pretriggerChans_ = nChans - posttriggerChans_;
+        asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+                  "%s:%s: pre-trigger + post-trigger channels too large, pre-trigger channels=%d\n",
+                  driverName, functionName, pretriggerChans_);
+      }
+      if (triggerSignal_ >= maxSignals_) triggerSignal_ = -1;
+    }
     acquiring_ = true;
     setIntegerParam(mcaAcquiring_, 1);
     erased_ = 0;
@@ -240,6 +377,7 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
     /* If device was acquiring, turn it back on */
     if (acquiring_) {
+      if (streaming_) openStream();
       startMCSAcquire();
       erased_ = 0;
     }
@@ -250,12 +388,14 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
      * This is the number of channels that are to be acquired. Channels
      * correspond to time bins or external channel advance triggers, as
      * opposed to the 32 input signals that the SIS38XX supports.
+     * With binning mcsData_ holds maxChans_ bins, so up to maxChans_*binFactor_ channels
+     * can be acquired.
      */
-    if (value > maxChans_) {
-      setIntegerParam(mcaNumChannels_, maxChans_);
+    if (value > maxChans_*binFactor_) {
+      setIntegerParam(mcaNumChannels_, maxChans_*binFactor_);
       asynPrint(pasynUser, ASYN_TRACE_ERROR, 
                 "%s:%s:  # channels=%d too large, max=%d\n",
-                driverName, functionName, nChans, maxChans_);
+                driverName, functionName, nChans, maxChans_*binFactor_);
     }
   }
 
@@ -266,10 +406,13 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
     resetScaler();
     acquiring_ = false;
     /* Clear all of the presets and counts*/
+    epicsMutexLock(fifoLockId_);
     for (i=0; i<maxSignals_; i++) {
       scalerData_[i] = 0;
       setIntegerParam(i, scalerPresets_, 0);
     }
+    epicsMutexUnlock(fifoLockId_);
+    resetScalerRates();
   }
 
   else if (command == scalerArm_) {
@@ -279,6 +422,7 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
       setScalerPresets();
       startScaler();
       acquiring_ = true;
+      resetScalerRates();
     } else {
       stopScaler();
     }
@@ -308,6 +452,87 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
     setOutputMode();
   }
 
+  else if (command == SIS38XXInterleaved_) {
+    /* The storage order can only be changed when not acquiring, and the data are erased */
+    if (acquiring_ || (value && (streaming_ || pretrigger_ || (binFactor_ > 1)))) {
+      setIntegerParam(SIS38XXInterleaved_, interleaved_);
+      goto done;
+    }
+    if (value && (mcsExtract_ == NULL)) {
+      mcsExtract_ = (epicsUInt32 *)calloc(maxSignals_*maxChans_, sizeof(epicsUInt32));
+      if (mcsExtract_ == NULL) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s:%s: malloc failure for mcsExtract_\n", 
+                  driverName, functionName);
+        setIntegerParam(SIS38XXInterleaved_, 0);
+        goto done;
+      }
+    }
+    interleaved_ = (value != 0);
+    erased_ = 0;
+    erase();
+  }
+
+  else if (command == SIS38XXStream_) {
+    /* Streaming can only be changed when not acquiring, and the data are erased.
+     * The files are opened when acquisition is started. */
+    if (acquiring_ || (value && (interleaved_ || pretrigger_ || (binFactor_ > 1)))) {
+      setIntegerParam(SIS38XXStream_, streaming_);
+      goto done;
+    }
+    streaming_ = (value != 0);
+    erased_ = 0;
+    erase();
+  }
+
+  else if (command == SIS38XXPretrigger_) {
+    /* Pre-trigger mode can only be changed when not acquiring, and the data are erased */
+    if (acquiring_ || (value && (interleaved_ || streaming_ || (binFactor_ > 1)))) {
+      setIntegerParam(SIS38XXPretrigger_, pretrigger_);
+      goto done;
+    }
+    pretrigger_ = (value != 0);
+    erased_ = 0;
+    erase();
+  }
+
+  else if (command == SIS38XXBinFactor_) {
+    /* The binning factor can only be changed when not acquiring, and the data are erased.
+     * mcsData_ is not reallocated, the binned data use the first nChans/binFactor channels. */
+    if (value < 1) value = 1;
+    if (acquiring_ || ((value > 1) && (interleaved_ || streaming_ || pretrigger_))) {
+      setIntegerParam(SIS38XXBinFactor_, binFactor_);
+      goto done;
+    }
+    binFactor_ = value;
+    setIntegerParam(SIS38XXBinFactor_, binFactor_);
+    // A smaller factor can leave more channels than the bins in mcsData_
+    if (nChans > maxChans_*binFactor_) {
+      setIntegerParam(mcaNumChannels_, maxChans_*binFactor_);
+      asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+                "%s:%s:  # channels=%d too large for bin factor %d, max=%d\n",
+                driverName, functionName, nChans, binFactor_, maxChans_*binFactor_);
+    }
+    erased_ = 0;
+    erase();
+  }
+
+  else if (command == SIS38XXTrigger_) {
+    /* Software trigger.  The channels already read from the FIFO are before the trigger. */
+    if (!pretrigger_ || !acquiring_) goto done;
+    // demuxFIFO can set triggered_ from the trigger signal at the same time
+    epicsMutexLock(demuxLockId_);
+    if (!triggered_) {
+      triggerChan_ = ringBase_ + nextChan_;
+      triggered_ = true;
+      setIntegerParam(SIS38XXTriggered_, 1);
+      asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+                "%s:%s: software trigger at channel %.0f\n", 
+                driverName, functionName, triggerChan_);
+    }
+    epicsMutexUnlock(demuxLockId_);
+  }
+
   status = asynSuccess;
   done:
   callParamCallbacks(signal);
@@ -321,6 +546,7 @@ asynStatus drvSIS38XX::readInt32(asynUser *pasynUser, epicsInt32 *value)
   int command = pasynUser->reason;
   asynStatus status=asynSuccess;
   int signal;
+  epicsUInt64 counts[SIS38XX_MAX_SIGNALS];
   static const char* functionName="readInt32";
 
   if (!exists_) return asynError;
@@ -332,8 +558,10 @@ asynStatus drvSIS38XX::readInt32(asynUser *pasynUser, epicsInt32 *value)
 
   if (command == scalerRead_) {
     readScalers();
-    /* Read a single scaler channel */
-    *value = scalerData_[signal];
+    copyScalerData(counts);
+    /* Read a single scaler channel.  This is the low 32 bits, SIS38XX_SCALER_OVERFLOW is set
+     * when the count no longer fits. */
+    *value = (epicsInt32)counts[signal];
   }
   else if (command == SIS38XXLED_) {
     *value = getLED();
@@ -347,6 +575,18 @@ asynStatus drvSIS38XX::readInt32(asynUser *pasynUser, epicsInt32 *value)
   return status;
 }
 
+asynStatus drvSIS38XX::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
+{
+  int command = pasynUser->reason;
+
+  if (!exists_) return asynError;
+
+  /* The elapsed times are the same for all signals, checkMCSDone only sets them for signal 0 */
+  if ((command == mcaElapsedRealTime_) || (command == mcaElapsedLiveTime_))
+    return getDoubleParam(command, value);
+  return asynPortDriver::readFloat64(pasynUser, value);
+}
+
 
 
 asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data, 
@@ -356,6 +596,7 @@ asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
   int command = pasynUser->reason;
   asynStatus status = asynSuccess;
   size_t i;
+  epicsUInt64 counts[SIS38XX_MAX_SIGNALS];
   static const char* functionName="readInt32Array";
 
   if (!exists_) return asynError;
@@ -374,22 +615,78 @@ asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
     int numCopy;
     getIntegerParam(mcaNumChannels_, &nChans);
     numCopy = numRead;
-    if (numCopy > nChans) numCopy = nChans;
-    // We copy all the channels but we only report nchans
-    // This ensures the entire array is correct even if it was not set to zero at the start
-    memcpy(data, mcsData_ + signal*maxChans_, numCopy*sizeof(epicsInt32));
-    *numActual = numRead;
-    if ((int)*numActual > nextChan_) *numActual = nextChan_;
+    if (numCopy > binnedChans(nChans)) numCopy = binnedChans(nChans);
+    *numActual = readSignal(signal, data, numCopy);
     // Make it set NORD non-zero?
     if (*numActual == 0) *numActual = 1;
     asynPrint(pasynUser, ASYN_TRACE_FLOW, 
               "%s:%s: [signal=%d]: read %d chans (numRead=%d, numCopy=%d, nextChan=%d, nChans=%d)\n",  
               driverName, functionName, signal, *numActual, numRead, numCopy, nextChan_, nChans);
     }
+  else if (command == SIS38XXAllData_) {
+    /* All signals at once, signal-major with the same number of channels for each signal.
+     * The lock is held for the whole copy, so all signals are from the same instant. */
+    int nChans;
+    int numCopy;
+    getIntegerParam(mcaNumChannels_, &nChans);
+    numCopy = numRead / maxSignals_;
+    if (numCopy > binnedChans(nChans)) numCopy = binnedChans(nChans);
+    for (i=0; i<(size_t)maxSignals_; i++) {
+      readSignal(i, data + i*numCopy, numCopy);
+    }
+    *numActual = maxSignals_*numCopy;
+    if (*numActual == 0) *numActual = 1;
+    setIntegerParam(SIS38XXAllChans_, numCopy);
+    callParamCallbacks();
+    asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+              "%s:%s: read %d chans for %d signals (numRead=%d, nextChan=%d, nChans=%d)\n",  
+              driverName, functionName, numCopy, maxSignals_, (int)numRead, nextChan_, nChans);
+    }
+  else if (command == mcaDataNew_) {
+    /* Transfer only the channels that have been acquired since this client last read */
+    mcaDataCursor *pCursor = (mcaDataCursor *)pasynUser->drvUser;
+    epicsUInt32 *pData = mcsData_;
+    int lastChan;
+    if (pCursor == NULL) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: no read cursor for MCA_DATA_NEW\n",
+                driverName, functionName);
+      return asynError;
+    }
+    if (streaming_ || pretrigger_) {
+      // The channels move through the ring buffer, so always return the whole window
+      pCursor->firstChan = 0;
+      pCursor->epoch = epoch_;
+      if (streaming_)
+        *numActual = readStreamWindow(signal, data, numRead);
+      else
+        *numActual = readPretriggerWindow(signal, data, numRead);
+      return asynSuccess;
+    }
+    // With binning only complete bins are returned while acquiring, a partial bin is still changing
+    lastChan = acquiring_ ? nextChan_/binFactor_ : binnedChans(nextChan_);
+    if ((pCursor->epoch != epoch_) || (pCursor->nextChan > lastChan)) pCursor->nextChan = 0;
+    pCursor->epoch = epoch_;
+    pCursor->firstChan = pCursor->nextChan;
+    if (lastChan > (int)numRead) lastChan = numRead;
+    if (lastChan < pCursor->firstChan) lastChan = pCursor->firstChan;
+    if (interleaved_) {
+      extractSignals();
+      pData = mcsExtract_;
+    }
+    memcpy(data, pData + signal*maxChans_ + pCursor->firstChan, 
+           (lastChan - pCursor->firstChan)*sizeof(epicsInt32));
+    *numActual = lastChan - pCursor->firstChan;
+    pCursor->nextChan = lastChan;
+    asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+              "%s:%s: [signal=%d]: read new chans %d to %d (numRead=%d, nextChan=%d)\n",  
+              driverName, functionName, signal, pCursor->firstChan, lastChan, (int)numRead, nextChan_);
+  }
   else if (command == scalerRead_) {
     readScalers();
+    copyScalerData(counts);
     for (i=0; (i<numRead && i<(size_t)maxSignals_); i++) {
-      data[i] = scalerData_[i];
+      data[i] = (epicsInt32)counts[i];
     }
     for (i=maxSignals_; i<numRead; i++) {
       data[i] = 0;
@@ -408,10 +705,89 @@ asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
   return status;
 }
 
+asynStatus drvSIS38XX::readFloat64Array(asynUser *pasynUser, epicsFloat64 *data, 
+                                        size_t numRead, size_t *numActual)
+{
+  int signal;
+  int command = pasynUser->reason;
+  int nChans;
+  int numCopy;
+  int numValid;
+  int i;
+  epicsUInt64 *pSums;
+  static const char* functionName="readFloat64Array";
+
+  if (!exists_) return asynError;
+
+  if (command == SIS38XXScalerHistory_) {
+    pasynManager->getAddr(pasynUser, &signal);
+    *numActual = readScalerHistory(signal, data, numRead);
+    return asynSuccess;
+  }
+
+  if (command != SIS38XXSweepSums_) 
+    return asynPortDriver::readFloat64Array(pasynUser, data, numRead, numActual);
+
+  pasynManager->getAddr(pasynUser, &signal);
+  getIntegerParam(mcaNumChannels_, &nChans);
+  numCopy = numRead;
+  if (numCopy > binnedChans(nChans)) numCopy = binnedChans(nChans);
+  // The sums are stored rather than added in the first sweep after an erase, so until one
+  // sweep is complete only the channels before nextChan_ are valid.  After that only the
+  // channels that every completed sweep acquired are valid, the rest can be from before the
+  // erase if NumChannels was increased between sweeps.
+  if (sweepSums_ == NULL) {
+    numValid = 0;
+  } else if (sweeps_ > 0) {
+    numValid = binnedChans(sumChans_);
+    if (numValid > numCopy) numValid = numCopy;
+  } else {
+    numValid = nextChan_;
+    if (signal < nextSignal_) numValid++;
+    numValid = binnedChans(numValid);
+    if (numValid > numCopy) numValid = numCopy;
+  }
+  if (sweepSums_) {
+    pSums = sweepSums_ + signal*maxChans_;
+    for (i=0; i<numValid; i++) data[i] = (epicsFloat64)pSums[i];
+  }
+  for (i=numValid; i<numCopy; i++) data[i] = 0.;
+  *numActual = numCopy;
+  if (*numActual == 0) *numActual = 1;
+  asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+            "%s:%s: [signal=%d]: read %d chans of sums, sweeps=%d\n",  
+            driverName, functionName, signal, numValid, sweeps_);
+  return asynSuccess;
+}
+
+/** Allocates a read cursor for each client that uses MCA_DATA_NEW */
+asynStatus drvSIS38XX::drvUserCreate(asynUser *pasynUser, const char *drvInfo, 
+                                     const char **pptypeName, size_t *psize)
+{
+  asynStatus status;
+  
+  status = asynPortDriver::drvUserCreate(pasynUser, drvInfo, pptypeName, psize);
+  if ((status == asynSuccess) && (pasynUser->reason == mcaDataNew_)) {
+    pasynUser->drvUser = calloc(1, sizeof(mcaDataCursor));
+    if (pasynUser->drvUser == NULL) status = asynError;
+  }
+  return status;
+}
+
+asynStatus drvSIS38XX::drvUserDestroy(asynUser *pasynUser)
+{
+  if ((pasynUser->reason == mcaDataNew_) && pasynUser->drvUser) {
+    free(pasynUser->drvUser);
+    pasynUser->drvUser = NULL;
+  }
+  return asynPortDriver::drvUserDestroy(pasynUser);
+}
+
 /* Report  parameters */
 void drvSIS38XX::report(FILE *fp, int details)
 {
   int i, nprint;
+  epicsUInt64 counts[SIS38XX_MAX_SIGNALS];
   if (details > 0) {
     fprintf(fp, "  acquire mode     = %d\n",   acquireMode_);
     fprintf(fp, "  max signals      = %d\n",   maxSignals_);
@@ -420,13 +796,30 @@ void drvSIS38XX::report(FILE *fp, int details)
     fprintf(fp, "  next signal      = %d\n",   nextSignal_);
     fprintf(fp, "  elapsed previous = %f\n",   elapsedPrevious_);
     fprintf(fp, "  erased           = %d\n",   erased_);
+    fprintf(fp, "  epoch            = %d\n",   epoch_);
     fprintf(fp, "  acquiring        = %d\n",   acquiring_);
+    fprintf(fp, "  interleaved      = %d\n",   interleaved_);
+    fprintf(fp, "  streaming        = %d\n",   streaming_);
+    fprintf(fp, "  bin factor       = %d\n",   binFactor_);
+    fprintf(fp, "  stream channels  = %.0f\n", streamChans_);
+    fprintf(fp, "  stream segment   = %d\n",   pStream_->sequence());
+    fprintf(fp, "  accumulating     = %d\n",   accumulating_);
+    fprintf(fp, "  sweeps           = %d\n",   sweeps_);
+    fprintf(fp, "  sum channels     = %d\n",   sumChans_);
+    fprintf(fp, "  pre-trigger      = %d\n",   pretrigger_);
+    epicsMutexLock(demuxLockId_);
+    fprintf(fp, "  triggered        = %d\n",   triggered_);
+    fprintf(fp, "  trigger channel  = %.0f\n", triggerChan_);
+    fprintf(fp, "  ring base        = %.0f\n", ringBase_);
+    epicsMutexUnlock(demuxLockId_);
     nprint = maxChans_;
     if (nprint > 10) nprint = 10;
     for (i=0; i<nprint; i++) fprintf(fp,
                 "    mcsData[%d]    = %d\n", i, mcsData_[i]);             
+    copyScalerData(counts);
     for (i=0; i<maxSignals_; i++) fprintf(fp,
-                "    scalerData[%d] = %d\n", i, scalerData_[i]);         
+                "    scalerData[%d] = %llu\n", i, (unsigned long long)counts[i]);         
+    if (pSim_) pSim_->report(fp, details);
   }
   // Call the base class method
   asynPortDriver::report(fp, details);
@@ -435,9 +828,7 @@ void drvSIS38XX::report(FILE *fp, int details)
 void drvSIS38XX::erase()
 {
   int i;
-  epicsTimeStamp begin, end;
   static const char *functionName="erase";
-  int nChans;
 
   /* If we are already erased return */
   if (erased_) {
@@ -448,18 +839,41 @@ void drvSIS38XX::erase()
   }
   erased_ = 1;
 
-  getIntegerParam(mcaNumChannels_, &nChans);
-  epicsTimeGetCurrent(&begin);
-  /* Erase buffer in driver */
-  memset(mcsData_, 0, maxSignals_ * nChans * sizeof(epicsUInt32));
-  epicsTimeGetCurrent(&end);
+  /* The buffer in the driver is not cleared, that would take too long with large buffers.
+   * A new epoch starts, and only the channels before nextChan_ are valid.  Readers zero the
+   * rest, and MCA_DATA_NEW clients start again at channel 0 when the epoch changes.
+   * demuxFIFO drops the words that readFIFOThread read before the erase. */
+  epicsMutexLock(demuxLockId_);
+  epoch_++;
+  /* Wait for a new trigger.  This is done with the new epoch so demuxFIFO does not
+   * add ring wraps or a trigger from the old data. */
+  triggered_ = false;
+  ringBase_ = 0.;
+  pendingLaps_ = 0;
+  epicsMutexUnlock(demuxLockId_);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: cleared local buffer (%d) in %fs\n",
-            driverName, functionName, maxSignals_*nChans, epicsTimeDiffInSeconds(&end, &begin));
+            "%s:%s: starting epoch %d, previous epoch had %d channels\n",
+            driverName, functionName, epoch_, nextChan_);
 
   /* Reset pointers to start of buffer */
   nextChan_ = 0;
   nextSignal_ = 0;
+  extractChan_ = 0;
+
+  /* The next sweep is stored in sweepSums_ rather than added, so they do not need to be cleared */
+  sweeps_ = 0;
+  sumChans_ = 0;
+  setIntegerParam(SIS38XXSweeps_, 0);
+
+  setIntegerParam(SIS38XXTriggered_, 0);
+
+  /* Finish the current set of stream files, the next acquisition starts a new set */
+  epicsMutexLock(streamLockId_);
+  pStream_->close();
+  streamError_ = false;
+  epicsMutexUnlock(streamLockId_);
+  streamChans_ = 0.;
+  setDoubleParam(SIS38XXStreamChannels_, 0.0);
 
   /* Reset the elapsed time and counts */
   elapsedPrevious_ = 0.;
@@ -480,12 +894,430 @@ void drvSIS38XX::erase()
 }
 
 
+/** Reads a board register.  With the simulator the read goes through the simulator, because
+  * the simulator thread updates the status registers.  Only those registers need to use this. */
+epicsUInt32 drvSIS38XX::readRegister(volatile epicsUInt32 *pReg)
+{
+  if (pSim_)
+    return pSim_->readRegister(pReg);
+  return *pReg;
+}
+
+/** Writes value to a board register.  With the simulator the write goes through the simulator,
+  * which acts on it as the board would. */
+void drvSIS38XX::writeRegister(volatile epicsUInt32 *pReg, epicsUInt32 value)
+{
+  if (pSim_)
+    pSim_->writeRegister(pReg, value);
+  else
+    *pReg = value;
+}
+
+
+/** Copy count words read from the FIFO into mcsData_.
+  * signal and chan are the position of the first word, and are updated.
+  * epoch is the value of epoch_ when readFIFOThread read the position.  If the data have been
+  * erased since then the words are from before the erase, and are dropped.
+  * This is called from readFIFOThread without the asynPortDriver lock. */
+void drvSIS38XX::demuxFIFO(const epicsUInt32 *pIn, int count, int epoch, int *signal, int *chan)
+{
+  int offset;
+  int n;
+  int sumSignal, sumChan;
+
+  epicsMutexLock(demuxLockId_);
+  if (epoch != epoch_) goto done;
+
+  if (accumulating_) {
+    sumSignal = *signal;
+    sumChan = *chan;
+    SIS38XXAccumulate(sweepSums_, maxChans_, maxSignals_, binFactor_, pIn, count, &sumSignal, &sumChan,
+                      sweeps_ == 0);
+  }
+
+  if (streaming_ || pretrigger_) {
+    if (streaming_) {
+      epicsMutexLock(streamLockId_);
+      // The SIS3801 starts again at signal 0 when acquisition is resumed
+      if (*signal == 0) pStream_->discardPartialChannel();
+      if (pStream_->write(pIn, count)) streamError_ = true;
+      epicsMutexUnlock(streamLockId_);
+    } else {
+      count = pretriggerCount(pIn, count, *signal, *chan);
+    }
+    // mcsData_ is a ring buffer of the last maxChans_ channels
+    while (count > 0) {
+      n = SIS38XXDemux(mcsData_, maxChans_, maxSignals_, pIn, count, signal, chan);
+      pIn += n;
+      count -= n;
+      if (*chan == maxChans_) {
+        *chan = 0;
+        pendingLaps_++;
+      }
+    }
+  }
+  else if (!interleaved_) {
+    SIS38XXDemuxBinned(mcsData_, maxChans_, maxSignals_, binFactor_, pIn, count, signal, chan);
+  }
+  else {
+    /* In interleaved mode mcsData_ is in the same order as the FIFO, so this is a straight copy */
+    offset = *chan*maxSignals_ + *signal;
+    if (count > maxChans_*maxSignals_ - offset) count = maxChans_*maxSignals_ - offset;
+    memcpy(mcsData_ + offset, pIn, count*sizeof(epicsUInt32));
+    offset += count;
+    *chan = offset / maxSignals_;
+    *signal = offset % maxSignals_;
+  }
+
+  done:
+  epicsMutexUnlock(demuxLockId_);
+}
+
+/** Stores the position after the words that readFIFOThread has read and passed to demuxFIFO.
+  * epoch is the value of epoch_ when readFIFOThread read the position.  If the data were erased
+  * while it was reading the FIFO the position is for the old data, and erase() has already reset it.
+  * The ring buffer wraps that demuxFIFO counted in those words are added to ringBase_ at the same
+  * time, so ringBase_ + nextChan_ is always the absolute channel number.
+  * This is called from readFIFOThread with the asynPortDriver lock held. */
+void drvSIS38XX::storeFIFOPosition(int epoch, int signal, int chan)
+{
+  epicsMutexLock(demuxLockId_);
+  if (epoch == epoch_) {
+    nextChan_ = chan;
+    nextSignal_ = signal;
+    ringBase_ += (double)pendingLaps_*maxChans_;
+    pendingLaps_ = 0;
+  }
+  epicsMutexUnlock(demuxLockId_);
+}
+
+/** Copies numCopy channels of the data for one signal to data.  The channels that have not been
+  * acquired are set to 0.  Returns the number of channels acquired.
+  * Must be called with the asynPortDriver lock held. */
+size_t drvSIS38XX::readSignal(int signal, epicsInt32 *data, size_t numCopy)
+{
+  size_t numValid;
+  size_t numAcquired;
+  epicsUInt32 *pData = mcsData_;
+
+  if (streaming_ || pretrigger_) {
+    if (streaming_)
+      numValid = readStreamWindow(signal, data, numCopy);
+    else
+      numValid = readPretriggerWindow(signal, data, numCopy);
+    memset(data + numValid, 0, (numCopy - numValid)*sizeof(epicsInt32));
+    return numValid;
+  }
+  if (interleaved_) {
+    // The data are in FIFO order, bring the signal-major copy up to date
+    extractSignals();
+    pData = mcsExtract_;
+  }
+  // erase() does not clear mcsData_, so only the channels acquired since the last erase are valid.
+  // These include the last partial channel for signals before nextSignal_.
+  // We copy the valid channels and zero the rest, but we only report nchans.
+  // This ensures the entire array is correct.
+  // With binning there are binFactor_ times fewer channels, the last one can be a partial bin.
+  numValid = nextChan_;
+  if (signal < nextSignal_) numValid++;
+  numValid = binnedChans(numValid);
+  if (numValid > numCopy) numValid = numCopy;
+  memcpy(data, pData + signal*maxChans_, numValid*sizeof(epicsInt32));
+  memset(data + numValid, 0, (numCopy - numValid)*sizeof(epicsInt32));
+  numAcquired = binnedChans(nextChan_);
+  if (numAcquired > numCopy) numAcquired = numCopy;
+  return numAcquired;
+}
+
+/** Returns the number of channels of mcsData_ that contain data from the first chans channels
+  * acquired.  The last one is a partial bin if chans is not a multiple of binFactor_. */
+int drvSIS38XX::binnedChans(int chans)
+{
+  return (chans + binFactor_ - 1) / binFactor_;
+}
+
+/** Bring mcsExtract_ up to date with the data in mcsData_ when interleaved_ is true.
+  * Only the words added since the last call are transposed, so when many records read
+  * different signals after the same FIFO read only the first one does any work.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XX::extractSignals()
+{
+  int signal = 0;
+  int count;
+
+  // Start again at the beginning of the last partial channel, nextSignal_ can be reset
+  // when acquisition is resumed
+  if (extractChan_ > nextChan_) extractChan_ = nextChan_;
+  count = (nextChan_ - extractChan_)*maxSignals_ + nextSignal_;
+  if (count <= 0) return;
+  SIS38XXDemux(mcsExtract_, maxChans_, maxSignals_, mcsData_ + extractChan_*maxSignals_, count,
+               &signal, &extractChan_);
+}
+
+
+/** Open a new set of stream files using the path and segment size parameters.
+  * Returns 0 on success, -1 on error.
+  * Must be called with the asynPortDriver lock held. */
+int drvSIS38XX::openStream()
+{
+  char path[SIS38XX_STREAM_MAX_PATH];
+  int segmentChans;
+  int numSegments;
+  int status;
+  static const char* functionName="openStream";
+
+  getStringParam(SIS38XXStreamPath_, sizeof(path), path);
+  getIntegerParam(SIS38XXStreamSegmentChans_, &segmentChans);
+  getIntegerParam(SIS38XXStreamSegments_, &numSegments);
+  epicsMutexLock(streamLockId_);
+  status = pStream_->open(path, maxSignals_, segmentChans, numSegments);
+  streamError_ = false;
+  epicsMutexUnlock(streamLockId_);
+  streamChans_ = 0.;
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: error opening stream %s, %s\n",
+              driverName, functionName, path, pStream_->errorString());
+    setStringParam(SIS38XXStreamMessage_, pStream_->errorString());
+  } else {
+    setStringParam(SIS38XXStreamMessage_, "Streaming");
+  }
+  setDoubleParam(SIS38XXStreamChannels_, 0.0);
+  return status;
+}
+
+/** Copy the most recent numRead complete channels of one signal from the ring buffer,
+  * oldest first.  Returns the number of channels copied.
+  * Must be called with the asynPortDriver lock held. */
+size_t drvSIS38XX::readStreamWindow(int signal, epicsInt32 *data, size_t numRead)
+{
+  epicsUInt32 *pRow = mcsData_ + signal*maxChans_;
+  size_t numValid = nextChan_;
+  size_t first, n;
+
+  if (streamChans_ >= maxChans_) numValid = maxChans_;
+  if (numRead > numValid) numRead = numValid;
+  // The oldest channel to copy, it may be before the end of the ring buffer
+  first = (nextChan_ + maxChans_ - numRead) % maxChans_;
+  n = maxChans_ - first;
+  if (n > numRead) n = numRead;
+  memcpy(data, pRow + first, n*sizeof(epicsInt32));
+  memcpy(data + n, pRow, (numRead - n)*sizeof(epicsInt32));
+  return numRead;
+}
+
+/** In pre-trigger mode looks for the trigger in count FIFO words starting at signal, chan.
+  * A non-zero count in triggerSignal_ is a trigger, and the trigger channel is the first
+  * post-trigger channel.  After a trigger returns the number of words to keep so that the ring buffer
+  * holds the pre-trigger channels and posttriggerChans_ channels starting at the trigger.
+  * This is called from demuxFIFO with demuxLockId_ held, without the asynPortDriver lock. */
+int drvSIS38XX::pretriggerCount(const epicsUInt32 *pIn, int count, int signal, int chan)
+{
+  double firstChan = ringBase_ + (double)pendingLaps_*maxChans_ + chan;
+  double limit;
+  int i;
+  static const char* functionName="pretriggerCount";
+
+  if (!triggered_ && (triggerSignal_ >= 0)) {
+    // Only look at the words for the trigger signal
+    for (i=(triggerSignal_ - signal + maxSignals_) % maxSignals_; i<count; i+=maxSignals_) {
+      if (pIn[i] != 0) {
+        triggerChan_ = firstChan + (signal + i)/maxSignals_;
+        triggered_ = true;
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+                  "%s:%s: trigger on signal %d at channel %.0f\n",
+                  driverName, functionName, triggerSignal_, triggerChan_);
+        break;
+      }
+    }
+  }
+  if (triggered_) {
+    limit = (triggerChan_ + posttriggerChans_ - firstChan)*maxSignals_ - signal;
+    if (limit < 0) limit = 0;
+    if (count > limit) count = (int)limit;
+  }
+  return count;
+}
+
+/** Copy the pre-trigger window of one signal from the ring buffer, oldest first.
+  * Before the trigger this is the most recent numRead channels.  After the trigger it is the
+  * pretriggerChans_ channels before the trigger and the post-trigger channels acquired so far.
+  * Returns the number of channels copied.
+  * Must be called with the asynPortDriver lock held. */
+size_t drvSIS38XX::readPretriggerWindow(int signal, epicsInt32 *data, size_t numRead)
+{
+  epicsUInt32 *pRow = mcsData_ + signal*maxChans_;
+  double lastChan, firstChan, triggerChan;
+  bool triggered;
+  size_t numValid, first, n;
+
+  epicsMutexLock(demuxLockId_);
+  triggered = triggered_;
+  triggerChan = triggerChan_;
+  lastChan = ringBase_ + nextChan_;
+  epicsMutexUnlock(demuxLockId_);
+  if (triggered) {
+    if (lastChan > triggerChan + posttriggerChans_) lastChan = triggerChan + posttriggerChans_;
+    firstChan = triggerChan - pretriggerChans_;
+  } else {
+    firstChan = lastChan - numRead;
+  }
+  // Channels before the start of the ring buffer have been overwritten
+  if (firstChan < lastChan - maxChans_) firstChan = lastChan - maxChans_;
+  if (firstChan < 0) firstChan = 0;
+  numValid = (size_t)(lastChan - firstChan);
+  if (numValid > numRead) numValid = numRead;
+  first = (size_t)fmod(firstChan, (double)maxChans_);
+  n = maxChans_ - first;
+  if (n > numValid) n = numValid;
+  memcpy(data, pRow + first, n*sizeof(epicsInt32));
+  memcpy(data + n, pRow, (numValid - n)*sizeof(epicsInt32));
+  return numValid;
+}
+
+/** Restarts acquisition for the next sweep when accumulating sweeps.
+  * The next sweep overwrites mcsData_ starting at channel 0, and MCA_DATA_NEW clients start again.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XX::startNextSweep()
+{
+  static const char* functionName="startNextSweep";
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+            "%s:%s: starting sweep %d\n",
+            driverName, functionName, sweeps_+1);
+  stopMCSAcquire();
+  // The SIS3801 stopMCSAcquire() clears acquiring_
+  acquiring_ = true;
+  epicsMutexLock(demuxLockId_);
+  epoch_++;
+  epicsMutexUnlock(demuxLockId_);
+  nextChan_ = 0;
+  nextSignal_ = 0;
+  extractChan_ = 0;
+  startMCSAcquire();
+}
+
+/** Copies the 64-bit scaler counts to counts, which has at least maxSignals_ elements.
+  * The SIS3801 readFIFOThread adds to scalerData_ with only the FIFO lock, so the copy is
+  * made with the FIFO lock held.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XX::copyScalerData(epicsUInt64 *counts)
+{
+  epicsMutexLock(fifoLockId_);
+  memcpy(counts, scalerData_, maxSignals_*sizeof(epicsUInt64));
+  epicsMutexUnlock(fifoLockId_);
+}
+
+/** Sets the starting point for the scaler rates and clears the scaler history.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XX::resetScalerRates()
+{
+  epicsUInt64 counts[SIS38XX_MAX_SIGNALS];
+  int signal;
+
+  copyScalerData(counts);
+  for (signal=0; signal<maxSignals_; signal++) {
+    rateCounts_[signal] = counts[signal];
+    setDoubleParam(signal, SIS38XXScalerRate_, 0.0);
+    setDoubleParam(signal, SIS38XXScalerCounts_, (double)counts[signal]);
+    setIntegerParam(signal, SIS38XXScalerOverflow_, 0);
+  }
+  historyPos_ = 0;
+  historyCount_ = 0;
+  epicsTimeGetCurrent(&rateTime_);
+}
+
+/** Reads the scalers, computes the rates since the last call, and adds the counts to the scaler history.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XX::updateScalerRates()
+{
+  epicsUInt64 counts[SIS38XX_MAX_SIGNALS];
+  epicsTimeStamp now;
+  double dt;
+  double rate;
+  int signal;
+  size_t n;
+
+  readScalers();
+  epicsTimeGetCurrent(&now);
+  dt = epicsTimeDiffInSeconds(&now, &rateTime_);
+  rateTime_ = now;
+  copyScalerData(counts);
+  for (signal=0; signal<maxSignals_; signal++) {
+    rate = 0.;
+    if (dt > 0.) rate = (double)(counts[signal] - rateCounts_[signal]) / dt;
+    rateCounts_[signal] = counts[signal];
+    scalerHistory_[signal*SIS38XX_SCALER_HISTORY_SIZE + historyPos_] = (double)counts[signal];
+    setDoubleParam(signal, SIS38XXScalerCounts_, (double)counts[signal]);
+    setDoubleParam(signal, SIS38XXScalerRate_, rate);
+    // The scaler record reads 32-bit signed values
+    setIntegerParam(signal, SIS38XXScalerOverflow_, counts[signal] > 0x7FFFFFFF);
+  }
+  historyPos_ = (historyPos_ + 1) % SIS38XX_SCALER_HISTORY_SIZE;
+  if (historyCount_ < SIS38XX_SCALER_HISTORY_SIZE) historyCount_++;
+  for (signal=0; signal<maxSignals_; signal++) {
+    n = readScalerHistory(signal, historyBuffer_, SIS38XX_SCALER_HISTORY_SIZE);
+    doCallbacksFloat64Array(historyBuffer_, n, SIS38XXScalerHistory_, signal);
+    callParamCallbacks(signal);
+  }
+}
+
+/** Copy the most recent numRead scaler readings of one signal, oldest first.
+  * Returns the number of readings copied.
+  * Must be called with the asynPortDriver lock held. */
+size_t drvSIS38XX::readScalerHistory(int signal, epicsFloat64 *data, size_t numRead)
+{
+  epicsFloat64 *pRow = scalerHistory_ + signal*SIS38XX_SCALER_HISTORY_SIZE;
+  size_t first, n;
+
+  if (numRead > (size_t)historyCount_) numRead = historyCount_;
+  first = (historyPos_ + SIS38XX_SCALER_HISTORY_SIZE - numRead) % SIS38XX_SCALER_HISTORY_SIZE;
+  n = SIS38XX_SCALER_HISTORY_SIZE - first;
+  if (n > numRead) n = numRead;
+  memcpy(data, pRow + first, n*sizeof(epicsFloat64));
+  memcpy(data + n, pRow, (numRead - n)*sizeof(epicsFloat64));
+  return numRead;
+}
+
+/** Updates the scaler rates every RatePeriod seconds while acquiring in scaler mode.
+  * Reading the scalers at least this often also lets the SIS3820 extend its 32-bit counters. */
+void drvSIS38XX::scalerRateThread()
+{
+  double period;
+  bool acquiring;
+
+  while (true) {
+    lock();
+    getDoubleParam(SIS38XXRatePeriod_, &period);
+    acquiring = exists_ && acquiring_ && (acquireMode_ == ACQUIRE_MODE_SCALER);
+    // Do one more update when acquisition stops, so the final counts are in the history
+    if (acquiring || rateAcquiring_) updateScalerRates();
+    rateAcquiring_ = acquiring;
+    unlock();
+    if (period < SIS38XX_MIN_RATE_PERIOD) period = SIS38XX_MIN_RATE_PERIOD;
+    epicsThreadSleep(period);
+  }
+}
+
+static void scalerRateThreadC(void *drvPvt)
+{
+  drvSIS38XX *pPvt = (drvSIS38XX *)drvPvt;
+
+  pPvt->scalerRateThread();
+}
+
 void drvSIS38XX::checkMCSDone()
 {
   int signal;
   epicsTimeStamp now;
   int nChans;
+  int presetSweeps;
   double presetReal, elapsedTime;
+  double callbackPeriod;
+  int published;
+  bool streamError;
+  bool triggered;
+  double triggerChan, lastChan;
   static const char* functionName="checkMCSDone";
 
 
@@ -507,15 +1339,60 @@ void drvSIS38XX::checkMCSDone()
     }
   }
 
+  /* When streaming there is no channel limit, acquisition is stopped by preset real time,
+   * by a stop command, or if the stream files cannot be written */
+  if (streaming_) {
+    epicsMutexLock(streamLockId_);
+    streamChans_ = pStream_->channels();
+    streamError = streamError_;
+    epicsMutexUnlock(streamLockId_);
+    setDoubleParam(SIS38XXStreamChannels_, streamChans_);
+    if (acquiring_ && streamError) {
+      acquiring_ = false;
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s:, stopped acquisition by stream error %s\n",
+                driverName, functionName, pStream_->errorString());
+      setStringParam(SIS38XXStreamMessage_, pStream_->errorString());
+    }
+  }
+
+  /* In pre-trigger mode acquisition stops when the post-trigger channels have been acquired,
+   * which freezes the ring buffer */
+  else if (pretrigger_) {
+    // demuxFIFO sets triggered_ and triggerChan_ when it sees the trigger signal
+    epicsMutexLock(demuxLockId_);
+    triggered = triggered_;
+    triggerChan = triggerChan_;
+    lastChan = ringBase_ + nextChan_;
+    epicsMutexUnlock(demuxLockId_);
+    setIntegerParam(SIS38XXTriggered_, triggered);
+    if (acquiring_ && triggered && (lastChan >= triggerChan + posttriggerChans_)) {
+      acquiring_ = false;
+      asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+                "%s:%s:, stopped acquisition by post-trigger channels, trigger channel=%.0f\n",
+                driverName, functionName, triggerChan);
+    }
+  }
+
   /* Check that acquisition is complete by nextChan and nextSignal.  This ensures
    * that it will be detected even if interrupts are disabled.
    */
-  if (acquiring_) {
+  else if (acquiring_) {
     if (nextChan_ >= nChans) {
-      acquiring_ = false;
-      asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                "%s:%s:, stopped acquisition by nextChan=%d, nChans=%d\n",
-                driverName, functionName, nextChan_, nChans);
+      if (accumulating_) {
+        sweeps_++;
+        if ((sweeps_ == 1) || (nChans < sumChans_)) sumChans_ = nChans;
+        setIntegerParam(SIS38XXSweeps_, sweeps_);
+      }
+      getIntegerParam(mcaPresetSweeps_, &presetSweeps);
+      if (accumulating_ && (sweeps_ < presetSweeps)) {
+        startNextSweep();
+      } else {
+        acquiring_ = false;
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+                  "%s:%s:, stopped acquisition by nextChan=%d, nChans=%d, sweeps=%d\n",
+                  driverName, functionName, nextChan_, nChans, sweeps_);
+      }
     }
   }
 
@@ -527,28 +1404,39 @@ void drvSIS38XX::checkMCSDone()
     stopMCSAcquire();
   }
 
-  // Set elapsed times
-  for (signal=0; signal<maxSignals_; signal++) {
-    setDoubleParam(signal, mcaElapsedRealTime_, elapsedTime);
-    setDoubleParam(signal, mcaElapsedLiveTime_, elapsedTime);
-  }
+  // Set elapsed times.  These are the same for all signals, so they are only set for signal 0
+  // and readFloat64 returns them for the other signals.
+  setDoubleParam(mcaElapsedRealTime_, elapsedTime);
+  setDoubleParam(mcaElapsedLiveTime_, elapsedTime);
   
   // Set current channel
   setIntegerParam(SIS38XXCurrentChannel_, nextChan_);
 
+  // Acquisition may also have been stopped by a stop command since the last call,
+  // so compare with the acquiring status that was last published
+  getIntegerParam(mcaAcquiring_, &published);
   if (!acquiring_) {
-    // Do callbacks on mcaAcquiring
-    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-               "%s:%s:, acquisition complete, doing callbacks on mcaAcquiring\n",
-               driverName, functionName);
     for (signal=0; signal<maxSignals_; signal++) {
       setIntegerParam(signal, mcaAcquiring_, 0);
     }
   }
 
-  // Do callbacks on all channels
-  for (signal=0; signal<maxSignals_; signal++) {
-    callParamCallbacks(signal);
+  // Do callbacks on all signals only when acquisition stops.  Otherwise do callbacks
+  // on signal 0, at most once per CallbackPeriod.
+  if (published && !acquiring_) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+               "%s:%s:, acquisition complete, doing callbacks on mcaAcquiring\n",
+               driverName, functionName);
+    for (signal=0; signal<maxSignals_; signal++) {
+      callParamCallbacks(signal);
+    }
+    callbackTime_ = now;
+  } else {
+    getDoubleParam(SIS38XXCallbackPeriod_, &callbackPeriod);
+    if (epicsTimeDiffInSeconds(&now, &callbackTime_) >= callbackPeriod) {
+      callParamCallbacks();
+      callbackTime_ = now;
+    }
   }
 
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
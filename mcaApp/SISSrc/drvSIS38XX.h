@@ -23,6 +23,8 @@
 #include <epicsEvent.h>
 #include <epicsTypes.h>
 
+#include "SIS38XXStream.h"
+#include "SIS38XXSim.h"
 
 
 /***************/
@@ -42,9 +44,45 @@
 #define SIS38XXCountOnStartString           "SIS38XX_COUNT_ON_START"
 #define SIS38XXModelString                  "SIS38XX_MODEL"
 #define SIS38XXFirmwareString               "SIS38XX_FIRMWARE"
+#define SIS38XXInterleavedString            "SIS38XX_INTERLEAVED"
+#define SIS38XXStreamString                 "SIS38XX_STREAM"
+#define SIS38XXStreamPathString             "SIS38XX_STREAM_PATH"
+#define SIS38XXStreamSegmentChansString     "SIS38XX_STREAM_SEGMENT_CHANS"
+#define SIS38XXStreamSegmentsString         "SIS38XX_STREAM_SEGMENTS"
+#define SIS38XXStreamChannelsString         "SIS38XX_STREAM_CHANNELS"
+#define SIS38XXStreamMessageString          "SIS38XX_STREAM_MESSAGE"
+#define SIS38XXDrainPeriodString            "SIS38XX_DRAIN_PERIOD"
+#define SIS38XXFifoRateString               "SIS38XX_FIFO_RATE"
+#define SIS38XXFifoThresholdString          "SIS38XX_FIFO_THRESHOLD"
+#define SIS38XXDrainLatencyString           "SIS38XX_DRAIN_LATENCY"
+#define SIS38XXDrainLatencyMaxString        "SIS38XX_DRAIN_LATENCY_MAX"
+#define SIS38XXWakeupsString                "SIS38XX_WAKEUPS"
+#define SIS38XXIntWakeupsString             "SIS38XX_INT_WAKEUPS"
+#define SIS38XXSweepsString                 "SIS38XX_SWEEPS"
+#define SIS38XXSweepSumsString              "SIS38XX_SWEEP_SUMS"
+#define SIS38XXPretriggerString             "SIS38XX_PRETRIGGER"
+#define SIS38XXPretriggerChansString        "SIS38XX_PRETRIGGER_CHANS"
+#define SIS38XXPosttriggerChansString       "SIS38XX_POSTTRIGGER_CHANS"
+#define SIS38XXTriggerSignalString          "SIS38XX_TRIGGER_SIGNAL"
+#define SIS38XXTriggerString                "SIS38XX_TRIGGER"
+#define SIS38XXTriggeredString              "SIS38XX_TRIGGERED"
+#define SIS38XXScalerCountsString           "SIS38XX_SCALER_COUNTS"
+#define SIS38XXScalerRateString             "SIS38XX_SCALER_RATE"
+#define SIS38XXScalerOverflowString         "SIS38XX_SCALER_OVERFLOW"
+#define SIS38XXRatePeriodString             "SIS38XX_RATE_PERIOD"
+#define SIS38XXScalerHistoryString          "SIS38XX_SCALER_HISTORY"
+#define SIS38XXCallbackPeriodString         "SIS38XX_CALLBACK_PERIOD"
+#define SIS38XXBinFactorString              "SIS38XX_BIN_FACTOR"
+#define SIS38XXAllDataString                "SIS38XX_ALL_DATA"
+#define SIS38XXAllChansString               "SIS38XX_ALL_CHANS"
 
 #define SIS38XX_MAX_SIGNALS 32
 
+/* Number of scaler readings kept in the scaler history for each signal */
+#define SIS38XX_SCALER_HISTORY_SIZE 1024
+/* Minimum time between scaler rate calculations */
+#define SIS38XX_MIN_RATE_PERIOD 0.01
+
 typedef enum {
     ACQUIRE_MODE_MCS,
     ACQUIRE_MODE_SCALER
@@ -83,13 +121,36 @@ class drvSIS38XX : public asynPortDriver
   // These are the methods we override from asynPortDriver
   asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
   asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
+  asynStatus readFloat64(asynUser *pasynUser, epicsFloat64 *value);
   asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *data, 
                                     size_t maxChans, size_t *nactual);
+  asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *data, 
+                                      size_t maxChans, size_t *nactual);
+  asynStatus drvUserCreate(asynUser *pasynUser, const char *drvInfo, 
+                           const char **pptypeName, size_t *psize);
+  asynStatus drvUserDestroy(asynUser *pasynUser);
   virtual void report(FILE *fp, int details);
+  void scalerRateThread(); // Should be private, but called from C callback function
   
   protected:
   virtual void checkMCSDone();
   virtual void erase();
+  void startNextSweep();
+  void demuxFIFO(const epicsUInt32 *pIn, int count, int epoch, int *signal, int *chan);
+  void storeFIFOPosition(int epoch, int signal, int chan);
+  epicsUInt32 readRegister(volatile epicsUInt32 *pReg);
+  void writeRegister(volatile epicsUInt32 *pReg, epicsUInt32 value);
+  int binnedChans(int chans);
+  size_t readSignal(int signal, epicsInt32 *data, size_t numCopy);
+  void extractSignals();
+  int openStream();
+  size_t readStreamWindow(int signal, epicsInt32 *data, size_t numRead);
+  int pretriggerCount(const epicsUInt32 *pIn, int count, int signal, int chan);
+  size_t readPretriggerWindow(int signal, epicsInt32 *data, size_t numRead);
+  void copyScalerData(epicsUInt64 *counts);
+  void resetScalerRates();
+  void updateScalerRates();
+  size_t readScalerHistory(int signal, epicsFloat64 *data, size_t numRead);
   // Pure virtual functions, derived class must implement these
   virtual void stopMCSAcquire() = 0;
   virtual void startMCSAcquire() = 0;
@@ -115,6 +176,7 @@ class drvSIS38XX : public asynPortDriver
   int mcaStopAcquire_;
   int mcaErase_;
   int mcaData_;
+  int mcaDataNew_;
   int mcaReadStatus_;
   int mcaChannelAdvanceSource_;
   int mcaNumChannels_;
@@ -151,7 +213,38 @@ class drvSIS38XX : public asynPortDriver
   int SIS38XXCountOnStart_;
   int SIS38XXModel_;
   int SIS38XXFirmware_;
-  #define LAST_SIS38XX_PARAM SIS38XXFirmware_
+  int SIS38XXInterleaved_;
+  int SIS38XXStream_;
+  int SIS38XXStreamPath_;
+  int SIS38XXStreamSegmentChans_;
+  int SIS38XXStreamSegments_;
+  int SIS38XXStreamChannels_;
+  int SIS38XXStreamMessage_;
+  int SIS38XXDrainPeriod_;
+  int SIS38XXFifoRate_;
+  int SIS38XXFifoThreshold_;
+  int SIS38XXDrainLatency_;
+  int SIS38XXDrainLatencyMax_;
+  int SIS38XXWakeups_;
+  int SIS38XXIntWakeups_;
+  int SIS38XXSweeps_;
+  int SIS38XXSweepSums_;
+  int SIS38XXPretrigger_;
+  int SIS38XXPretriggerChans_;
+  int SIS38XXPosttriggerChans_;
+  int SIS38XXTriggerSignal_;
+  int SIS38XXTrigger_;
+  int SIS38XXTriggered_;
+  int SIS38XXScalerCounts_;
+  int SIS38XXScalerRate_;
+  int SIS38XXScalerOverflow_;
+  int SIS38XXRatePeriod_;
+  int SIS38XXScalerHistory_;
+  int SIS38XXCallbackPeriod_;
+  int SIS38XXBinFactor_;
+  int SIS38XXAllData_;
+  int SIS38XXAllChans_;
+  #define LAST_SIS38XX_PARAM SIS38XXAllChans_
 
   bool exists_;
   int firmwareVersion_;
@@ -165,16 +258,48 @@ class drvSIS38XX : public asynPortDriver
   epicsTimeStamp startTime_;
   double elapsedPrevious_;
   bool erased_;
+  int epoch_;                /* Incremented each time the data are erased, with demuxLockId_ held too */
+  epicsMutexId demuxLockId_; /* Held by demuxFIFO while it stores the words read from the FIFO */
   epicsUInt32 *mcsData_;     /* maxSignals * maxChans */
-  epicsUInt32 *scalerData_;  /* maxSignals */
+  bool interleaved_;         /* mcsData_ is in FIFO order (channel-major) rather than signal-major */
+  epicsUInt32 *mcsExtract_;  /* Signal-major copy of mcsData_ when interleaved_ is true */
+  int extractChan_;          /* mcsExtract_ is valid for channels before extractChan_ */
+  bool streaming_;           /* Data are written to pStream_ and mcsData_ is a ring of the last maxChans channels */
+  SIS38XXStream *pStream_;
+  double streamChans_;       /* Channels written to pStream_ since the last erase */
+  bool streamError_;         /* pStream_ could not be written, protected by streamLockId_ */
+  epicsMutexId streamLockId_;
+  bool accumulating_;        /* Each sweep is added to sweepSums_ and acquisition restarts for PresetSweeps sweeps */
+  epicsUInt64 *sweepSums_;   /* maxSignals * maxChans, allocated when first needed */
+  int sweeps_;               /* Sweeps completed since the last erase */
+  int sumChans_;             /* Channels acquired in every completed sweep, the sums beyond are not valid */
+  bool pretrigger_;          /* mcsData_ is a ring buffer that is frozen posttriggerChans_ channels after a trigger */
+  bool triggered_;           /* triggered_, triggerChan_, ringBase_ and pendingLaps_ are protected by demuxLockId_ */
+  int pretriggerChans_;
+  int posttriggerChans_;
+  int triggerSignal_;        /* A count in this signal is a trigger, -1 for software trigger only */
+  double triggerChan_;       /* Channel number of the trigger since the last erase */
+  double ringBase_;          /* Channel number of channel 0 of the ring buffer since the last erase */
+  int pendingLaps_;          /* Wraps of the ring buffer in demuxFIFO not yet added to ringBase_ by storeFIFOPosition */
+  int binFactor_;            /* Adjacent channels summed into each channel of mcsData_ and sweepSums_ */
+  epicsUInt64 *scalerData_;  /* maxSignals */
+  epicsUInt64 *rateCounts_;  /* scalerData_ at the last rate calculation */
+  epicsTimeStamp rateTime_;  /* Time of the last rate calculation */
+  bool rateAcquiring_;       /* Scaler was acquiring at the last rate calculation */
+  epicsFloat64 *scalerHistory_;  /* Ring of SIS38XX_SCALER_HISTORY_SIZE readings for each signal */
+  epicsFloat64 *historyBuffer_;  /* One signal of scalerHistory_ in time order, for callbacks */
+  int historyPos_;
+  int historyCount_;
   int nextChan_;
   int nextSignal_;
   epicsUInt32 *fifoBuffer_;
   int fifoBufferWords_;
   epicsUInt32 *fifoBuffPtr_;
   bool acquiring_;
+  epicsTimeStamp callbackTime_;  /* Time of the last status callbacks in checkMCSDone */
   epicsEventId readFIFOEventId_;
   epicsMutexId fifoLockId_;
+  SIS38XXSim *pSim_;         /* Software simulation of the board, NULL with real hardware */
 };
 
 #define NUM_SIS38XX_PARAMS (int)(&LAST_SIS38XX_PARAM - &FIRST_SIS38XX_PARAM + 1)
@@ -0,0 +1,582 @@
+/* File:    drvSIS38XXGroup.cpp
+ *
+ * Purpose:
+ * This module presents several SIS3820 or SIS3801 boards as a single MCA port.
+ * See drvSIS38XXGroup.h.
+ *
+ * The boards are accessed through their asyn interfaces with the SyncIO functions,
+ * in the same way as drvFastSweep accesses its input driver.
+ *
+ */
+
+/*******************/
+/* System includes */
+/*******************/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+/******************/
+/* EPICS includes */
+/******************/
+
+#include <cantProceed.h>
+#include <epicsString.h>
+#include <epicsThread.h>
+#include <epicsExport.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include <asynInt32SyncIO.h>
+#include <asynFloat64SyncIO.h>
+#include <asynInt32ArraySyncIO.h>
+
+/*******************/
+/* Custom includes */
+/*******************/
+
+#include "drvMca.h"
+#include "devScalerAsyn.h"
+#include "drvSIS38XX.h"
+#include "drvSIS38XXGroup.h"
+
+static const char *driverName="drvSIS38XXGroup";
+
+/* Timeout for the I/O to the boards.  The board drivers are synchronous, so this is not used. */
+#define SIS38XX_GROUP_TIMEOUT 1.0
+
+static void pollThreadC(void *drvPvt);
+
+/*Constructor */
+drvSIS38XXGroup::drvSIS38XXGroup(const char *portName, int numBoards, const char **boardPorts,
+                                 int maxSignals, int maxChans)
+  :  asynPortDriver(portName, numBoards*maxSignals, NUM_SIS38XX_GROUP_PARAMS,
+                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynDrvUserMask,
+                    asynInt32Mask | asynFloat64Mask,
+                    ASYN_MULTIDEVICE, 1, 0, 0),
+     numBoards_(numBoards), maxSignals_(maxSignals), maxChans_(maxChans), acquiring_(false),
+     erased_(false), exists_(false), pasynUserSignal_(NULL), pasynUserData_(NULL)
+{
+  int board;
+  int signal;
+  int addr;
+  asynStatus status;
+  static const char* functionName="drvSIS38XXGroup";
+
+  createParam(mcaStartAcquireString,                asynParamInt32, &mcaStartAcquire_);           /* int32, write */
+  createParam(mcaStopAcquireString,                 asynParamInt32, &mcaStopAcquire_);            /* int32, write */
+  createParam(mcaEraseString,                       asynParamInt32, &mcaErase_);                  /* int32, write */
+  createParam(mcaDataString,                        asynParamInt32, &mcaData_);                   /* int32Array, read */
+  createParam(mcaReadStatusString,                  asynParamInt32, &mcaReadStatus_);             /* int32, write */
+  createParam(mcaChannelAdvanceSourceString,        asynParamInt32, &mcaChannelAdvanceSource_);   /* int32, write */
+  createParam(mcaNumChannelsString,                 asynParamInt32, &mcaNumChannels_);            /* int32, write */
+  createParam(mcaDwellTimeString,                 asynParamFloat64, &mcaDwellTime_);              /* float64, write */
+  createParam(mcaPresetLiveTimeString,            asynParamFloat64, &mcaPresetLiveTime_);         /* float64, write */
+  createParam(mcaPresetRealTimeString,            asynParamFloat64, &mcaPresetRealTime_);         /* float64, write */
+  createParam(mcaPresetCountsString,              asynParamFloat64, &mcaPresetCounts_);           /* float64, write */
+  createParam(mcaPresetLowChannelString,            asynParamInt32, &mcaPresetLowChannel_);       /* int32, write */
+  createParam(mcaPresetHighChannelString,           asynParamInt32, &mcaPresetHighChannel_);      /* int32, write */
+  createParam(mcaPresetSweepsString,                asynParamInt32, &mcaPresetSweeps_);           /* int32, write */
+  createParam(mcaAcquireModeString,                 asynParamInt32, &mcaAcquireMode_);            /* int32, write */
+  createParam(mcaSequenceString,                    asynParamInt32, &mcaSequence_);               /* int32, write */
+  createParam(mcaPrescaleString,                    asynParamInt32, &mcaPrescale_);               /* int32, write */
+  createParam(mcaAcquiringString,                   asynParamInt32, &mcaAcquiring_);              /* int32, read */
+  createParam(mcaElapsedLiveTimeString,           asynParamFloat64, &mcaElapsedLiveTime_);        /* float64, read */
+  createParam(mcaElapsedRealTimeString,           asynParamFloat64, &mcaElapsedRealTime_);        /* float64, read */
+  createParam(mcaElapsedCountsString,             asynParamFloat64, &mcaElapsedCounts_);          /* float64, read */
+  createParam(SIS38XXCurrentChannelString,          asynParamInt32, &SIS38XXCurrentChannel_);     /* int32, read */
+  createParam(SIS38XXMaxChannelsString,             asynParamInt32, &SIS38XXMaxChannels_);        /* int32, read */
+  createParam(SIS38XXBinFactorString,               asynParamInt32, &SIS38XXBinFactor_);          /* int32, write */
+
+  // Connect to the parameters of each board
+  for (board=0; board<numBoards_; board++) {
+    boardPorts_[board] = epicsStrDup(boardPorts[board]);
+    pasynUserBoard_[board] = (asynUser **)callocMustSucceed(NUM_SIS38XX_GROUP_PARAMS, sizeof(asynUser *),
+                                                             functionName);
+  }
+  status = connectParam(mcaStartAcquire_,         mcaStartAcquireString,         false);
+  if (!status) status = connectParam(mcaStopAcquire_,          mcaStopAcquireString,          false);
+  if (!status) status = connectParam(mcaErase_,                mcaEraseString,                false);
+  if (!status) status = connectParam(mcaChannelAdvanceSource_, mcaChannelAdvanceSourceString, false);
+  if (!status) status = connectParam(mcaNumChannels_,          mcaNumChannelsString,          false);
+  if (!status) status = connectParam(mcaDwellTime_,            mcaDwellTimeString,            true);
+  if (!status) status = connectParam(mcaPresetLiveTime_,       mcaPresetLiveTimeString,       true);
+  if (!status) status = connectParam(mcaPresetRealTime_,       mcaPresetRealTimeString,       true);
+  if (!status) status = connectParam(mcaPresetSweeps_,         mcaPresetSweepsString,         false);
+  if (!status) status = connectParam(mcaAcquireMode_,          mcaAcquireModeString,          false);
+  if (!status) status = connectParam(mcaSequence_,             mcaSequenceString,             false);
+  if (!status) status = connectParam(mcaPrescale_,             mcaPrescaleString,             false);
+  if (!status) status = connectParam(mcaAcquiring_,            mcaAcquiringString,            false);
+  if (!status) status = connectParam(mcaElapsedLiveTime_,      mcaElapsedLiveTimeString,      true);
+  if (!status) status = connectParam(mcaElapsedRealTime_,      mcaElapsedRealTimeString,      true);
+  if (!status) status = connectParam(SIS38XXCurrentChannel_,   SIS38XXCurrentChannelString,   false);
+  if (!status) status = connectParam(SIS38XXBinFactor_,        SIS38XXBinFactorString,        false);
+  if (status) return;
+
+  // Connect to the per-signal parameters of each signal of each board
+  pasynUserSignal_ = (asynUser ***)callocMustSucceed(numBoards_*maxSignals_, sizeof(asynUser **), functionName);
+  for (addr=0; addr<numBoards_*maxSignals_; addr++) {
+    pasynUserSignal_[addr] = (asynUser **)callocMustSucceed(NUM_SIS38XX_GROUP_PARAMS, sizeof(asynUser *),
+                                                            functionName);
+  }
+  status = connectSignalParam(mcaReadStatus_,                 mcaReadStatusString,           false);
+  if (!status) status = connectSignalParam(mcaPresetCounts_,      mcaPresetCountsString,         true);
+  if (!status) status = connectSignalParam(mcaPresetLowChannel_,  mcaPresetLowChannelString,     false);
+  if (!status) status = connectSignalParam(mcaPresetHighChannel_, mcaPresetHighChannelString,    false);
+  if (status) return;
+
+  // Connect to MCA_DATA for each signal of each board
+  pasynUserData_ = (asynUser **)callocMustSucceed(numBoards_*maxSignals_, sizeof(asynUser *), functionName);
+  for (addr=0; addr<numBoards_*maxSignals_; addr++) {
+    board = addr / maxSignals_;
+    signal = addr % maxSignals_;
+    status = pasynInt32ArraySyncIO->connect(boardPorts_[board], signal, &pasynUserData_[addr], mcaDataString);
+    if (status) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: cannot connect to %s signal %d for %s\n",
+                driverName, functionName, boardPorts_[board], signal, mcaDataString);
+      return;
+    }
+  }
+
+  setIntegerParam(SIS38XXMaxChannels_, maxChans_);
+  setIntegerParam(SIS38XXCurrentChannel_, 0);
+  for (addr=0; addr<numBoards_*maxSignals_; addr++) {
+    setIntegerParam(addr, mcaNumChannels_, maxChans_);
+    setIntegerParam(addr, mcaAcquiring_, 0);
+    setDoubleParam(addr, mcaElapsedCounts_, 0.0);
+    setDoubleParam(addr, mcaElapsedRealTime_, 0.0);
+    setDoubleParam(addr, mcaElapsedLiveTime_, 0.0);
+    callParamCallbacks(addr);
+  }
+  exists_ = true;
+
+  /* Create the thread that checks the board status while acquiring */
+  if (epicsThreadCreate("SIS38XXGroupThread",
+                         epicsThreadPriorityLow,
+                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                         (EPICSTHREADFUNC)pollThreadC,
+                         this) == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: epicsThreadCreate failure\n",
+              driverName, functionName);
+  }
+}
+
+/** Connects our parameter command to the parameter drvInfo at address 0 of each board */
+asynStatus drvSIS38XXGroup::connectParam(int command, const char *drvInfo, bool isFloat64)
+{
+  int board;
+  asynStatus status;
+  static const char* functionName="connectParam";
+
+  for (board=0; board<numBoards_; board++) {
+    if (isFloat64)
+      status = pasynFloat64SyncIO->connect(boardPorts_[board], 0, &pasynUserBoard_[board][command], drvInfo);
+    else
+      status = pasynInt32SyncIO->connect(boardPorts_[board], 0, &pasynUserBoard_[board][command], drvInfo);
+    if (status) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: cannot connect to %s for %s\n",
+                driverName, functionName, boardPorts_[board], drvInfo);
+      return status;
+    }
+  }
+  return asynSuccess;
+}
+
+/** Connects our parameter command at each address to the parameter drvInfo of the same signal of its board */
+asynStatus drvSIS38XXGroup::connectSignalParam(int command, const char *drvInfo, bool isFloat64)
+{
+  int addr;
+  asynStatus status;
+  static const char* functionName="connectSignalParam";
+
+  for (addr=0; addr<numBoards_*maxSignals_; addr++) {
+    if (isFloat64)
+      status = pasynFloat64SyncIO->connect(boardPorts_[addr/maxSignals_], addr%maxSignals_,
+                                           &pasynUserSignal_[addr][command], drvInfo);
+    else
+      status = pasynInt32SyncIO->connect(boardPorts_[addr/maxSignals_], addr%maxSignals_,
+                                         &pasynUserSignal_[addr][command], drvInfo);
+    if (status) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: cannot connect to %s signal %d for %s\n",
+                driverName, functionName, boardPorts_[addr/maxSignals_], addr%maxSignals_, drvInfo);
+      return status;
+    }
+  }
+  return asynSuccess;
+}
+
+/** Writes a value to one of the parameters of all of the boards */
+void drvSIS38XXGroup::writeBoards(int command, epicsInt32 value)
+{
+  int board;
+  asynStatus status;
+  static const char* functionName="writeBoards";
+
+  for (board=0; board<numBoards_; board++) {
+    status = pasynInt32SyncIO->write(pasynUserBoard_[board][command], value, SIS38XX_GROUP_TIMEOUT);
+    if (status)
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error writing command %d to %s, status=%d\n",
+                driverName, functionName, command, boardPorts_[board], status);
+  }
+}
+
+void drvSIS38XXGroup::writeBoardsFloat64(int command, epicsFloat64 value)
+{
+  int board;
+  asynStatus status;
+  static const char* functionName="writeBoardsFloat64";
+
+  for (board=0; board<numBoards_; board++) {
+    status = pasynFloat64SyncIO->write(pasynUserBoard_[board][command], value, SIS38XX_GROUP_TIMEOUT);
+    if (status)
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error writing command %d to %s, status=%d\n",
+                driverName, functionName, command, boardPorts_[board], status);
+  }
+}
+
+/** Writes a value to one of the per-signal parameters of the board signal for our address addr */
+void drvSIS38XXGroup::writeSignal(int addr, int command, epicsInt32 value)
+{
+  asynStatus status;
+  static const char* functionName="writeSignal";
+
+  status = pasynInt32SyncIO->write(pasynUserSignal_[addr][command], value, SIS38XX_GROUP_TIMEOUT);
+  if (status)
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: error writing command %d to %s signal %d, status=%d\n",
+              driverName, functionName, command, boardPorts_[addr/maxSignals_], addr%maxSignals_, status);
+}
+
+void drvSIS38XXGroup::writeSignalFloat64(int addr, int command, epicsFloat64 value)
+{
+  asynStatus status;
+  static const char* functionName="writeSignalFloat64";
+
+  status = pasynFloat64SyncIO->write(pasynUserSignal_[addr][command], value, SIS38XX_GROUP_TIMEOUT);
+  if (status)
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: error writing command %d to %s signal %d, status=%d\n",
+              driverName, functionName, command, boardPorts_[addr/maxSignals_], addr%maxSignals_, status);
+}
+
+/** Returns the number of channels that all of the boards have acquired.
+  * The MCA data of each board have BinFactor channels in each bin, so binned is set to the number
+  * of bins that all of the boards have acquired.  As in the board drivers, a partial bin is only
+  * counted when acquisition has stopped. */
+int drvSIS38XXGroup::alignedChannels(int *binned)
+{
+  int board;
+  int chans, binFactor, bins;
+  int aligned = -1;
+
+  *binned = -1;
+  for (board=0; board<numBoards_; board++) {
+    if (pasynInt32SyncIO->read(pasynUserBoard_[board][SIS38XXCurrentChannel_], &chans, SIS38XX_GROUP_TIMEOUT))
+      chans = 0;
+    if (pasynInt32SyncIO->read(pasynUserBoard_[board][SIS38XXBinFactor_], &binFactor, SIS38XX_GROUP_TIMEOUT) ||
+        (binFactor < 1))
+      binFactor = 1;
+    bins = acquiring_ ? chans/binFactor : (chans + binFactor - 1)/binFactor;
+    if ((aligned < 0) || (chans < aligned)) aligned = chans;
+    if ((*binned < 0) || (bins < *binned)) *binned = bins;
+  }
+  return aligned;
+}
+
+/** Reads the status of the boards.  If any board has stopped acquiring the others are stopped,
+  * so that they all have the same number of channels.
+  * Must be called with the asynPortDriver lock held. */
+void drvSIS38XXGroup::updateStatus()
+{
+  int board;
+  int addr;
+  int acquiring;
+  int numAcquiring = 0;
+  int binned;
+  double realTime = 0., liveTime = 0.;
+  static const char* functionName="updateStatus";
+
+  for (board=0; board<numBoards_; board++) {
+    if (pasynInt32SyncIO->read(pasynUserBoard_[board][mcaAcquiring_], &acquiring, SIS38XX_GROUP_TIMEOUT))
+      acquiring = 0;
+    if (acquiring) numAcquiring++;
+  }
+  if (acquiring_ && (numAcquiring < numBoards_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: %d of %d boards stopped, stopping all boards\n",
+              driverName, functionName, numBoards_ - numAcquiring, numBoards_);
+    if (numAcquiring > 0) writeBoards(mcaStopAcquire_, 1);
+    acquiring_ = false;
+  }
+  // The boards are started together, so the elapsed time of the first board is used for all of them
+  pasynFloat64SyncIO->read(pasynUserBoard_[0][mcaElapsedRealTime_], &realTime, SIS38XX_GROUP_TIMEOUT);
+  pasynFloat64SyncIO->read(pasynUserBoard_[0][mcaElapsedLiveTime_], &liveTime, SIS38XX_GROUP_TIMEOUT);
+  setIntegerParam(SIS38XXCurrentChannel_, alignedChannels(&binned));
+  for (addr=0; addr<numBoards_*maxSignals_; addr++) {
+    setIntegerParam(addr, mcaAcquiring_, acquiring_);
+    setDoubleParam(addr, mcaElapsedRealTime_, realTime);
+    setDoubleParam(addr, mcaElapsedLiveTime_, liveTime);
+    callParamCallbacks(addr);
+  }
+}
+
+asynStatus drvSIS38XXGroup::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+  int command = pasynUser->reason;
+  int addr;
+  asynStatus status = asynSuccess;
+  static const char* functionName = "writeInt32";
+
+  pasynManager->getAddr(pasynUser, &addr);
+  asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s:%s: entry, command=%d, addr=%d, value=%d\n",
+            driverName, functionName, command, addr, value);
+  if (!exists_) return asynError;
+
+  setIntegerParam(addr, command, value);
+
+  // The mca record for each address writes the commands, so the board-level commands are only
+  // sent when they change something, in the same way as the board drivers ignore them
+  if (command == mcaStartAcquire_) {
+    // The boards wait for the first channel advance, so starting them one after the other
+    // does not change the alignment
+    if (!acquiring_) {
+      acquiring_ = true;
+      erased_ = false;
+      writeBoards(command, value);
+      updateStatus();
+    }
+  }
+  else if (command == mcaStopAcquire_) {
+    if (acquiring_) {
+      writeBoards(command, value);
+      updateStatus();
+    }
+  }
+  else if (command == mcaErase_) {
+    // The boards only erase once until they are started again, except while acquiring
+    if (!erased_ || acquiring_) {
+      erased_ = true;
+      writeBoards(command, value);
+      updateStatus();
+    }
+  }
+  else if ((command == mcaAcquiring_) || (command == SIS38XXCurrentChannel_) ||
+           (command == SIS38XXMaxChannels_)) {
+    // Read-only
+    status = asynError;
+  }
+  else if (pasynUserSignal_[addr][command]) {
+    writeSignal(addr, command, value);
+    if (command == mcaReadStatus_) updateStatus();
+  }
+  else if (pasynUserBoard_[0][command]) {
+    // The board drivers use the value for signal 0
+    if (addr == 0) writeBoards(command, value);
+  }
+
+  callParamCallbacks(addr);
+  return status;
+}
+
+asynStatus drvSIS38XXGroup::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+  int command = pasynUser->reason;
+  int addr;
+  static const char* functionName = "writeFloat64";
+
+  pasynManager->getAddr(pasynUser, &addr);
+  asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s:%s: entry, command=%d, addr=%d, value=%f\n",
+            driverName, functionName, command, addr, value);
+  if (!exists_) return asynError;
+
+  setDoubleParam(addr, command, value);
+  if ((command == mcaElapsedRealTime_) || (command == mcaElapsedLiveTime_)) {
+    // Read-only
+  }
+  else if (pasynUserSignal_[addr][command]) {
+    writeSignalFloat64(addr, command, value);
+  }
+  else if (pasynUserBoard_[0][command]) {
+    // The board drivers use the value for signal 0
+    if (addr == 0) writeBoardsFloat64(command, value);
+  }
+  callParamCallbacks(addr);
+  return asynSuccess;
+}
+
+asynStatus drvSIS38XXGroup::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
+                                           size_t numRead, size_t *numActual)
+{
+  int command = pasynUser->reason;
+  int addr;
+  int binned;
+  size_t aligned;
+  asynStatus status;
+  static const char* functionName = "readInt32Array";
+
+  if (command != mcaData_)
+    return asynPortDriver::readInt32Array(pasynUser, data, numRead, numActual);
+  if (!exists_) return asynError;
+
+  pasynManager->getAddr(pasynUser, &addr);
+  // Find the channels that all boards have acquired before reading, a board can only
+  // have more channels when its data are read.  The data are binned, so the bins are compared.
+  alignedChannels(&binned);
+  aligned = binned;
+  status = pasynInt32ArraySyncIO->read(pasynUserData_[addr], data, numRead, numActual, SIS38XX_GROUP_TIMEOUT);
+  if (status) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: error reading %s signal %d, status=%d\n",
+              driverName, functionName, boardPorts_[addr/maxSignals_], addr%maxSignals_, status);
+    return status;
+  }
+  // Return only the channels that all of the boards have acquired
+  if (aligned > numRead) aligned = numRead;
+  if (*numActual > aligned) {
+    memset(data + aligned, 0, (*numActual - aligned)*sizeof(epicsInt32));
+    *numActual = aligned;
+  }
+  if (*numActual == 0) *numActual = 1;
+  return asynSuccess;
+}
+
+/** Detects when the boards have finished acquiring, even if no client reads the status */
+void drvSIS38XXGroup::pollThread()
+{
+  while (true) {
+    lock();
+    if (acquiring_) updateStatus();
+    unlock();
+    epicsThreadSleep(SIS38XX_GROUP_POLL_TIME);
+  }
+}
+
+static void pollThreadC(void *drvPvt)
+{
+  drvSIS38XXGroup *pPvt = (drvSIS38XXGroup *)drvPvt;
+
+  pPvt->pollThread();
+}
+
+/* Report  parameters */
+void drvSIS38XXGroup::report(FILE *fp, int details)
+{
+  int board;
+
+  fprintf(fp, "SIS38XX group %s, %d boards%s\n", portName, numBoards_,
+          exists_ ? "" : ", not connected to all boards");
+  if (details > 0) {
+    for (board=0; board<numBoards_; board++) fprintf(fp,
+                "  board %d = %s, signals %d-%d\n",
+                board, boardPorts_[board], board*maxSignals_, (board+1)*maxSignals_ - 1);
+    fprintf(fp, "  signals per board = %d\n", maxSignals_);
+    fprintf(fp, "  max channels      = %d\n", maxChans_);
+    fprintf(fp, "  acquiring         = %d\n", acquiring_);
+  }
+  // Call the base class method
+  asynPortDriver::report(fp, details);
+}
+
+extern "C" {
+
+/* Reads an integer parameter from a board */
+static int readBoardInt32(const char *boardPort, const char *drvInfo, int *value)
+{
+  asynUser *pasynUser;
+  asynStatus status;
+
+  status = pasynInt32SyncIO->connect(boardPort, 0, &pasynUser, drvInfo);
+  if (status) return status;
+  status = pasynInt32SyncIO->read(pasynUser, value, SIS38XX_GROUP_TIMEOUT);
+  pasynInt32SyncIO->disconnect(pasynUser);
+  return status;
+}
+
+/** Creates a port for the boards in boardPorts, a list of port names separated by spaces or commas.
+  * The boards must already have been configured, and must have the same number of signals. */
+int drvSIS38XXGroupConfig(const char *portName, const char *boardPorts)
+{
+  char *ports;
+  char *port;
+  char *last;
+  const char *boards[SIS38XX_GROUP_MAX_BOARDS];
+  int numBoards = 0;
+  int maxSignals = 0, maxChans = 0;
+  int signals, chans;
+  int i;
+  drvSIS38XXGroup *pGroup;
+
+  ports = epicsStrDup(boardPorts);
+  for (port = epicsStrtok_r(ports, " ,", &last); port; port = epicsStrtok_r(NULL, " ,", &last)) {
+    if (numBoards == SIS38XX_GROUP_MAX_BOARDS) {
+      errlogPrintf("drvSIS38XXGroupConfig: too many boards, maximum=%d\n", SIS38XX_GROUP_MAX_BOARDS);
+      goto error;
+    }
+    boards[numBoards++] = port;
+  }
+  if (numBoards == 0) {
+    errlogPrintf("drvSIS38XXGroupConfig: no boards\n");
+    goto error;
+  }
+  for (i=0; i<numBoards; i++) {
+    if (readBoardInt32(boards[i], SCALER_CHANNELS_COMMAND_STRING, &signals) ||
+        readBoardInt32(boards[i], SIS38XXMaxChannelsString, &chans)) {
+      errlogPrintf("drvSIS38XXGroupConfig: cannot read board %s\n", boards[i]);
+      goto error;
+    }
+    if (i == 0) {
+      maxSignals = signals;
+      maxChans = chans;
+    }
+    if (signals != maxSignals) {
+      errlogPrintf("drvSIS38XXGroupConfig: board %s has %d signals, must be %d\n",
+                   boards[i], signals, maxSignals);
+      goto error;
+    }
+    if (chans < maxChans) maxChans = chans;
+  }
+  pGroup = new drvSIS38XXGroup(portName, numBoards, boards, maxSignals, maxChans);
+  pGroup = NULL;
+  free(ports);
+  return 0;
+
+error:
+  free(ports);
+  return -1;
+}
+
+/* iocsh config function */
+static const iocshArg drvSIS38XXGroupConfigArg0 = { "Asyn port name", iocshArgString};
+static const iocshArg drvSIS38XXGroupConfigArg1 = { "Board ports",    iocshArgString};
+
+static const iocshArg * const drvSIS38XXGroupConfigArgs[] =
+{ &drvSIS38XXGroupConfigArg0,
+  &drvSIS38XXGroupConfigArg1
+};
+
+static const iocshFuncDef drvSIS38XXGroupConfigFuncDef =
+  {"drvSIS38XXGroupConfig",2,drvSIS38XXGroupConfigArgs};
+
+static void drvSIS38XXGroupConfigCallFunc(const iocshArgBuf *args)
+{
+  drvSIS38XXGroupConfig(args[0].sval, args[1].sval);
+}
+
+void drvSIS38XXGroupRegister(void)
+{
+  iocshRegister(&drvSIS38XXGroupConfigFuncDef,drvSIS38XXGroupConfigCallFunc);
+}
+
+epicsExportRegistrar(drvSIS38XXGroupRegister);
+
+} // extern "C"
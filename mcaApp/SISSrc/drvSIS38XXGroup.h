@@ -0,0 +1,102 @@
+/* File:    drvSIS38XXGroup.h
+ *
+ * Purpose:
+ * This module presents several SIS3820 or SIS3801 boards as a single MCA port.
+ * Each board is configured as usual with drvSIS3820Config, and this port then
+ * has nBoards*maxSignals signals.  Address N is signal N%maxSignals of board
+ * N/maxSignals.
+ *
+ * The boards must share the same channel advance (LNE) signal, so that channel N
+ * is the same time bin on every board.  The boards are started, stopped and erased together,
+ * and when one board stops the others are stopped.  The settings that apply to a whole board
+ * (number of channels, dwell time, ...) are taken from address 0, as the board drivers take
+ * them from signal 0, and are sent to each board once.  The settings for one signal (preset
+ * counts, ...) are only sent to that signal of its board.
+ * The MCA data are only returned for the channels that all boards have acquired, so
+ * the data for the signals of all boards are always aligned.
+ *
+ * The SIS38XX specific settings (input mode, output mode, LED, ...) are still done on the
+ * individual board ports.
+ *
+ */
+
+#ifndef DRVSIS38XXGROUP_H
+#define DRVSIS38XXGROUP_H
+
+#include <asynPortDriver.h>
+#include <epicsTypes.h>
+
+#define SIS38XX_GROUP_MAX_BOARDS 8
+
+/* Time between checks of the board status while acquiring */
+#define SIS38XX_GROUP_POLL_TIME 0.1
+
+class drvSIS38XXGroup : public asynPortDriver
+{
+  public:
+  drvSIS38XXGroup(const char *portName, int numBoards, const char **boardPorts,
+                  int maxSignals, int maxChans);
+
+  // These are the methods we override from asynPortDriver
+  asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+  asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+  asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *data,
+                            size_t maxChans, size_t *nactual);
+  virtual void report(FILE *fp, int details);
+  void pollThread(); // Should be private, but called from C callback function
+
+  protected:
+  #define FIRST_SIS38XX_GROUP_PARAM mcaStartAcquire_
+  int mcaStartAcquire_;
+  int mcaStopAcquire_;
+  int mcaErase_;
+  int mcaData_;
+  int mcaReadStatus_;
+  int mcaChannelAdvanceSource_;
+  int mcaNumChannels_;
+  int mcaDwellTime_;
+  int mcaPresetLiveTime_;
+  int mcaPresetRealTime_;
+  int mcaPresetCounts_;
+  int mcaPresetLowChannel_;
+  int mcaPresetHighChannel_;
+  int mcaPresetSweeps_;
+  int mcaAcquireMode_;
+  int mcaSequence_;
+  int mcaPrescale_;
+  int mcaAcquiring_;
+  int mcaElapsedLiveTime_;
+  int mcaElapsedRealTime_;
+  int mcaElapsedCounts_;
+  int SIS38XXCurrentChannel_;
+  int SIS38XXMaxChannels_;
+  int SIS38XXBinFactor_;
+  #define LAST_SIS38XX_GROUP_PARAM SIS38XXBinFactor_
+
+  private:
+  asynStatus connectParam(int command, const char *drvInfo, bool isFloat64);
+  asynStatus connectSignalParam(int command, const char *drvInfo, bool isFloat64);
+  void writeBoards(int command, epicsInt32 value);
+  void writeBoardsFloat64(int command, epicsFloat64 value);
+  void writeSignal(int addr, int command, epicsInt32 value);
+  void writeSignalFloat64(int addr, int command, epicsFloat64 value);
+  int alignedChannels(int *binned);
+  void updateStatus();
+  int numBoards_;
+  int maxSignals_;         // Signals per board
+  int maxChans_;
+  bool acquiring_;
+  bool erased_;            // Erase has been sent to the boards since they were last started
+  bool exists_;            // Construction finished, all of the board parameters are connected
+  char *boardPorts_[SIS38XX_GROUP_MAX_BOARDS];
+  // asynUsers for the parameters of each board at address 0, indexed by our parameter number
+  asynUser **pasynUserBoard_[SIS38XX_GROUP_MAX_BOARDS];
+  // asynUsers for the per-signal parameters, indexed by our address and parameter number
+  asynUser ***pasynUserSignal_;
+  // asynUsers for MCA_DATA, indexed by our address
+  asynUser **pasynUserData_;
+};
+
+#define NUM_SIS38XX_GROUP_PARAMS (int)(&LAST_SIS38XX_GROUP_PARAM - &FIRST_SIS38XX_GROUP_PARAM + 1)
+
+#endif
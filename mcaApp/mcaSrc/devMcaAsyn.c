@@ -61,6 +61,10 @@ typedef struct {
     void *asynDrvUserPvt;
     size_t nread;
     int *data;
+    /* Read position used by the driver when the link specifies mcaDataNewString.
+     * Only new channels are read, and they are appended to the record array at firstChan. */
+    mcaDataCursor *pCursor;
+    int firstChan;
     double elapsedLive;
     double elapsedReal;
     double dwellTime;
@@ -203,6 +207,18 @@ static long init_record(mcaRecord *pmca)
     if (findDrvInfo(pmca, pasynUser, mcaElapsedRealTimeString,         mcaElapsedRealTime)) goto bad;
     if (findDrvInfo(pmca, pasynUser, mcaElapsedCountsString,           mcaElapsedCounts)) goto bad;
 
+    /* If the link is @asyn(port addr)MCA_DATA_NEW then do incremental reads, if the driver supports them */
+    if (userParam && (strcmp(userParam, mcaDataNewString) == 0)) {
+        pasynUser->drvUser = NULL;
+        if (findDrvInfo(pmca, pasynUser, mcaDataNewString, mcaData) || !pasynUser->drvUser) {
+            asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                      "devMcaAsyn::init_record, %s driver does not support %s, reading all channels\n",
+                      pmca->name, mcaDataNewString);
+            if (findDrvInfo(pmca, pasynUser, mcaDataString, mcaData)) goto bad;
+        } else {
+            pPvt->pCursor = pasynUser->drvUser;
+        }
+    }
 
     return(0);
 bad:
@@ -354,8 +370,10 @@ static void asynCallback(asynUser *pasynUser)
 
     if (pmsg->command == mcaData) {
         /* Read data */
+       if (pPvt->pCursor) pasynUser->drvUser = pPvt->pCursor;
        pPvt->pasynInt32Array->read(pPvt->asynInt32ArrayPvt, pasynUser, 
                                    pPvt->data, pmca->nuse, &pPvt->nread);
+       if (pPvt->pCursor) pPvt->firstChan = pPvt->pCursor->firstChan;
        dbScanLock((dbCommon *)pmca);
        (*prset->process)(pmca);
        dbScanUnlock((dbCommon *)pmca);
@@ -405,6 +423,23 @@ static long read_array(mcaRecord *pmca)
     mcaAsynPvt *pPvt = (mcaAsynPvt *)pmca->dpvt;
     asynUser *pasynUser = pPvt->pasynUser;
 
+    if (pPvt->pCursor) {
+        /* Incremental read, append the new channels to the record array */
+        int *pData = (int *)pmca->bptr;
+        int firstChan = pPvt->firstChan;
+        if (firstChan + (int)pPvt->nread > pmca->nmax) firstChan = pmca->nmax - pPvt->nread;
+        memcpy(pData + firstChan, pPvt->data, pPvt->nread*sizeof(int));
+        /* If the driver started again from channel 0 then clear anything left from before */
+        if ((firstChan == 0) && ((int)pmca->nord > (int)pPvt->nread))
+            memset(pData + pPvt->nread, 0, (pmca->nord - pPvt->nread)*sizeof(int));
+        pmca->udf=0;
+        pmca->nord = firstChan + pPvt->nread;
+        asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+                  "devMcaAsyn::read_value, record=%s, appended %d at %d, nord=%d\n",
+                  pmca->name, (int)pPvt->nread, firstChan, pmca->nord);
+        return(0);
+    }
+
     /* Copy data from private buffer to record */
     memcpy(pmca->bptr, pPvt->data, pPvt->nread*sizeof(long));  
     pmca->udf=0;
@@ -37,5 +37,18 @@ enum MCAChannelAdvanceSource {
 #define mcaElapsedLiveTimeString        "MCA_ELAPSED_LIVE"  /* float64, read */
 #define mcaElapsedRealTimeString        "MCA_ELAPSED_REAL"  /* float64, read */
 #define mcaElapsedCountsString          "MCA_ELAPSED_COUNTS" /* float64, read */
+#define mcaDataNewString                "MCA_DATA_NEW"      /* int32Array, read */
+
+/* Read position of one client for mcaDataNewString.
+ * Drivers that support incremental reads allocate one of these in drvUserCreate for
+ * mcaDataNewString and store it in pasynUser->drvUser.  Each read returns only the channels
+ * acquired since the previous read by the same client.  data[0] is channel firstChan,
+ * and no channel >= nElements is returned, so the client can copy the data to
+ * its own array at offset firstChan.  firstChan is 0 after the driver has been erased. */
+typedef struct {
+    int firstChan;  /* Channel number of data[0] in the last read */
+    int nextChan;   /* First channel that has not been returned to this client */
+    int epoch;      /* Driver erase counter when nextChan was last updated */
+} mcaDataCursor;
 
 #endif /* drvMcaH */